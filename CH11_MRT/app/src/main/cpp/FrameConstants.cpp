@@ -0,0 +1,73 @@
+#include "FrameConstants.h"
+
+#include <cstring>
+
+#include "AndroidOut.h"
+
+void SetAspectOrtho(GLfloat *matrix, GLsizei width, GLsizei height) {
+    SetIdentity(matrix);
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    if (width > height) {
+        matrix[0] = (GLfloat) height / (GLfloat) width;
+    } else {
+        matrix[5] = (GLfloat) width / (GLfloat) height;
+    }
+}
+
+void SetIdentity(GLfloat *matrix) {
+    for (int i = 0; i < 16; i++) {
+        matrix[i] = i % 5 == 0 ? 1.0f : 0.0f;
+    }
+}
+
+FrameConstantsBuffer::FrameConstantsBuffer(GLStateCache *stateCache)
+        : stateCache_(stateCache), buffer_(0), slotSize_(0), slot_(-1), fences_() {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    slotSize_ = (sizeof(FrameConstants) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &buffer_);
+    stateCache_->BindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, slotSize_ * kSlots, nullptr, GL_DYNAMIC_DRAW);
+}
+
+FrameConstantsBuffer::~FrameConstantsBuffer() {
+    for (GLsync fence : fences_) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    stateCache_->DeleteBuffers(1, &buffer_);
+}
+
+void FrameConstantsBuffer::Update(const FrameConstants &constants) {
+    // The draws of the previous frame have all been issued by now
+    if (slot_ >= 0) {
+        fences_[slot_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    slot_ = (slot_ + 1) % kSlots;
+
+    // Only blocks if the GPU is kSlots frames behind
+    if (fences_[slot_]) {
+        glClientWaitSync(fences_[slot_], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fences_[slot_]);
+        fences_[slot_] = nullptr;
+    }
+
+    GLintptr offset = slotSize_ * slot_;
+    stateCache_->BindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    void *mapped = glMapBufferRange(GL_UNIFORM_BUFFER, offset, sizeof(FrameConstants),
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+                                    | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!mapped) {
+        aout << "FrameConstantsBuffer: glMapBufferRange failed" << std::endl;
+        return;
+    }
+    memcpy(mapped, &constants, sizeof(FrameConstants));
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+
+    stateCache_->BindBufferRange(GL_UNIFORM_BUFFER, ES_FRAME_CONSTANTS_BINDING, buffer_, offset,
+                                 sizeof(FrameConstants));
+}
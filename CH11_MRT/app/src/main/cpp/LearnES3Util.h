@@ -50,6 +50,9 @@
 // #include <android_native_app_glue.h>
 #include <time.h>
 
+#include "FrameConstants.h"
+#include "ProgramCache.h"
+
 ///
 //  Macros
 //
@@ -146,9 +149,11 @@ GLuint esLoadShader(GLenum type, const char *shaderSrc) {
 //         Errors output to log.
 /// \param vertShaderSrc Vertex shader source code
 /// \param fragShaderSrc Fragment shader source code
+/// \param retrievable Sets GL_PROGRAM_BINARY_RETRIEVABLE_HINT before linking
 /// \return A new program object linked with the vertex/fragment shader pair, 0 on failure
 //
-GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc )
+GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc,
+                                  GLboolean retrievable = GL_FALSE )
 {
    GLuint vertexShader;
    GLuint fragmentShader;
@@ -182,6 +187,11 @@ GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragSha
    glAttachShader ( programObject, vertexShader );
    glAttachShader ( programObject, fragmentShader );
 
+   if ( retrievable )
+   {
+      glProgramParameteri ( programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+   }
+
    // Link the program
    glLinkProgram ( programObject );
 
@@ -208,6 +218,9 @@ GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragSha
       return 0;
    }
 
+   // Share the per-frame uniform buffer with every other program
+   esBindFrameConstantsBlock ( programObject );
+
    // Free up no longer needed shader resources
    glDeleteShader ( vertexShader );
    glDeleteShader ( fragmentShader );
@@ -215,6 +228,39 @@ GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragSha
    return programObject;
 }
 
+//
+///
+/// \brief Same as esLoadProgram, but goes through a program binary cache first.
+/// \param cache Cache to look in and fill, compiles from source when NULL
+/// \param vertShaderSrc Vertex shader source code
+/// \param fragShaderSrc Fragment shader source code
+/// \return A new program object, 0 on failure
+//
+inline GLuint ESUTIL_API esLoadProgramCached ( ProgramCache *cache, const char *vertShaderSrc,
+                                               const char *fragShaderSrc )
+{
+   GLuint programObject;
+
+   if ( cache == NULL )
+   {
+      return esLoadProgram ( vertShaderSrc, fragShaderSrc );
+   }
+
+   programObject = cache->Load ( vertShaderSrc, fragShaderSrc,
+                                 [] ( const char *vert, const char *frag )
+                                 {
+                                    return esLoadProgram ( vert, frag, GL_TRUE );
+                                 } );
+
+   // glProgramBinary resets the block bindings like a fresh link does
+   if ( programObject != 0 )
+   {
+      esBindFrameConstantsBlock ( programObject );
+   }
+
+   return programObject;
+}
+
 //
 /// \brief Generates geometry for a sphere.  Allocates memory for the vertex data and stores
 ///        the results in the arrays.  Generate index list for a TRIANGLE_STRIP
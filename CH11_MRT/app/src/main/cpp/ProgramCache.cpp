@@ -0,0 +1,194 @@
+#include "ProgramCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "AndroidOut.h"
+
+namespace {
+
+// Bump when the file layout changes
+const unsigned int kMagic = 0x50425331;  // "PBS1"
+
+struct BinaryHeader {
+    unsigned int magic;
+    GLenum format;
+    unsigned int length;
+    unsigned int reserved;
+    unsigned long long key;
+};
+
+// 64-bit FNV-1a, continued from hash
+unsigned long long HashBytes(unsigned long long hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Includes the terminator so that "ab" + "c" and "a" + "bc" hash differently
+unsigned long long HashString(unsigned long long hash, const char *text) {
+    if (!text) {
+        text = "";
+    }
+    return HashBytes(hash, text, strlen(text) + 1);
+}
+
+const unsigned long long kFnvOffset = 14695981039346656037ull;
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+}  // namespace
+
+ProgramCache::ProgramCache(const std::string &directory)
+        : directory_(directory),
+          driverHash_(kFnvOffset),
+          enabled_(false),
+          hits_(0),
+          misses_(0),
+          rejected_(0),
+          hitMs_(0.0),
+          missMs_(0.0) {
+    driverHash_ = HashString(driverHash_, (const char *) glGetString(GL_RENDERER));
+    driverHash_ = HashString(driverHash_, (const char *) glGetString(GL_VERSION));
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    enabled_ = formats > 0 && !directory_.empty();
+    if (!enabled_) {
+        aout << "ProgramCache: disabled, " << formats << " binary formats" << std::endl;
+    }
+}
+
+GLuint ProgramCache::Load(const char *vertShaderSrc, const char *fragShaderSrc,
+                          ProgramLinkFunc link) {
+    GLuint program = Find(vertShaderSrc, fragShaderSrc);
+    if (program) {
+        return program;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    program = link(vertShaderSrc, fragShaderSrc);
+    Store(vertShaderSrc, fragShaderSrc, program, MsSince(start));
+    return program;
+}
+
+GLuint ProgramCache::Find(const char *vertShaderSrc, const char *fragShaderSrc) {
+    if (!enabled_) {
+        return 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long key = Key(vertShaderSrc, fragShaderSrc);
+    GLuint program = LoadBinary(key);
+    if (program) {
+        double ms = MsSince(start);
+        hits_++;
+        hitMs_ += ms;
+        aout << "ProgramCache: hit " << std::hex << key << std::dec << " in " << ms << " ms"
+             << std::endl;
+    }
+    return program;
+}
+
+void ProgramCache::Store(const char *vertShaderSrc, const char *fragShaderSrc, GLuint program,
+                         double buildMs) {
+    unsigned long long key = Key(vertShaderSrc, fragShaderSrc);
+    if (program && enabled_) {
+        StoreBinary(key, program);
+    }
+
+    misses_++;
+    missMs_ += buildMs;
+    aout << "ProgramCache: miss " << std::hex << key << std::dec << " in " << buildMs << " ms"
+         << std::endl;
+}
+
+unsigned long long ProgramCache::Key(const char *vertShaderSrc, const char *fragShaderSrc) const {
+    unsigned long long key = HashString(driverHash_, vertShaderSrc);
+    return HashString(key, fragShaderSrc);
+}
+
+std::string ProgramCache::PathFor(unsigned long long key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/program_%016llx.bin", key);
+    return directory_ + name;
+}
+
+GLuint ProgramCache::LoadBinary(unsigned long long key) {
+    std::string path = PathFor(key);
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+
+    BinaryHeader header;
+    std::vector<char> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+                 && header.magic == kMagic && header.key == key && header.length > 0;
+    if (valid) {
+        binary.resize(header.length);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+
+    GLuint program = 0;
+    if (valid) {
+        program = glCreateProgram();
+        glProgramBinary(program, header.format, binary.data(), (GLsizei) binary.size());
+
+        GLint linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    // Usually a driver update that kept the version string, the fresh link replaces the file
+    if (!program) {
+        aout << "ProgramCache: rejected " << path << std::endl;
+        rejected_++;
+        remove(path.c_str());
+    }
+    return program;
+}
+
+void ProgramCache::StoreBinary(unsigned long long key, GLuint program) const {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    BinaryHeader header = { kMagic, 0, 0, 0, key };
+    std::vector<char> binary(length);
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &header.format, binary.data());
+    if (written <= 0) {
+        return;
+    }
+    header.length = (unsigned int) written;
+
+    // Write to a temporary name first so that a killed process never leaves half a binary
+    std::string path = PathFor(key);
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        aout << "ProgramCache: cannot write " << temporary << std::endl;
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(binary.data(), 1, written, file) == (size_t) written;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+    }
+}
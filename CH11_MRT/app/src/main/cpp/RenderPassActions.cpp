@@ -0,0 +1,94 @@
+#include "RenderPassActions.h"
+
+#include "AndroidOut.h"
+
+RenderPassActions::RenderPassActions(const char *name)
+        : name_(name),
+          invalidate_(true),
+          width_(0),
+          height_(0),
+          windowPasses_(0),
+          windowSavedBytes_(0.0),
+          windowTotalBytes_(0.0) {}
+
+void RenderPassActions::AddAttachment(GLenum attachment, GLsizei bytesPerPixel, LoadAction load,
+                                      StoreAction store) {
+    attachments_.push_back({ attachment, bytesPerPixel, load, store });
+}
+
+GLbitfield RenderPassActions::ClearBits(GLenum attachment) {
+    switch (attachment) {
+        case GL_DEPTH:
+        case GL_DEPTH_ATTACHMENT:
+            return GL_DEPTH_BUFFER_BIT;
+        case GL_STENCIL:
+        case GL_STENCIL_ATTACHMENT:
+            return GL_STENCIL_BUFFER_BIT;
+        case GL_DEPTH_STENCIL_ATTACHMENT:
+            return GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+        default:
+            return GL_COLOR_BUFFER_BIT;
+    }
+}
+
+void RenderPassActions::Begin(GLenum target, GLsizei width, GLsizei height) {
+    width_ = width;
+    height_ = height;
+
+    GLbitfield clear = 0;
+    invalid_.clear();
+    for (const AttachmentActions &actions : attachments_) {
+        double bytes = (double) width_ * height_ * actions.bytesPerPixel;
+        windowTotalBytes_ += 2.0 * bytes;
+
+        if (actions.load == LoadAction::kLoad) {
+            continue;
+        }
+        // Either way the tile starts out without reading memory
+        windowSavedBytes_ += bytes;
+        if (actions.load == LoadAction::kDontCare && invalidate_) {
+            invalid_.push_back(actions.attachment);
+        } else {
+            clear |= ClearBits(actions.attachment);
+        }
+    }
+
+    if (!invalid_.empty()) {
+        glInvalidateFramebuffer(target, (GLsizei) invalid_.size(), invalid_.data());
+    }
+    if (clear) {
+        glClear(clear);
+    }
+}
+
+void RenderPassActions::End(GLenum target) {
+    invalid_.clear();
+    if (invalidate_) {
+        for (const AttachmentActions &actions : attachments_) {
+            if (actions.store == StoreAction::kInvalidate) {
+                invalid_.push_back(actions.attachment);
+                windowSavedBytes_ += (double) width_ * height_ * actions.bytesPerPixel;
+            }
+        }
+    }
+
+    if (!invalid_.empty()) {
+        glInvalidateFramebuffer(target, (GLsizei) invalid_.size(), invalid_.data());
+    }
+    windowPasses_++;
+}
+
+void RenderPassActions::LogStats() {
+    if (windowPasses_ == 0) {
+        return;
+    }
+    aout << "Render pass " << name_ << ": " << width_ << "x" << height_ << ", invalidation "
+         << (invalidate_ ? "on" : "off") << ", about " << windowSavedBytes_ / windowPasses_
+         << " of " << windowTotalBytes_ / windowPasses_
+         << " bytes of loads and stores saved per frame over " << windowPasses_ << " frames"
+         << std::endl;
+
+    windowPasses_ = 0;
+    windowSavedBytes_ = 0.0;
+    windowTotalBytes_ = 0.0;
+}
@@ -0,0 +1,99 @@
+#ifndef LEARNES3_RENDERPASSACTIONS_H
+#define LEARNES3_RENDERPASSACTIONS_H
+
+#include <GLES3/gl3.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*!
+ * What becomes of an attachment's contents when a pass starts.
+ */
+enum class LoadAction {
+    // Kept from before the pass, a tiled GPU reads them into tile memory
+    kLoad,
+    // Cleared with glClear
+    kClear,
+    // Undefined, for passes that overwrite every pixel
+    kDontCare
+};
+
+/*!
+ * What becomes of an attachment's contents when a pass ends.
+ */
+enum class StoreAction {
+    // Written back to memory for later passes
+    kStore,
+    // Dropped, nothing reads them again
+    kInvalidate
+};
+
+struct AttachmentActions {
+    // GL_COLOR_ATTACHMENTi, GL_DEPTH_ATTACHMENT, ... of an FBO, or GL_COLOR, GL_DEPTH and
+    // GL_STENCIL of the default framebuffer
+    GLenum attachment;
+    GLsizei bytesPerPixel;
+    LoadAction load;
+    StoreAction store;
+};
+
+/*!
+ * Load and store actions of one render pass, carried out with glClear and
+ * glInvalidateFramebuffer.
+ *
+ * A tiled GPU renders each tile in on-chip memory. Unless told otherwise it reads every
+ * attachment into the tile first and writes it all back afterwards, even contents nobody reads.
+ * Clearing or invalidating before the pass skips the read, invalidating after it skips the
+ * write. Immediate mode GPUs ignore the hints.
+ *
+ * The bytes a pass keeps off the memory bus are estimated from the attachment sizes against
+ * loading and storing everything. With invalidation off nothing is invalidated and kDontCare
+ * falls back to a clear, for comparing the two.
+ */
+class RenderPassActions {
+public:
+    explicit RenderPassActions(const char *name);
+
+    void AddAttachment(GLenum attachment, GLsizei bytesPerPixel, LoadAction load,
+                       StoreAction store);
+
+    void SetInvalidate(bool invalidate) { invalidate_ = invalidate; }
+    bool Invalidate() const { return invalidate_; }
+
+    /*!
+     * At the start of the pass, with its framebuffer bound to target and its draw buffers set.
+     * Invalidates the kDontCare attachments and clears the kClear ones. glClear covers every
+     * draw buffer, so a pass mixing kClear and kDontCare colors clears them all.
+     */
+    void Begin(GLenum target, GLsizei width, GLsizei height);
+
+    /*!
+     * At the end of the pass, with its framebuffer bound to target: invalidates the kInvalidate
+     * attachments.
+     */
+    void End(GLenum target);
+
+    /*!
+     * Passes in the current report window, and a log line of the window that starts a new one.
+     */
+    int WindowPasses() const { return windowPasses_; }
+    void LogStats();
+
+private:
+    static GLbitfield ClearBits(GLenum attachment);
+
+    std::string name_;
+    std::vector<AttachmentActions> attachments_;
+    bool invalidate_;
+
+    // Size given to Begin, End counts with it
+    GLsizei width_;
+    GLsizei height_;
+    std::vector<GLenum> invalid_;
+
+    int windowPasses_;
+    double windowSavedBytes_;
+    double windowTotalBytes_;
+};
+
+#endif //LEARNES3_RENDERPASSACTIONS_H
@@ -0,0 +1,76 @@
+#include "RenderTargetPool.h"
+
+RenderTargetPool::RenderTargetPool(TextureFactory *textureFactory, GLsizei granularity,
+                                   size_t maxIdle)
+        : textureFactory_(textureFactory),
+          granularity_(granularity > 0 ? granularity : 1),
+          maxIdle_(maxIdle),
+          allocations_(0),
+          reuses_(0) {}
+
+RenderTargetPool::~RenderTargetPool() {
+    for (Target &target : idle_) {
+        textureFactory_->Destroy(&target.texture);
+    }
+}
+
+void RenderTargetPool::Bucket(GLsizei width, GLsizei height, GLsizei *bucketWidth,
+                              GLsizei *bucketHeight) const {
+    *bucketWidth = (width + granularity_ - 1) / granularity_ * granularity_;
+    *bucketHeight = (height + granularity_ - 1) / granularity_ * granularity_;
+}
+
+GLuint RenderTargetPool::Acquire(GLenum internalFormat, GLsizei width, GLsizei height,
+                                 GLsizei *bucketWidth, GLsizei *bucketHeight) {
+    Target target = { 0, internalFormat, 0, 0 };
+    Bucket(width, height, &target.width, &target.height);
+    *bucketWidth = target.width;
+    *bucketHeight = target.height;
+
+    // Most recently released first, it is the likeliest to still be resident
+    for (size_t i = idle_.size(); i-- > 0;) {
+        const Target &candidate = idle_[i];
+        if (candidate.internalFormat == internalFormat && candidate.width == target.width
+            && candidate.height == target.height) {
+            target = candidate;
+            idle_.erase(idle_.begin() + i);
+            used_.push_back(target);
+            reuses_++;
+            return target.texture;
+        }
+    }
+
+    TextureDesc desc = { GL_TEXTURE_2D, internalFormat, target.width, target.height, 1, 1 };
+    target.texture = textureFactory_->Create(desc);
+    if (target.texture) {
+        used_.push_back(target);
+        allocations_++;
+    }
+    return target.texture;
+}
+
+void RenderTargetPool::Release(GLuint *texture) {
+    for (size_t i = 0; i < used_.size(); i++) {
+        if (used_[i].texture == *texture) {
+            idle_.push_back(used_[i]);
+            used_.erase(used_.begin() + i);
+            break;
+        }
+    }
+    *texture = 0;
+
+    while (idle_.size() > maxIdle_) {
+        textureFactory_->Destroy(&idle_.front().texture);
+        idle_.erase(idle_.begin());
+    }
+}
+
+size_t RenderTargetPool::IdleBytes() const {
+    size_t bytes = 0;
+    for (const Target &target : idle_) {
+        TextureDesc desc = { GL_TEXTURE_2D, target.internalFormat, target.width, target.height,
+                             1, 1 };
+        bytes += TextureFactory::StorageBytes(desc);
+    }
+    return bytes;
+}
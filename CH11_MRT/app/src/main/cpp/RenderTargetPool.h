@@ -0,0 +1,75 @@
+#ifndef LEARNES3_RENDERTARGETPOOL_H
+#define LEARNES3_RENDERTARGETPOOL_H
+
+#include <GLES3/gl3.h>
+#include <cstddef>
+#include <vector>
+
+#include "TextureFactory.h"
+
+/*!
+ * Keeps render target textures that went out of use, so that a size seen before is served
+ * without allocating. Sizes are rounded up to buckets of a fixed granularity, so a target is
+ * usually a bit larger than asked for and the caller renders into its lower left corner.
+ *
+ * Rotating a device flips between two sizes; with both kept idle the second and every later
+ * rotation reuses them. The least recently released textures beyond the idle limit are
+ * destroyed. Every texture is a single level 2D texture from the TextureFactory. Must be used
+ * and destroyed with the GL context current.
+ */
+class RenderTargetPool {
+public:
+    /*!
+     * @param granularity both dimensions are rounded up to a multiple of it
+     * @param maxIdle textures kept after Release, older ones are destroyed
+     */
+    RenderTargetPool(TextureFactory *textureFactory, GLsizei granularity, size_t maxIdle);
+
+    /*!
+     * Destroys the idle textures. Acquired ones must have been released.
+     */
+    virtual ~RenderTargetPool();
+
+    /*!
+     * Returns a texture of internalFormat that covers width x height, reused if one of the same
+     * bucket is idle. Its real size goes to bucketWidth and bucketHeight.
+     */
+    GLuint Acquire(GLenum internalFormat, GLsizei width, GLsizei height, GLsizei *bucketWidth,
+                   GLsizei *bucketHeight);
+
+    /*!
+     * Hands a texture from Acquire back and sets it to 0.
+     */
+    void Release(GLuint *texture);
+
+    /*!
+     * Size Acquire would return for width x height.
+     */
+    void Bucket(GLsizei width, GLsizei height, GLsizei *bucketWidth, GLsizei *bucketHeight) const;
+
+    // Counts since construction, and what is idle now
+    int Allocations() const { return allocations_; }
+    int Reuses() const { return reuses_; }
+    size_t IdleTextures() const { return idle_.size(); }
+    size_t IdleBytes() const;
+
+private:
+    struct Target {
+        GLuint texture;
+        GLenum internalFormat;
+        GLsizei width;
+        GLsizei height;
+    };
+
+    TextureFactory *textureFactory_;
+    GLsizei granularity_;
+    size_t maxIdle_;
+    // Idle, oldest release first
+    std::vector<Target> idle_;
+    // Acquired
+    std::vector<Target> used_;
+    int allocations_;
+    int reuses_;
+};
+
+#endif //LEARNES3_RENDERTARGETPOOL_H
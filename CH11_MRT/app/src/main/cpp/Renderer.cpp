@@ -7,11 +7,15 @@
 
 
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "AndroidOut.h"
 #include "LearnES3Util.h"
+#include "GLStateCache.h"
 
 //! executes glGetString and outputs the result to logcat
 #define PRINT_GL_STRING(s) { aout << #s": " << glGetString(s) << std::endl; }
@@ -38,12 +42,42 @@ aout << std::endl;\
 //! Color for cornflower blue. Can be sent directly to glClearColor
 #define CORNFLOWER_BLUE 100 / 255.f, 149 / 255.f, 237 / 255.f, 1
 
+// Room for a few frames of dynamic geometry, so the ring never catches up with the GPU
+static const GLsizeiptr kStreamBufferSize = 4 * 1024 * 1024;
+
+// Color textures of the FBO, also the MRT_COUNT of the fragment shader
+static const int kColorTargets = 4;
+
+// MRT resolution relative to the window surface
+static const float kRenderScale = 1.0f;
+
+// Target sizes are rounded up to this, so small surface changes keep the textures
+static const GLsizei kTargetGranularity = 64;
+
+// Both orientations' targets stay in the pool, so rotating back allocates nothing
+static const size_t kIdleTargets = 2 * kColorTargets;
+
+// Frames a new surface size has to hold before the targets follow it. Rotation and split
+// screen resize over several frames, this allocates once for the final size.
+static const int kResizeSettleFrames = 3;
+
+// Invalidate attachments whose contents are not needed, off to measure what it saves
+static const bool kInvalidateAttachments = true;
+
+// Frames per log line of estimated bandwidth saved by the passes and of compositor GPU time,
+// 0 for none
+static const int kPassReportFrames = 300;
+
+// Composites per compositor in RunBenchmarks
+static const int kCompositeBenchIterations = 100;
+
+static const char *const kCompositorNames[] = { "blit", "shader" };
+
 ///
 // Initialize the framebuffer object and MRTs
 //
 int MRTRender::InitFBO() {
     RenderUserData* userData = &UserData_;
-    int i;
     GLint defaultFramebuffer = 0;
     const GLenum attachments[4] =
             {
@@ -55,159 +89,389 @@ int MRTRender::InitFBO() {
 
     glGetIntegerv ( GL_FRAMEBUFFER_BINDING, &defaultFramebuffer );
 
-    // Setup fbo
+    // Setup fbo. The output buffers follow the surface size, see AllocateTargets
     glGenFramebuffers ( 1, &userData->fbo );
-    glBindFramebuffer ( GL_FRAMEBUFFER, userData->fbo );
+    state_cache_->BindFramebuffer ( GL_FRAMEBUFFER, userData->fbo );
+    glDrawBuffers ( 4, attachments );
 
-    // Setup four output buffers and attach to fbo
-    userData->textureHeight = userData->textureWidth = 400;
-    glGenTextures ( 4, &userData->colorTexId[0] );
-    for (i = 0; i < 4; ++i)
-    {
-        glBindTexture ( GL_TEXTURE_2D, userData->colorTexId[i] );
+    // Restore the original framebuffer
+    state_cache_->BindFramebuffer ( GL_FRAMEBUFFER, defaultFramebuffer );
+
+    return TRUE;
+}
+
+///
+// Attach four output buffers covering width x height to the fbo
+//
+int MRTRender::AllocateTargets(GLsizei width, GLsizei height) {
+    RenderUserData* userData = &UserData_;
+    int i;
+    GLint defaultFramebuffer = 0;
+    const GLenum attachments[4] =
+            {
+                    GL_COLOR_ATTACHMENT0,
+                    GL_COLOR_ATTACHMENT1,
+                    GL_COLOR_ATTACHMENT2,
+                    GL_COLOR_ATTACHMENT3
+            };
 
-        glTexImage2D ( GL_TEXTURE_2D, 0, GL_RGBA,
-                       userData->textureWidth, userData->textureHeight,
-                       0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    glGetIntegerv ( GL_FRAMEBUFFER_BINDING, &defaultFramebuffer );
+    auto start = std::chrono::steady_clock::now ();
+    int allocations = target_pool_->Allocations ();
 
-        // Set the filtering mode
-        glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-        glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    // The previous size goes back to the pool first, a rotation back to it reuses them
+    for ( GLuint &texture : userData->colorTexId ) {
+        target_pool_->Release ( &texture );
+    }
+
+    // Immutable single level storage, so the attachments are complete by construction. They
+    // have no sampling state of their own: glBlitFramebuffer takes its filter as an argument,
+    // the composite shader samples them through the sampler pool.
+    state_cache_->BindFramebuffer ( GL_FRAMEBUFFER, userData->fbo );
+    for (i = 0; i < 4; ++i)
+    {
+        userData->colorTexId[i] = target_pool_->Acquire ( GL_RGBA8, width, height,
+                                                          &userData->textureWidth,
+                                                          &userData->textureHeight );
 
         glFramebufferTexture2D ( GL_DRAW_FRAMEBUFFER, attachments[i],
                                  GL_TEXTURE_2D, userData->colorTexId[i], 0 );
     }
+    userData->renderWidth = width;
+    userData->renderHeight = height;
 
-    glDrawBuffers ( 4, attachments );
+    GLenum status = glCheckFramebufferStatus ( GL_FRAMEBUFFER );
+
+    // Restore the original framebuffer
+    state_cache_->BindFramebuffer ( GL_FRAMEBUFFER, defaultFramebuffer );
 
-    if ( GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus ( GL_FRAMEBUFFER ) )
+    if ( GL_FRAMEBUFFER_COMPLETE != status )
     {
+        aout << "MRT targets: framebuffer incomplete at " << width << "x" << height << std::endl;
         return FALSE;
     }
 
-    // Restore the original framebuffer
-    glBindFramebuffer ( GL_FRAMEBUFFER, defaultFramebuffer );
+    aout << "MRT targets: " << width << "x" << height << " in " << kColorTargets << " of "
+         << userData->textureWidth << "x" << userData->textureHeight << ", "
+         << target_pool_->Allocations () - allocations << " allocated, "
+         << target_pool_->Reuses () << " reused so far, " << target_pool_->IdleTextures ()
+         << " idle (" << target_pool_->IdleBytes () << " bytes), "
+         << texture_factory_->Bytes () << " bytes in all, in "
+         << std::chrono::duration<double, std::milli> (
+                 std::chrono::steady_clock::now () - start ).count () << " ms" << std::endl;
 
     return TRUE;
 }
 
-// Initialize the shader and program object
-bool MRTRender::Init() {
+void MRTRender::SetSurfaceSize(GLsizei width, GLsizei height) {
+    if ( width != surface_width_ || height != surface_height_ ) {
+        surface_width_ = width;
+        surface_height_ = height;
+        settle_frames_ = 0;
+    }
+}
+
+void MRTRender::SetRenderScale(float scale) {
+    render_scale_ = scale;
+    settle_frames_ = 0;
+}
+
+void MRTRender::UpdateTargets() {
     RenderUserData* userData = &UserData_;
-    char vShaderStr[] =
-            "#version 300 es                            \n"
+    if ( userData->fbo == 0 || surface_width_ <= 0 || surface_height_ <= 0 ) {
+        return;
+    }
+
+    GLsizei width = std::max ( ( GLsizei ) ( surface_width_ * render_scale_ + 0.5f ), 1 );
+    GLsizei height = std::max ( ( GLsizei ) ( surface_height_ * render_scale_ + 0.5f ), 1 );
+    if ( width == userData->renderWidth && height == userData->renderHeight ) {
+        return;
+    }
+
+    // Inside the current bucket the textures already cover it, only the rendered area moves
+    GLsizei bucketWidth = 0;
+    GLsizei bucketHeight = 0;
+    target_pool_->Bucket ( width, height, &bucketWidth, &bucketHeight );
+    if ( userData->colorTexId[0] && bucketWidth == userData->textureWidth
+         && bucketHeight == userData->textureHeight ) {
+        userData->renderWidth = width;
+        userData->renderHeight = height;
+        return;
+    }
+
+    // Until the size settles Draw stretches the old targets over the new surface
+    if ( userData->colorTexId[0] && ++settle_frames_ < kResizeSettleFrames ) {
+        return;
+    }
+    settle_frames_ = 0;
+    AllocateTargets ( width, height );
+}
+
+// Request the program variant, Init runs once it is linked
+void MRTRender::AddPrograms(ShaderVariantCache* variants) {
+    // Templates, ShaderVariantCache adds the #version line and the defines
+    const char vShaderStr[] =
             "layout(location = 0) in vec4 a_position;   \n"
             "void main()                                \n"
             "{                                          \n"
             "   gl_Position = a_position;               \n"
             "}                                          \n";
 
-    char fShaderStr[] =
-            "#version 300 es                                     \n"
-            "precision mediump float;                            \n"
+    // One output per color target, MRT_COUNT of them
+    const char fShaderStr[] =
+            "precision PRECISION float;                          \n"
             "layout(location = 0) out vec4 fragData0;            \n"
+            "#if MRT_COUNT > 1                                   \n"
             "layout(location = 1) out vec4 fragData1;            \n"
+            "#endif                                              \n"
+            "#if MRT_COUNT > 2                                   \n"
             "layout(location = 2) out vec4 fragData2;            \n"
+            "#endif                                              \n"
+            "#if MRT_COUNT > 3                                   \n"
             "layout(location = 3) out vec4 fragData3;            \n"
+            "#endif                                              \n"
             "void main()                                         \n"
             "{                                                   \n"
             "  // first buffer will contain red color            \n"
             "  fragData0 = vec4 ( 1, 0, 0, 1 );                  \n"
-            "                                                    \n"
+            "#if MRT_COUNT > 1                                   \n"
             "  // second buffer will contain green color         \n"
             "  fragData1 = vec4 ( 0, 1, 0, 1 );                  \n"
-            "                                                    \n"
+            "#endif                                              \n"
+            "#if MRT_COUNT > 2                                   \n"
             "  // third buffer will contain blue color           \n"
             "  fragData2 = vec4 ( 0, 0, 1, 1 );                  \n"
-            "                                                    \n"
+            "#endif                                              \n"
+            "#if MRT_COUNT > 3                                   \n"
             "  // fourth buffer will contain gray color          \n"
             "  fragData3 = vec4 ( 0.5, 0.5, 0.5, 1 );            \n"
+            "#endif                                              \n"
             "}                                                   \n";
 
-    // Load the shaders and get a linked program object
-    userData->programObject = esLoadProgram ( vShaderStr, fShaderStr );
+    ShaderDefines defines;
+    defines["MRT_COUNT"] = std::to_string ( kColorTargets );
+    program_variant_ = variants->Request ( vShaderStr, fShaderStr, defines );
+
+    // Fullscreen triangle from gl_VertexID, no vertex data. v_screen runs from 0 to 1 across
+    // the window.
+    const char vCompositeStr[] =
+            "out vec2 v_screen;                                                  \n"
+            "void main()                                                         \n"
+            "{                                                                   \n"
+            "   vec2 corner = vec2 ( float ( ( gl_VertexID & 1 ) << 2 ),         \n"
+            "                        float ( ( gl_VertexID & 2 ) << 1 ) );       \n"
+            "   v_screen = corner * 0.5;                                         \n"
+            "   gl_Position = vec4 ( corner - 1.0, 0.0, 1.0 );                   \n"
+            "}                                                                   \n";
+
+    // Each window quadrant shows the same quadrant of one target, like the blits. u_scale maps
+    // the window onto the rendered area of the targets. Only one target is sampled per pixel,
+    // with an explicit level since the branch is not uniform.
+    const char fCompositeStr[] =
+            "precision PRECISION float;                                          \n"
+            "uniform sampler2D s_target0;                                        \n"
+            "uniform sampler2D s_target1;                                        \n"
+            "uniform sampler2D s_target2;                                        \n"
+            "uniform sampler2D s_target3;                                        \n"
+            "uniform vec2 u_scale;                                               \n"
+            "in vec2 v_screen;                                                   \n"
+            "layout(location = 0) out vec4 outColor;                             \n"
+            "void main()                                                         \n"
+            "{                                                                   \n"
+            "  vec2 uv = v_screen * u_scale;                                     \n"
+            "  if ( v_screen.y < 0.5 )                                           \n"
+            "    outColor = v_screen.x < 0.5 ? textureLod ( s_target0, uv, 0.0 ) \n"
+            "                                : textureLod ( s_target1, uv, 0.0 );\n"
+            "  else                                                              \n"
+            "    outColor = v_screen.x < 0.5 ? textureLod ( s_target2, uv, 0.0 ) \n"
+            "                                : textureLod ( s_target3, uv, 0.0 );\n"
+            "}                                                                   \n";
+
+    // mediump cannot address every texel of a large window
+    ShaderDefines compositeDefines;
+    compositeDefines["PRECISION"] = "highp";
+    composite_variant_ = variants->Request ( vCompositeStr, fCompositeStr, compositeDefines );
+}
+
+// Initialize the resources that need the linked program
+bool MRTRender::Init() {
+    UserData_.programObject = program_variant_ ? *program_variant_ : 0;
+    if ( UserData_.programObject == 0 ) {
+        return FALSE;
+    }
 
     InitFBO();
+    UpdateTargets();
+
+    // The composite program samples target i from texture unit i
+    UserData_.compositeProgram = composite_variant_ ? *composite_variant_ : 0;
+    if ( UserData_.compositeProgram ) {
+        state_cache_->UseProgram ( UserData_.compositeProgram );
+        for ( int i = 0; i < kColorTargets; ++i ) {
+            std::string name = "s_target" + std::to_string ( i );
+            state_cache_->Uniform1i ( glGetUniformLocation ( UserData_.compositeProgram,
+                                                             name.c_str () ), i );
+        }
+        UserData_.compositeScaleLoc = glGetUniformLocation ( UserData_.compositeProgram,
+                                                             "u_scale" );
+    }
+
+    for ( int i = 0; i < kColorTargets; ++i ) {
+        mrt_pass_.AddAttachment ( GL_COLOR_ATTACHMENT0 + i, 4, LoadAction::kDontCare,
+                                  StoreAction::kStore );
+    }
+
+    stream_buffer_ = new StreamRingBuffer ( state_cache_, GL_ARRAY_BUFFER, kStreamBufferSize );
 
     glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
     return TRUE;
 };
 
-void MRTRender::DrawGeometry(GLsizei width, GLsizei height) const {
+void MRTRender::DrawGeometry() const {
     const RenderUserData *userData = &UserData_;
-    GLfloat vVertices[] = { -1.0f,  1.0f, 0.0f,
-                            -1.0f, -1.0f, 0.0f,
-                            1.0f, -1.0f, 0.0f,
-                            1.0f,  1.0f, 0.0f,
+    static const GLfloat vVertices[] = { -1.0f,  1.0f, 0.0f,
+                                         -1.0f, -1.0f, 0.0f,
+                                         1.0f, -1.0f, 0.0f,
+                                         1.0f,  1.0f, 0.0f,
     };
-    GLushort indices[] = { 0, 1, 2, 0, 2, 3 };
+    static const GLushort indices[] = { 0, 1, 2, 0, 2, 3 };
 
-    // Set the viewport
-    glViewport ( 0, 0, width, height);
+    // Stream this frame's vertices into the ring buffer
+    StreamAllocation vertices = stream_buffer_->Allocate ( sizeof ( vVertices ) );
+    if ( !vertices.ptr ) {
+        return;
+    }
+    memcpy ( vertices.ptr, vVertices, sizeof ( vVertices ) );
+    stream_buffer_->Unmap ();
 
-    // Clear the color buffer
-    glClear ( GL_COLOR_BUFFER_BIT );
+    // Set the viewport to the rendered area. Draw already cleared the attachments.
+    state_cache_->Viewport ( 0, 0, userData->renderWidth, userData->renderHeight );
 
     // Use the program object
-    glUseProgram ( userData->programObject );
+    state_cache_->UseProgram ( userData->programObject );
 
-    // Load the vertex position
+    // Load the vertex position, the ring buffer is still bound to GL_ARRAY_BUFFER
     glVertexAttribPointer ( 0, 3, GL_FLOAT,
-                            GL_FALSE, 3 * sizeof ( GLfloat ), vVertices );
+                            GL_FALSE, 3 * sizeof ( GLfloat ), ( const void * ) vertices.offset );
     glEnableVertexAttribArray ( 0 );
 
     // Draw a quad
     glDrawElements ( GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices );
+
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, 0 );
 }
 
 void MRTRender::BlitTextures(GLsizei width, GLsizei height) const {
     const RenderUserData* userData = &UserData_;
+    // Each quadrant of the window shows the same quadrant of its buffer's rendered area, a
+    // plain copy unless the render scale, or a resize that has not settled yet, stretches it
+    GLsizei srcWidth = userData->renderWidth;
+    GLsizei srcHeight = userData->renderHeight;
+    GLenum filter = ( srcWidth == width && srcHeight == height ) ? GL_NEAREST : GL_LINEAR;
 
     // set the fbo for reading
-    glBindFramebuffer ( GL_READ_FRAMEBUFFER, userData->fbo );
+    state_cache_->BindFramebuffer ( GL_READ_FRAMEBUFFER, userData->fbo );
 
     // Copy the output red buffer to lower left quadrant
     glReadBuffer ( GL_COLOR_ATTACHMENT0 );
-    glBlitFramebuffer ( 0, 0, userData->textureWidth, userData->textureHeight,
+    glBlitFramebuffer ( 0, 0, srcWidth/2, srcHeight/2,
                         0, 0, width/2, height/2,
-                        GL_COLOR_BUFFER_BIT, GL_LINEAR );
+                        GL_COLOR_BUFFER_BIT, filter );
 
     // Copy the output green buffer to lower right quadrant
     glReadBuffer ( GL_COLOR_ATTACHMENT1 );
-    glBlitFramebuffer ( 0, 0, userData->textureWidth, userData->textureHeight,
+    glBlitFramebuffer ( srcWidth/2, 0, srcWidth, srcHeight/2,
                         width/2, 0, width, height/2,
-                        GL_COLOR_BUFFER_BIT, GL_LINEAR );
+                        GL_COLOR_BUFFER_BIT, filter );
 
     // Copy the output blue buffer to upper left quadrant
     glReadBuffer ( GL_COLOR_ATTACHMENT2 );
-    glBlitFramebuffer ( 0, 0, userData->textureWidth, userData->textureHeight,
+    glBlitFramebuffer ( 0, srcHeight/2, srcWidth/2, srcHeight,
                         0, height/2, width/2, height,
-                        GL_COLOR_BUFFER_BIT, GL_LINEAR );
+                        GL_COLOR_BUFFER_BIT, filter );
 
     // Copy the output gray buffer to upper right quadrant
     glReadBuffer ( GL_COLOR_ATTACHMENT3 );
-    glBlitFramebuffer ( 0, 0, userData->textureWidth, userData->textureHeight,
+    glBlitFramebuffer ( srcWidth/2, srcHeight/2, srcWidth, srcHeight,
                         width/2, height/2, width, height,
-                        GL_COLOR_BUFFER_BIT, GL_LINEAR );
+                        GL_COLOR_BUFFER_BIT, filter );
+}
+
+void MRTRender::DrawComposite(GLsizei width, GLsizei height) const {
+    const RenderUserData* userData = &UserData_;
+    // Same filtering as the blits
+    GLenum filter = ( userData->renderWidth == width && userData->renderHeight == height )
+                    ? GL_NEAREST : GL_LINEAR;
+    SamplerDesc sampler = MakeSamplerDesc ( filter, filter, GL_CLAMP_TO_EDGE );
+
+    state_cache_->Viewport ( 0, 0, width, height );
+    state_cache_->UseProgram ( userData->compositeProgram );
+    glUniform2f ( userData->compositeScaleLoc,
+                  ( GLfloat ) userData->renderWidth / userData->textureWidth,
+                  ( GLfloat ) userData->renderHeight / userData->textureHeight );
+
+    for ( int i = 0; i < kColorTargets; ++i ) {
+        state_cache_->ActiveTexture ( GL_TEXTURE0 + i );
+        state_cache_->BindTexture ( GL_TEXTURE_2D, userData->colorTexId[i] );
+        sampler_pool_->Bind ( i, sampler );
+    }
+
+    // Blits replace the window's pixels, so blending stays off like for them and is restored
+    // as found afterwards. The triangle needs no vertex data.
+    bool blend = glIsEnabled ( GL_BLEND ) == GL_TRUE;
+    state_cache_->Disable ( GL_BLEND );
+    glDisableVertexAttribArray ( 0 );
+    glDrawArrays ( GL_TRIANGLES, 0, 3 );
+    if ( blend ) {
+        state_cache_->Enable ( GL_BLEND );
+    }
+}
+
+void MRTRender::Composite(Compositor compositor, GLsizei width, GLsizei height) const {
+    if ( compositor == kShaderCompositor && UserData_.compositeProgram ) {
+        DrawComposite ( width, height );
+    } else {
+        BlitTextures ( width, height );
+    }
+}
+
+void MRTRender::LogCompositeStats() {
+    aout << "Composite GPU time:";
+    for ( int i = 0; i < 2; i++ ) {
+        aout << " " << kCompositorNames[i] << " ";
+        if ( composite_frames_[i] > 0 ) {
+            aout << composite_gpu_ms_[i] / composite_frames_[i] << " ms over "
+                 << composite_frames_[i] << " frames";
+        } else {
+            aout << "not timed";
+        }
+        aout << ( i == 0 ? "," : "" );
+        composite_frames_[i] = 0;
+        composite_gpu_ms_[i] = 0.0;
+    }
+    aout << ", current " << kCompositorNames[compositor_] << std::endl;
 }
 
 void MRTRender::ShutDown() {
     RenderUserData* userData = &UserData_;
 
-    // Delete texture objects
-    glDeleteTextures ( 4, userData->colorTexId );
+    // Hand the texture objects back, the pool deletes them
+    for ( GLuint &texture : userData->colorTexId ) {
+        target_pool_->Release ( &texture );
+    }
 
     // Delete fbo
-    glDeleteFramebuffers ( 1, &userData->fbo);
+    state_cache_->DeleteFramebuffers ( 1, &userData->fbo);
 
-    // Delete program object
-    glDeleteProgram ( userData->programObject );
+    // Delete the streaming buffer and its pending fences
+    delete stream_buffer_;
+    stream_buffer_ = nullptr;
 }
 
 ///
 // Draw a triangle using the shader pair created in Init()
 //
-void MRTRender::Draw(GLsizei width, GLsizei height) const {
+void MRTRender::Draw(GLsizei width, GLsizei height, RenderPassActions* window_pass) {
     const RenderUserData* userData = &UserData_;
     GLint defaultFramebuffer = 0;
     const GLenum attachments[4] =
@@ -221,24 +485,165 @@ void MRTRender::Draw(GLsizei width, GLsizei height) const {
     // 不论是直接渲染到屏幕还是进行离屏渲染，都需要创建震缓冲区对象即FBO，
     // 只不过直接渲染到屏幕的FBO的GL_FRAMEBUFFER_BINDING为0。渲染到其他存储空间的frambuffer的id大于0.
     glGetIntegerv ( GL_FRAMEBUFFER_BINDING, &defaultFramebuffer );
+    if ( userData->colorTexId[0] == 0 ) {
+        window_pass->Begin ( GL_DRAW_FRAMEBUFFER, width, height );
+        return;
+    }
 
-    // FIRST: use MRTs to output four colors to four buffers
-    glBindFramebuffer ( GL_FRAMEBUFFER, userData->fbo );
-    glClear ( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    // FIRST: use MRTs to output four colors to four buffers. The blits below read them, so
+    // they are stored
+    state_cache_->BindFramebuffer ( GL_FRAMEBUFFER, userData->fbo );
     glDrawBuffers ( 4, attachments );
-    DrawGeometry(width, height);
+    mrt_pass_.Begin ( GL_FRAMEBUFFER, userData->renderWidth, userData->renderHeight );
+    DrawGeometry();
+    mrt_pass_.End ( GL_FRAMEBUFFER );
 
     // SECOND: copy the four output buffers into four window quadrants
-    // with framebuffer blits
+    // with framebuffer blits or the composite shader
+
+    // Restore the default framebuffer, prepare to blit to default frame buffer. The window
+    // pass starts only now, so a tiled GPU renders it in one go instead of storing its clear
+    // around the MRT pass and loading it back.
+    state_cache_->BindFramebuffer ( GL_DRAW_FRAMEBUFFER, defaultFramebuffer );
+    window_pass->Begin ( GL_DRAW_FRAMEBUFFER, width, height );
+
+    // Only timed when the previous result is in, the timer has a single query
+    double gpuMs = 0.0;
+    if ( composite_timer_pending_ && composite_timer_.Poll ( &gpuMs ) ) {
+        composite_timer_pending_ = false;
+        if ( gpuMs >= 0.0 ) {
+            composite_frames_[timed_compositor_]++;
+            composite_gpu_ms_[timed_compositor_] += gpuMs;
+        }
+    }
+    bool timed = composite_timer_.Available () && !composite_timer_pending_;
+    if ( timed ) {
+        timed_compositor_ = compositor_;
+        composite_timer_.Begin ();
+    }
+
+    Composite ( compositor_, width, height );
+
+    if ( timed ) {
+        composite_timer_.End ();
+        composite_timer_pending_ = true;
+    }
+
+    // Everything streamed this frame has been consumed by the draws above
+    stream_buffer_->Fence ();
+}
+
+void MRTRender::RunBenchmarks(GLsizei width, GLsizei height) {
+    const RenderUserData* userData = &UserData_;
+    const GLsizeiptr blockSizes[] = { 256, 4 * 1024, 64 * 1024, 1024 * 1024 };
+    const long long streamBytes = 256ll * 1024 * 1024;
+    // One simulated frame, fenced like Draw does
+    const GLsizeiptr frameBytes = 1024 * 1024;
+    GLint defaultFramebuffer = 0;
+
+    // Only created once Init succeeded
+    if ( !stream_buffer_ ) {
+        return;
+    }
+
+    glGetIntegerv ( GL_FRAMEBUFFER_BINDING, &defaultFramebuffer );
+    state_cache_->BindFramebuffer ( GL_FRAMEBUFFER, userData->fbo );
+    state_cache_->Viewport ( 0, 0, userData->renderWidth, userData->renderHeight );
+    state_cache_->UseProgram ( userData->programObject );
+    glEnableVertexAttribArray ( 0 );
 
-    // Restore the default framebuffer, prepare to blit to default frame buffer
-    glBindFramebuffer ( GL_DRAW_FRAMEBUFFER, defaultFramebuffer );
-    BlitTextures(width, height);
+    for ( GLsizeiptr blockSize : blockSizes ) {
+        int stalls = stream_buffer_->Stalls ();
+        double stallMs = stream_buffer_->StallMs ();
+        long long streamed = 0;
+        GLsizeiptr sinceFence = 0;
+
+        glFinish ();
+        auto start = std::chrono::steady_clock::now ();
+        while ( streamed < streamBytes ) {
+            StreamAllocation block = stream_buffer_->Allocate ( blockSize );
+            if ( !block.ptr ) {
+                break;
+            }
+
+            // Zeroed vertices form degenerate triangles, so the draw only consumes the block
+            memset ( block.ptr, 0, blockSize );
+            stream_buffer_->Unmap ();
+
+            glVertexAttribPointer ( 0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof ( GLfloat ),
+                                    ( const void * ) block.offset );
+            glDrawArrays ( GL_TRIANGLES, 0, 3 );
+
+            streamed += blockSize;
+            sinceFence += blockSize;
+            if ( sinceFence >= frameBytes ) {
+                stream_buffer_->Fence ();
+                sinceFence = 0;
+            }
+        }
+        stream_buffer_->Fence ();
+        glFinish ();
+        double ms = std::chrono::duration<double, std::milli> (
+                std::chrono::steady_clock::now () - start ).count ();
+
+        aout << "Stream " << blockSize << " byte blocks: " << streamed / ( ms * 1.0e3 )
+             << " MB/s, " << ( streamed / blockSize ) / ms << " blocks/ms, "
+             << stream_buffer_->Stalls () - stalls << " stalls, "
+             << stream_buffer_->StallMs () - stallMs << " ms stalled" << std::endl;
+    }
+
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, 0 );
+    state_cache_->BindFramebuffer ( GL_FRAMEBUFFER, defaultFramebuffer );
+
+    // Both compositors on the same targets, into the window
+    if ( userData->colorTexId[0] == 0 ) {
+        return;
+    }
+    for ( int i = 0; i < 2; i++ ) {
+        Compositor compositor = ( Compositor ) i;
+        if ( compositor == kShaderCompositor && !userData->compositeProgram ) {
+            continue;
+        }
+        DrawBenchResult result = BenchmarkDraws ( [this, compositor, width, height] () {
+            Composite ( compositor, width, height );
+        }, kCompositeBenchIterations );
+        aout << "Composite " << kCompositorNames[i] << ": " << result.gpuMs << " ms gpu"
+             << ( result.gpuTimerQuery ? "" : " (wall)" ) << ", " << result.cpuSubmitMs
+             << " ms cpu per composite" << std::endl;
+    }
 }
 
 // ====================================================================================================================
 
 Renderer::~Renderer() {
+    // GL objects have to go while the context is still current
+    delete cubemap_render_;
+    cubemap_render_ = nullptr;
+
+    delete program_batch_;
+    program_batch_ = nullptr;
+
+    delete shader_variants_;
+    shader_variants_ = nullptr;
+
+    delete target_pool_;
+    target_pool_ = nullptr;
+
+    delete sampler_pool_;
+    sampler_pool_ = nullptr;
+
+    delete texture_factory_;
+    texture_factory_ = nullptr;
+
+    delete program_cache_;
+    program_cache_ = nullptr;
+
+    delete frame_constants_buffer_;
+    frame_constants_buffer_ = nullptr;
+
+    delete state_cache_;
+    state_cache_ = nullptr;
+
     if (display_ != EGL_NO_DISPLAY) {
         eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
         if (context_ != EGL_NO_CONTEXT) {
@@ -252,9 +657,6 @@ Renderer::~Renderer() {
         eglTerminate(display_);
         display_ = EGL_NO_DISPLAY;
     }
-
-    delete cubemap_render_;
-    cubemap_render_ = nullptr;
 }
 
 void Renderer::render() {
@@ -263,24 +665,78 @@ void Renderer::render() {
     // changed.
     updateRenderArea();
 
+    // Nothing to draw until the programs are linked, keep presenting the clear color
+    if (!finishPrograms()) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        auto swapResult = eglSwapBuffers(display_, surface_);
+        assert(swapResult == EGL_TRUE);
+        return;
+    }
+
     // When the renderable area changes, the projection matrix has to also be updated. This is true
     // even if you change from the sample orthographic projection matrix as your aspect ratio has
     // likely changed.
     if (shaderNeedsNewProjectionMatrix_) {
+        SetAspectOrtho(frameConstants_.projection, width_, height_);
+        frameConstants_.viewport[2] = (GLfloat) width_;
+        frameConstants_.viewport[3] = (GLfloat) height_;
         shaderNeedsNewProjectionMatrix_ = false;
     }
 
-    // clear the color buffer
-    glClear(GL_COLOR_BUFFER_BIT);
+    // Global shader inputs go out once per frame, every program reads them from
+    // ES_FRAME_CONSTANTS_BINDING
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime_)
+            .count();
+    frameConstants_.time[1] = seconds - frameConstants_.time[0];
+    frameConstants_.time[0] = seconds;
+    frameConstants_.time[2] += 1.0f;
+    frame_constants_buffer_->Update(frameConstants_);
+
+    // Follow a resize once it has settled, before anything draws into the targets
+    cubemap_render_->UpdateTargets();
+
+    if (compositorSwitchRequested_) {
+        compositorSwitchRequested_ = false;
+        cubemap_render_->SetCompositor(
+                cubemap_render_->CurrentCompositor() == MRTRender::kBlitCompositor
+                ? MRTRender::kShaderCompositor : MRTRender::kBlitCompositor);
+        aout << "Compositor: " << kCompositorNames[cubemap_render_->CurrentCompositor()]
+             << std::endl;
+    }
 
     // Render all the models. There's no depth testing in this sample so they're accepted in the
     // order provided. But the sample EGL setup requests a 24 bit depth buffer so you could
-    // configure it at the end of initRenderer
-    cubemap_render_->Draw(width_, height_);
+    // configure it at the end of initRenderer. Draw starts the window pass, which clears the
+    // color buffer and leaves depth undefined, once the MRT pass is done.
+    cubemap_render_->Draw(width_, height_, &window_pass_);
+
+    // Only color is presented, the depth buffer need not be written back
+    window_pass_.End(GL_FRAMEBUFFER);
+
+    if (benchmarkRequested_) {
+        benchmarkRequested_ = false;
+        cubemap_render_->RunBenchmarks(width_, height_);
+    }
 
     // Present the rendered image. This is an implicit glFlush.
     auto swapResult = eglSwapBuffers(display_, surface_);
     assert(swapResult == EGL_TRUE);
+
+    if (kPassReportFrames > 0 && window_pass_.WindowPasses() >= kPassReportFrames) {
+        cubemap_render_->LogPassStats();
+        window_pass_.LogStats();
+        cubemap_render_->LogCompositeStats();
+    }
+
+    // A steady scene makes the same calls every frame, so only log when the counts move
+    state_cache_->EndFrame();
+    const GLStateCounters &counters = state_cache_->LastFrame();
+    if (counters.forwarded != loggedStateCounters_.forwarded
+        || counters.filtered != loggedStateCounters_.filtered) {
+        aout << "GL state calls per frame: " << counters.forwarded << " forwarded, "
+             << counters.filtered << " filtered" << std::endl;
+        loggedStateCounters_ = counters;
+    }
 }
 
 void Renderer::initRenderer() {
@@ -360,11 +816,61 @@ void Renderer::initRenderer() {
     glClearColor(CORNFLOWER_BLUE);
 
     // enable alpha globally for now, you probably don't want to do this in a game
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    state_cache_ = new GLStateCache();
+    state_cache_->Enable(GL_BLEND);
+    state_cache_->BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    frame_constants_buffer_ = new FrameConstantsBuffer(state_cache_);
+    SetIdentity(frameConstants_.projection);
+    SetIdentity(frameConstants_.view);
+    startTime_ = std::chrono::steady_clock::now();
+
+    program_cache_ = new ProgramCache(app_->activity->internalDataPath
+                                      ? app_->activity->internalDataPath : "");
+
+    texture_factory_ = new TextureFactory(state_cache_);
+    target_pool_ = new RenderTargetPool(texture_factory_, kTargetGranularity, kIdleTargets);
+    sampler_pool_ = new SamplerPool(state_cache_);
+    cubemap_render_ = new MRTRender(state_cache_, texture_factory_, target_pool_,
+                                    sampler_pool_);
+    cubemap_render_->SetRenderScale(kRenderScale);
+    cubemap_render_->SetInvalidate(kInvalidateAttachments);
+
+    // The EGL config asks for 24 bit depth, stored as 4 bytes like the color
+    window_pass_.AddAttachment(GL_COLOR, 4, LoadAction::kClear, StoreAction::kStore);
+    window_pass_.AddAttachment(GL_DEPTH, 4, LoadAction::kDontCare, StoreAction::kInvalidate);
+    window_pass_.SetInvalidate(kInvalidateAttachments);
+
+    // Compiles run while the first frames are presented, see finishPrograms
+    shader_variants_ = new ShaderVariantCache(state_cache_);
+    program_batch_ = new ProgramBatch(program_cache_);
+    cubemap_render_->AddPrograms(shader_variants_);
+    shader_variants_->Queue(program_batch_);
+    program_batch_->Submit();
+}
+
+bool Renderer::finishPrograms() {
+    if (!program_batch_) {
+        return true;
+    }
+    if (!program_batch_->IsReady()) {
+        return false;
+    }
+
+    program_batch_->Finish();
+    delete program_batch_;
+    program_batch_ = nullptr;
 
-    cubemap_render_ = new MRTRender();
-    cubemap_render_->Init();
+    if (!cubemap_render_->Init()) {
+        aout << "Renderer init failed" << std::endl;
+    }
+
+    aout << "Programs: " << program_cache_->Hits() << " cached in " << program_cache_->HitMs()
+         << " ms, " << program_cache_->Misses() << " built in " << program_cache_->MissMs()
+         << " ms (" << program_cache_->Rejected() << " rejected)" << std::endl;
+    aout << "Shader variants: " << shader_variants_->Variants() << " built, "
+         << shader_variants_->SharedRequests() << " requests shared" << std::endl;
+    return true;
 }
 
 void Renderer::updateRenderArea() {
@@ -377,7 +883,8 @@ void Renderer::updateRenderArea() {
     if (width != width_ || height != height_) {
         width_ = width;
         height_ = height;
-        glViewport(0, 0, width, height);
+        state_cache_->Viewport(0, 0, width, height);
+        cubemap_render_->SetSurfaceSize(width, height);
 
         // make sure that we lazily recreate the projection matrix before we render
         shaderNeedsNewProjectionMatrix_ = true;
@@ -410,9 +917,16 @@ void Renderer::handleInput() {
         // determine the action type and process the event accordingly.
         switch (action & AMOTION_EVENT_ACTION_MASK) {
             case AMOTION_EVENT_ACTION_DOWN:
+                aout << "(" << pointer.id << ", " << x << ", " << y << ") "
+                     << "Pointer Down";
+                multiTouchGesture_ = false;
+                break;
+
             case AMOTION_EVENT_ACTION_POINTER_DOWN:
                 aout << "(" << pointer.id << ", " << x << ", " << y << ") "
                      << "Pointer Down";
+                multiTouchGesture_ = true;
+                compositorSwitchRequested_ = true;
                 break;
 
             case AMOTION_EVENT_ACTION_CANCEL:
@@ -423,6 +937,12 @@ void Renderer::handleInput() {
             case AMOTION_EVENT_ACTION_POINTER_UP:
                 aout << "(" << pointer.id << ", " << x << ", " << y << ") "
                      << "Pointer Up";
+                // Only a one finger tap runs the benchmarks, so switching the compositor
+                // with two fingers does not stall the frames it is compared over
+                if ((action & AMOTION_EVENT_ACTION_MASK) == AMOTION_EVENT_ACTION_UP
+                    && !multiTouchGesture_) {
+                    benchmarkRequested_ = true;
+                }
                 break;
 
             case AMOTION_EVENT_ACTION_MOVE:
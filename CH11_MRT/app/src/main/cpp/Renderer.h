@@ -3,43 +3,182 @@
 
 #include <EGL/egl.h>
 #include <GLES3/gl3.h>
+#include <chrono>
 #include <memory>
 
+#include "DrawBench.h"
+#include "FrameConstants.h"
+#include "GLStateCache.h"
+#include "ProgramBatch.h"
+#include "ShaderVariants.h"
+#include "ProgramCache.h"
+#include "RenderPassActions.h"
+#include "RenderTargetPool.h"
+#include "StreamBuffer.h"
+#include "TextureFactory.h"
+
 struct android_app;
 
 class MRTRender {
 public:
-    MRTRender() {
+    /// How the four targets get into the window quadrants
+    enum Compositor {
+        // One glBlitFramebuffer per target
+        kBlitCompositor,
+        // One fullscreen triangle sampling all four targets
+        kShaderCompositor
+    };
+
+    MRTRender(GLStateCache* state_cache, TextureFactory* texture_factory,
+              RenderTargetPool* target_pool, SamplerPool* sampler_pool):
+            state_cache_(state_cache), texture_factory_(texture_factory),
+            target_pool_(target_pool), sampler_pool_(sampler_pool), program_variant_(nullptr),
+            composite_variant_(nullptr), stream_buffer_(nullptr),
+            render_scale_(1.0f), surface_width_(0), surface_height_(0), settle_frames_(0),
+            mrt_pass_("MRT"), compositor_(kBlitCompositor), timed_compositor_(kBlitCompositor),
+            composite_timer_pending_(false) {
         UserData_.programObject = 0;
+        UserData_.compositeProgram = 0;
+        UserData_.compositeScaleLoc = -1;
+        UserData_.fbo = 0;
+        for (GLuint &texture : UserData_.colorTexId) {
+            texture = 0;
+        }
+        UserData_.textureWidth = UserData_.textureHeight = 0;
+        UserData_.renderWidth = UserData_.renderHeight = 0;
+        for (int i = 0; i < 2; i++) {
+            composite_frames_[i] = 0;
+            composite_gpu_ms_[i] = 0.0;
+        }
     }
     virtual ~MRTRender() {
         ShutDown();
     }
 
+    /*!
+     * Requests the program variants of the renderer, owned by variants. Init must wait until
+     * they are built.
+     */
+    void AddPrograms(ShaderVariantCache* variants);
     bool Init();
-    void Draw(GLsizei width, GLsizei height) const;
+    /*!
+     * Renders the MRT pass, then begins window_pass with the default framebuffer bound and
+     * composites into it. The caller ends window_pass.
+     */
+    void Draw(GLsizei width, GLsizei height, RenderPassActions* window_pass);
+
+    /*!
+     * Size of the window surface, from Renderer::updateRenderArea. The targets follow it, scaled
+     * by the render scale, once it has held for a few frames, see UpdateTargets.
+     */
+    void SetSurfaceSize(GLsizei width, GLsizei height);
+
+    /*!
+     * Fraction of the surface size the MRT pass renders at, 1 for every pixel.
+     */
+    void SetRenderScale(float scale);
+
+    /*!
+     * Once per frame before Draw: moves the targets to the size asked for once it has settled.
+     * Sizes inside the current bucket only change the rendered area.
+     */
+    void UpdateTargets();
+
+    /*!
+     * Whether the MRT pass invalidates its attachments instead of clearing them, see
+     * RenderPassActions.
+     */
+    void SetInvalidate(bool invalidate) { mrt_pass_.SetInvalidate(invalidate); }
+
+    /*!
+     * Logs the bandwidth the MRT pass saved since the last call.
+     */
+    void LogPassStats() { mrt_pass_.LogStats(); }
+
+    /*!
+     * Switches between the blits and the composite shader from the next Draw on. The shader
+     * falls back to the blits if its program failed to build.
+     */
+    void SetCompositor(Compositor compositor) { compositor_ = compositor; }
+    Compositor CurrentCompositor() const { return compositor_; }
+
+    /*!
+     * Logs the average GPU time of each compositor over the frames timed since the last call.
+     */
+    void LogCompositeStats();
+
+    /*!
+     * Streams blocks of several sizes through the ring buffer and logs the throughput in MB/s,
+     * then times both compositors back to back. Stalls the pipeline, only run on request.
+     */
+    void RunBenchmarks(GLsizei width, GLsizei height);
 
 private:
     int InitFBO();
 
-    void DrawGeometry(GLsizei width, GLsizei height) const;
+    /*!
+     * Attaches targets covering width x height from the pool, handing the previous ones back.
+     */
+    int AllocateTargets(GLsizei width, GLsizei height);
+
+    void DrawGeometry() const;
     void BlitTextures(GLsizei width, GLsizei height) const;
+    void DrawComposite(GLsizei width, GLsizei height) const;
+    void Composite(Compositor compositor, GLsizei width, GLsizei height) const;
     void ShutDown();
 
     struct RenderUserData {
         // Handle to a program object
         GLuint programObject;
 
+        // Program of the shader compositor, and the location of its u_scale
+        GLuint compositeProgram;
+        GLint compositeScaleLoc;
+
         // Handle to a framebuffer object
         GLuint fbo;
 
         // Texture handle
         GLuint colorTexId[4];
 
-        // Texture size
+        // Texture size, a pool bucket at least as large as the rendered area
         GLsizei textureWidth;
         GLsizei textureHeight;
+
+        // Rendered area in the lower left corner of the textures
+        GLsizei renderWidth;
+        GLsizei renderHeight;
     }UserData_;
+
+    GLStateCache* state_cache_;
+    TextureFactory* texture_factory_;
+    RenderTargetPool* target_pool_;
+    SamplerPool* sampler_pool_;
+
+    // Filled in by the ShaderVariantCache
+    const GLuint* program_variant_;
+    const GLuint* composite_variant_;
+
+    // Per-frame vertex data, fenced once per Draw
+    StreamRingBuffer* stream_buffer_;
+
+    float render_scale_;
+    // Latest surface size, and frames it has held while it differs from the targets
+    GLsizei surface_width_;
+    GLsizei surface_height_;
+    int settle_frames_;
+
+    // The quad covers the rendered area, so the attachments start out undefined
+    RenderPassActions mrt_pass_;
+
+    Compositor compositor_;
+    // GPU time of the composite step, read a few frames late, and what it measured
+    GpuTimer composite_timer_;
+    Compositor timed_compositor_;
+    bool composite_timer_pending_;
+    // Timed frames and their total GPU time per compositor since LogCompositeStats
+    int composite_frames_[2];
+    double composite_gpu_ms_[2];
 };
 
 
@@ -56,6 +195,20 @@ public:
             width_(0),
             height_(0),
             shaderNeedsNewProjectionMatrix_(true),
+            benchmarkRequested_(false),
+            compositorSwitchRequested_(false),
+            multiTouchGesture_(false),
+            window_pass_("window"),
+            state_cache_(nullptr),
+            loggedStateCounters_(),
+            frame_constants_buffer_(nullptr),
+            frameConstants_(),
+            program_cache_(nullptr),
+            program_batch_(nullptr),
+            shader_variants_(nullptr),
+            texture_factory_(nullptr),
+            target_pool_(nullptr),
+            sampler_pool_(nullptr),
             cubemap_render_(nullptr) {
         initRenderer();
     }
@@ -87,6 +240,12 @@ private:
      */
     void updateRenderArea();
 
+    /*!
+     * Finishes the program batch and initializes the renderer once the driver is done
+     * compiling. Returns false while it is still busy.
+     */
+    bool finishPrograms();
+
     android_app* app_;
     EGLDisplay display_;
     EGLSurface surface_;
@@ -96,6 +255,38 @@ private:
 
     bool shaderNeedsNewProjectionMatrix_;
 
+    // Set by a one finger tap once it is lifted, runs the renderer's benchmarks on the next frame
+    bool benchmarkRequested_;
+    // Set by a second finger, switches the compositor on the next frame
+    bool compositorSwitchRequested_;
+    // A second finger came down since the first one, the tap does not run the benchmarks
+    bool multiTouchGesture_;
+
+    // The default framebuffer: color is cleared and presented, depth is never used
+    RenderPassActions window_pass_;
+
+    // All GL state changes of the sample go through here
+    GLStateCache* state_cache_;
+    // Counters of the frame last written to the log
+    GLStateCounters loggedStateCounters_;
+
+    // Projection, view, viewport and time shared by all programs, refreshed every frame
+    FrameConstantsBuffer* frame_constants_buffer_;
+    FrameConstants frameConstants_;
+    std::chrono::steady_clock::time_point startTime_;
+
+    // Program binaries of earlier launches, kept in the app's internal data path
+    ProgramCache* program_cache_;
+    // Programs still compiling, the renderer is initialized once it has finished
+    ProgramBatch* program_batch_;
+    // Every program of the sample, one per distinct permutation
+    ShaderVariantCache* shader_variants_;
+    // Immutable storage for the color targets, kept across resizes by the pool
+    TextureFactory* texture_factory_;
+    RenderTargetPool* target_pool_;
+    // Samplers of the composite shader
+    SamplerPool* sampler_pool_;
+
     MRTRender* cubemap_render_;
 };
 
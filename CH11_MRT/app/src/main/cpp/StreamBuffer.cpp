@@ -0,0 +1,129 @@
+#include "StreamBuffer.h"
+
+#include <chrono>
+
+#include "AndroidOut.h"
+
+StreamRingBuffer::StreamRingBuffer(GLStateCache *stateCache, GLenum target, GLsizeiptr size)
+        : stateCache_(stateCache),
+          target_(target),
+          buffer_(0),
+          size_(size),
+          head_(0),
+          fenced_(0),
+          retired_(0),
+          mapped_(false),
+          bytesAllocated_(0),
+          stalls_(0),
+          stallMs_(0.0) {
+    // Storage is only ever written through mappings, never respecified
+    glGenBuffers(1, &buffer_);
+    stateCache_->BindBuffer(target_, buffer_);
+    glBufferData(target_, size_, nullptr, GL_STREAM_DRAW);
+    stateCache_->BindBuffer(target_, 0);
+}
+
+StreamRingBuffer::~StreamRingBuffer() {
+    if (mapped_) {
+        Unmap();
+    }
+    for (const Segment &segment : segments_) {
+        glDeleteSync(segment.fence);
+    }
+    stateCache_->DeleteBuffers(1, &buffer_);
+}
+
+StreamAllocation StreamRingBuffer::Allocate(GLsizeiptr bytes, GLsizeiptr alignment) {
+    StreamAllocation allocation = { nullptr, 0 };
+    if (bytes <= 0 || bytes > size_) {
+        aout << "StreamRingBuffer: cannot allocate " << bytes << " of " << size_ << " bytes"
+             << std::endl;
+        return allocation;
+    }
+    if (mapped_) {
+        Unmap();
+    }
+
+    // Align, and skip the tail of the buffer if the block does not fit before the end
+    long long position = (head_ + alignment - 1) / alignment * alignment;
+    GLintptr offset = (GLintptr) (position % size_);
+    if (offset + bytes > size_) {
+        position += size_ - offset;
+        offset = 0;
+    }
+
+    // The block overwrites whatever was written one buffer size earlier
+    WaitUntilRetired(position + bytes - size_);
+
+    stateCache_->BindBuffer(target_, buffer_);
+    allocation.ptr = glMapBufferRange(target_, offset, bytes,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+                                      | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!allocation.ptr) {
+        aout << "StreamRingBuffer: glMapBufferRange failed, 0x" << std::hex << glGetError()
+             << std::dec << std::endl;
+        return allocation;
+    }
+
+    mapped_ = true;
+    allocation.offset = offset;
+    head_ = position + bytes;
+    bytesAllocated_ += bytes;
+    return allocation;
+}
+
+void StreamRingBuffer::Unmap() {
+    stateCache_->BindBuffer(target_, buffer_);
+    glUnmapBuffer(target_);
+    mapped_ = false;
+}
+
+void StreamRingBuffer::Fence() {
+    if (head_ > fenced_) {
+        Segment segment = { glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), head_ };
+        segments_.push_back(segment);
+        fenced_ = head_;
+    }
+
+    // Retire without waiting, keeps the queue short
+    while (!segments_.empty()) {
+        GLenum status = glClientWaitSync(segments_.front().fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(segments_.front().fence);
+        retired_ = segments_.front().end;
+        segments_.pop_front();
+    }
+}
+
+void StreamRingBuffer::WaitUntilRetired(long long position) {
+    if (position <= retired_) {
+        return;
+    }
+
+    // Data of the current segment is about to be overwritten, which means a single frame
+    // streams more than the whole buffer. Close the segment so there is a fence to wait on.
+    if (position > fenced_) {
+        Fence();
+        if (position <= retired_) {
+            return;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    while (position > retired_ && !segments_.empty()) {
+        const Segment &segment = segments_.front();
+        GLenum status = glClientWaitSync(segment.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            continue;
+        }
+        glDeleteSync(segment.fence);
+        retired_ = segment.end;
+        segments_.pop_front();
+    }
+
+    stalls_++;
+    stallMs_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
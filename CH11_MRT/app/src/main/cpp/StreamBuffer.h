@@ -0,0 +1,91 @@
+#ifndef LEARNES3_STREAMBUFFER_H
+#define LEARNES3_STREAMBUFFER_H
+
+#include <GLES3/gl3.h>
+#include <deque>
+
+#include "GLStateCache.h"
+
+/*!
+ * One block handed out by StreamRingBuffer::Allocate. ptr is write-only mapped memory that
+ * stays valid until Unmap; offset is where the block starts inside the buffer object, to be
+ * used as the pointer argument of glVertexAttribPointer.
+ */
+struct StreamAllocation {
+    void *ptr;
+    GLintptr offset;
+};
+
+/*!
+ * Ring allocator over one large buffer object for geometry that is rebuilt every frame.
+ *
+ * Blocks are mapped with GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT, so the driver
+ * neither waits for the GPU nor copies the old contents. Instead the buffer is cut into segments
+ * by Fence, and a block is only handed out once the fences of every segment it overwrites have
+ * signaled. With a buffer that holds a few frames of data that wait never happens.
+ *
+ * ES 3.0 cannot draw from a mapped buffer, so every Allocate must be followed by Unmap before
+ * the draw that reads it. Must be used and destroyed with the GL context current.
+ */
+class StreamRingBuffer {
+public:
+    StreamRingBuffer(GLStateCache *stateCache, GLenum target, GLsizeiptr size);
+    virtual ~StreamRingBuffer();
+
+    /*!
+     * Maps bytes bytes at the next offset that is a multiple of alignment and leaves the buffer
+     * bound to its target. Returns {nullptr, 0} if bytes is larger than the buffer or mapping
+     * failed.
+     */
+    StreamAllocation Allocate(GLsizeiptr bytes, GLsizeiptr alignment = 4);
+
+    /*!
+     * Ends the writes to the last allocation.
+     */
+    void Unmap();
+
+    /*!
+     * Closes the current segment after the draws that read from it have been issued, usually
+     * once per frame. Also retires the older segments the GPU is already done with.
+     */
+    void Fence();
+
+    GLuint Buffer() const { return buffer_; }
+    GLsizeiptr Size() const { return size_; }
+
+    // Totals since construction
+    long long BytesAllocated() const { return bytesAllocated_; }
+    int Stalls() const { return stalls_; }
+    double StallMs() const { return stallMs_; }
+
+private:
+    struct Segment {
+        GLsync fence;
+        // Stream position just past the last byte of the segment
+        long long end;
+    };
+
+    /*!
+     * Blocks until every segment ending at or before position has been retired.
+     */
+    void WaitUntilRetired(long long position);
+
+    GLStateCache *stateCache_;
+    GLenum target_;
+    GLuint buffer_;
+    GLsizeiptr size_;
+
+    // Positions count bytes since construction and never wrap. The offset in the buffer is
+    // position % size_.
+    long long head_;
+    long long fenced_;
+    long long retired_;
+    std::deque<Segment> segments_;
+    bool mapped_;
+
+    long long bytesAllocated_;
+    int stalls_;
+    double stallMs_;
+};
+
+#endif //LEARNES3_STREAMBUFFER_H
@@ -0,0 +1,142 @@
+#ifndef LEARNES3_TEXTUREFACTORY_H
+#define LEARNES3_TEXTUREFACTORY_H
+
+#include <GLES3/gl3.h>
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+
+#include "GLStateCache.h"
+
+/*!
+ * Filtering and wrap state of a sampler object.
+ */
+struct SamplerDesc {
+    GLenum minFilter;
+    GLenum magFilter;
+    GLenum wrapS;
+    GLenum wrapT;
+    GLenum wrapR;
+
+    bool operator<(const SamplerDesc &other) const;
+};
+
+/*!
+ * Same filter in both directions and one wrap mode for all three coordinates.
+ */
+SamplerDesc MakeSamplerDesc(GLenum minFilter, GLenum magFilter, GLenum wrap);
+
+/*!
+ * Hands out one sampler object per distinct SamplerDesc, so textures carry no sampling state of
+ * their own and any number of them share a handful of samplers. A sampler bound to a unit
+ * overrides the parameters of whatever texture is bound there. Must be used and destroyed with
+ * the GL context current.
+ */
+class SamplerPool {
+public:
+    explicit SamplerPool(GLStateCache *stateCache);
+
+    /*!
+     * Deletes every sampler of the pool.
+     */
+    virtual ~SamplerPool();
+
+    /*!
+     * The sampler for desc, created on the first request.
+     */
+    GLuint Get(const SamplerDesc &desc);
+
+    /*!
+     * Get followed by a bind to unit, an index like glBindSampler takes.
+     */
+    void Bind(GLuint unit, const SamplerDesc &desc);
+
+    // Distinct samplers created and requests served, the difference is what sharing saved
+    size_t Samplers() const { return samplers_.size(); }
+    int Requests() const { return requests_; }
+
+private:
+    GLStateCache *stateCache_;
+    std::map<SamplerDesc, GLuint> samplers_;
+    int requests_;
+};
+
+/*!
+ * Shape of a texture made by TextureFactory.
+ */
+struct TextureDesc {
+    // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_3D or GL_TEXTURE_2D_ARRAY
+    GLenum target;
+    // Sized, like GL_RGBA8
+    GLenum internalFormat;
+    GLsizei width;
+    GLsizei height;
+    // Depth of 3D textures, layers of arrays, ignored otherwise
+    GLsizei depth;
+    // 0 for the full chain down to 1x1
+    GLsizei levels;
+};
+
+/*!
+ * Creates every texture with immutable glTexStorage2D/glTexStorage3D storage and the exact mip
+ * count, so the driver validates completeness once at creation instead of at every draw, and
+ * keeps count of the memory the storage takes. Sampling state does not belong to the texture,
+ * take it from a SamplerPool. Must be used and destroyed with the GL context current.
+ */
+class TextureFactory {
+public:
+    explicit TextureFactory(GLStateCache *stateCache);
+
+    /*!
+     * Deletes the textures that are still alive.
+     */
+    virtual ~TextureFactory();
+
+    /*!
+     * Returns a new texture, left bound to desc.target on the active unit, or 0 if desc is not
+     * valid for immutable storage.
+     */
+    GLuint Create(const TextureDesc &desc);
+
+    /*!
+     * Gives immutable storage to texture, a name from glGenTextures that was never bound, for
+     * code that has to hand out the name before it knows the size. Afterwards the texture is
+     * owned like one from Create. Returns false and leaves texture alone if desc is not valid.
+     */
+    bool CreateStorage(GLuint texture, const TextureDesc &desc);
+
+    /*!
+     * Deletes a texture made by Create and sets it to 0.
+     */
+    void Destroy(GLuint *texture);
+
+    /*!
+     * Levels of a full mip chain, from width x height x depth down to 1x1x1.
+     */
+    static GLsizei FullMipLevels(GLsizei width, GLsizei height, GLsizei depth = 1);
+
+    /*!
+     * Bytes of the storage desc asks for, 0 for formats this does not know. Drivers add padding
+     * and alignment, so this is a lower bound of what the GPU really spends.
+     */
+    static size_t StorageBytes(const TextureDesc &desc);
+
+    /*!
+     * Block footprint and size of a compressed format, ETC2/EAC or ASTC, false for anything else.
+     */
+    static bool BlockInfo(GLenum internalFormat, int *blockWidth, int *blockHeight,
+                          int *blockBytes);
+
+    // Alive textures and their storage
+    size_t Textures() const { return bytes_.size(); }
+    size_t Bytes() const { return totalBytes_; }
+
+private:
+    static size_t TexelBytes(GLenum internalFormat);
+
+    GLStateCache *stateCache_;
+    std::unordered_map<GLuint, size_t> bytes_;
+    size_t totalBytes_;
+};
+
+#endif //LEARNES3_TEXTUREFACTORY_H
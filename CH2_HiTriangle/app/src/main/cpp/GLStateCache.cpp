@@ -0,0 +1,365 @@
+#include "GLStateCache.h"
+
+#include <iterator>
+
+namespace {
+
+// No GL name or enum has this value, so a shadow holding it never matches
+const GLuint kUnknown = 0xFFFFFFFFu;
+
+} // namespace
+
+GLStateCache::GLStateCache(): frame_(), lastFrame_() {
+    Invalidate();
+}
+
+int GLStateCache::TextureTargetIndex(GLenum target) {
+    switch (target) {
+        case GL_TEXTURE_2D:
+            return 0;
+        case GL_TEXTURE_CUBE_MAP:
+            return 1;
+        case GL_TEXTURE_3D:
+            return 2;
+        case GL_TEXTURE_2D_ARRAY:
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+int GLStateCache::BufferTargetIndex(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER:
+            return 0;
+        case GL_ELEMENT_ARRAY_BUFFER:
+            return 1;
+        case GL_UNIFORM_BUFFER:
+            return 2;
+        case GL_PIXEL_PACK_BUFFER:
+            return 3;
+        case GL_PIXEL_UNPACK_BUFFER:
+            return 4;
+        case GL_COPY_READ_BUFFER:
+            return 5;
+        case GL_COPY_WRITE_BUFFER:
+            return 6;
+        case GL_TRANSFORM_FEEDBACK_BUFFER:
+            return 7;
+        default:
+            return -1;
+    }
+}
+
+int GLStateCache::CapIndex(GLenum cap) {
+    switch (cap) {
+        case GL_BLEND:
+            return 0;
+        case GL_CULL_FACE:
+            return 1;
+        case GL_DEPTH_TEST:
+            return 2;
+        case GL_SCISSOR_TEST:
+            return 3;
+        case GL_PRIMITIVE_RESTART_FIXED_INDEX:
+            return 4;
+        default:
+            return -1;
+    }
+}
+
+bool GLStateCache::Update(GLuint &shadow, GLuint value) {
+    if (shadow == value) {
+        frame_.filtered++;
+        return false;
+    }
+    shadow = value;
+    frame_.forwarded++;
+    return true;
+}
+
+void GLStateCache::UseProgram(GLuint program) {
+    if (Update(program_, program)) {
+        glUseProgram(program);
+    }
+}
+
+void GLStateCache::ActiveTexture(GLenum unit) {
+    if (Update(activeTexture_, unit)) {
+        glActiveTexture(unit);
+    }
+}
+
+void GLStateCache::BindTexture(GLenum target, GLuint texture) {
+    int unit = (int) (activeTexture_ - GL_TEXTURE0);
+    int index = TextureTargetIndex(target);
+    if (activeTexture_ == kUnknown || unit >= kTextureUnits || index < 0) {
+        frame_.forwarded++;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (Update(textures_[unit][index], texture)) {
+        glBindTexture(target, texture);
+    }
+}
+
+void GLStateCache::BindSampler(GLuint unit, GLuint sampler) {
+    if (unit >= (GLuint) kTextureUnits) {
+        frame_.forwarded++;
+        glBindSampler(unit, sampler);
+        return;
+    }
+    if (Update(samplers_[unit], sampler)) {
+        glBindSampler(unit, sampler);
+    }
+}
+
+void GLStateCache::BindBuffer(GLenum target, GLuint buffer) {
+    int index = BufferTargetIndex(target);
+    if (index < 0) {
+        frame_.forwarded++;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (Update(buffers_[index], buffer)) {
+        glBindBuffer(target, buffer);
+    }
+}
+
+void GLStateCache::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset,
+                                   GLsizeiptr size) {
+    // The generic binding only changes when GL is actually called, a filtered call leaves it
+    int generic = BufferTargetIndex(target);
+
+    // Only the uniform binding points are shadowed
+    if (target != GL_UNIFORM_BUFFER || index >= kUniformBindings) {
+        if (generic >= 0) {
+            buffers_[generic] = buffer;
+        }
+        frame_.forwarded++;
+        glBindBufferRange(target, index, buffer, offset, size);
+        return;
+    }
+
+    BufferRange &bound = uniformBindings_[index];
+    if (bound.buffer == buffer && bound.offset == offset && bound.size == size) {
+        frame_.filtered++;
+        return;
+    }
+    bound.buffer = buffer;
+    bound.offset = offset;
+    bound.size = size;
+    if (generic >= 0) {
+        buffers_[generic] = buffer;
+    }
+    frame_.forwarded++;
+    glBindBufferRange(target, index, buffer, offset, size);
+}
+
+void GLStateCache::BindVertexArray(GLuint vertexArray) {
+    if (Update(vertexArray_, vertexArray)) {
+        glBindVertexArray(vertexArray);
+        // The element array binding belongs to the VAO
+        buffers_[BufferTargetIndex(GL_ELEMENT_ARRAY_BUFFER)] = kUnknown;
+    }
+}
+
+void GLStateCache::BindFramebuffer(GLenum target, GLuint framebuffer) {
+    bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    if ((!draw || drawFramebuffer_ == framebuffer) && (!read || readFramebuffer_ == framebuffer)) {
+        frame_.filtered++;
+        return;
+    }
+    if (draw) {
+        drawFramebuffer_ = framebuffer;
+    }
+    if (read) {
+        readFramebuffer_ = framebuffer;
+    }
+    frame_.forwarded++;
+    glBindFramebuffer(target, framebuffer);
+}
+
+void GLStateCache::Viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if (viewportKnown_ && viewport_[0] == x && viewport_[1] == y && viewport_[2] == width
+        && viewport_[3] == height) {
+        frame_.filtered++;
+        return;
+    }
+    viewport_[0] = x;
+    viewport_[1] = y;
+    viewport_[2] = width;
+    viewport_[3] = height;
+    viewportKnown_ = true;
+    frame_.forwarded++;
+    glViewport(x, y, width, height);
+}
+
+void GLStateCache::SetCap(GLenum cap, bool enabled) {
+    int index = CapIndex(cap);
+    if (index >= 0 && !Update(caps_[index], enabled ? GL_TRUE : GL_FALSE)) {
+        return;
+    }
+    if (index < 0) {
+        frame_.forwarded++;
+    }
+    if (enabled) {
+        glEnable(cap);
+    } else {
+        glDisable(cap);
+    }
+}
+
+void GLStateCache::Enable(GLenum cap) {
+    SetCap(cap, true);
+}
+
+void GLStateCache::Disable(GLenum cap) {
+    SetCap(cap, false);
+}
+
+void GLStateCache::BlendFunc(GLenum sfactor, GLenum dfactor) {
+    if (blendSrc_ == sfactor && blendDst_ == dfactor) {
+        frame_.filtered++;
+        return;
+    }
+    blendSrc_ = sfactor;
+    blendDst_ = dfactor;
+    frame_.forwarded++;
+    glBlendFunc(sfactor, dfactor);
+}
+
+void GLStateCache::CullFace(GLenum mode) {
+    if (Update(cullFace_, mode)) {
+        glCullFace(mode);
+    }
+}
+
+void GLStateCache::Uniform1i(GLint location, GLint value) {
+    if (program_ == kUnknown || location < 0) {
+        frame_.forwarded++;
+        glUniform1i(location, value);
+        return;
+    }
+
+    unsigned long long key = ((unsigned long long) program_ << 32) | (GLuint) location;
+    auto found = uniforms_.find(key);
+    if (found != uniforms_.end() && found->second == value) {
+        frame_.filtered++;
+        return;
+    }
+    uniforms_[key] = value;
+    frame_.forwarded++;
+    glUniform1i(location, value);
+}
+
+void GLStateCache::DeletePrograms(GLsizei n, const GLuint *programs) {
+    for (GLsizei i = 0; i < n; i++) {
+        glDeleteProgram(programs[i]);
+        if (program_ == programs[i]) {
+            program_ = kUnknown;
+        }
+        for (auto it = uniforms_.begin(); it != uniforms_.end();) {
+            it = (it->first >> 32) == programs[i] ? uniforms_.erase(it) : std::next(it);
+        }
+    }
+}
+
+void GLStateCache::DeleteTextures(GLsizei n, const GLuint *textures) {
+    glDeleteTextures(n, textures);
+    for (GLsizei i = 0; i < n; i++) {
+        for (auto &unit : textures_) {
+            for (GLuint &bound : unit) {
+                if (bound == textures[i]) {
+                    bound = 0;
+                }
+            }
+        }
+    }
+}
+
+void GLStateCache::DeleteSamplers(GLsizei n, const GLuint *samplers) {
+    glDeleteSamplers(n, samplers);
+    for (GLsizei i = 0; i < n; i++) {
+        for (GLuint &bound : samplers_) {
+            if (bound == samplers[i]) {
+                bound = 0;
+            }
+        }
+    }
+}
+
+void GLStateCache::DeleteBuffers(GLsizei n, const GLuint *buffers) {
+    glDeleteBuffers(n, buffers);
+    for (GLsizei i = 0; i < n; i++) {
+        for (GLuint &bound : buffers_) {
+            if (bound == buffers[i]) {
+                bound = 0;
+            }
+        }
+        for (BufferRange &bound : uniformBindings_) {
+            if (bound.buffer == buffers[i]) {
+                bound.buffer = 0;
+            }
+        }
+    }
+}
+
+void GLStateCache::DeleteVertexArrays(GLsizei n, const GLuint *vertexArrays) {
+    glDeleteVertexArrays(n, vertexArrays);
+    for (GLsizei i = 0; i < n; i++) {
+        if (vertexArray_ == vertexArrays[i]) {
+            vertexArray_ = 0;
+            buffers_[BufferTargetIndex(GL_ELEMENT_ARRAY_BUFFER)] = kUnknown;
+        }
+    }
+}
+
+void GLStateCache::DeleteFramebuffers(GLsizei n, const GLuint *framebuffers) {
+    glDeleteFramebuffers(n, framebuffers);
+    for (GLsizei i = 0; i < n; i++) {
+        if (drawFramebuffer_ == framebuffers[i]) {
+            drawFramebuffer_ = 0;
+        }
+        if (readFramebuffer_ == framebuffers[i]) {
+            readFramebuffer_ = 0;
+        }
+    }
+}
+
+void GLStateCache::Invalidate() {
+    program_ = kUnknown;
+    activeTexture_ = kUnknown;
+    for (auto &unit : textures_) {
+        for (GLuint &bound : unit) {
+            bound = kUnknown;
+        }
+    }
+    for (GLuint &bound : samplers_) {
+        bound = kUnknown;
+    }
+    for (GLuint &bound : buffers_) {
+        bound = kUnknown;
+    }
+    for (BufferRange &bound : uniformBindings_) {
+        bound.buffer = kUnknown;
+    }
+    vertexArray_ = kUnknown;
+    drawFramebuffer_ = kUnknown;
+    readFramebuffer_ = kUnknown;
+    viewportKnown_ = false;
+    for (GLuint &cap : caps_) {
+        cap = kUnknown;
+    }
+    blendSrc_ = kUnknown;
+    blendDst_ = kUnknown;
+    cullFace_ = kUnknown;
+    uniforms_.clear();
+}
+
+void GLStateCache::EndFrame() {
+    lastFrame_ = frame_;
+    frame_.forwarded = 0;
+    frame_.filtered = 0;
+}
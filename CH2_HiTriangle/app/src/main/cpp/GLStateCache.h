@@ -0,0 +1,124 @@
+#ifndef LEARNES3_GLSTATECACHE_H
+#define LEARNES3_GLSTATECACHE_H
+
+#include <GLES3/gl3.h>
+#include <unordered_map>
+
+/*!
+ * Calls seen by GLStateCache during one frame.
+ */
+struct GLStateCounters {
+    // Calls that reached GL
+    int forwarded;
+    // Calls dropped because they would not have changed anything
+    int filtered;
+};
+
+/*!
+ * Shadows the bindings and fixed-function state the samples change every frame, and only
+ * forwards a call to GL when it changes the shadowed value.
+ *
+ * The shadow is only right as long as every change of that state goes through the cache. Code
+ * that calls GL directly has to call Invalidate afterwards. Objects must be deleted through the
+ * cache too, since GL silently unbinds them and may hand the name out again.
+ *
+ * Per-VAO state (the element array buffer) is forgotten whenever the VAO binding changes.
+ * Uniforms are shadowed per program and location.
+ */
+class GLStateCache {
+public:
+    GLStateCache();
+    virtual ~GLStateCache() {}
+
+    void UseProgram(GLuint program);
+    void ActiveTexture(GLenum unit);
+    // Binds to the active unit
+    void BindTexture(GLenum target, GLuint texture);
+    // unit is an index, not GL_TEXTURE0 + index, like glBindSampler takes it
+    void BindSampler(GLuint unit, GLuint sampler);
+    void BindBuffer(GLenum target, GLuint buffer);
+    // Also binds buffer to the generic target, like GL does
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset,
+                         GLsizeiptr size);
+    void BindVertexArray(GLuint vertexArray);
+    // GL_FRAMEBUFFER, GL_DRAW_FRAMEBUFFER or GL_READ_FRAMEBUFFER
+    void BindFramebuffer(GLenum target, GLuint framebuffer);
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    // Shadowed for GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_SCISSOR_TEST and
+    // GL_PRIMITIVE_RESTART_FIXED_INDEX, always forwarded for other caps
+    void Enable(GLenum cap);
+    void Disable(GLenum cap);
+    void BlendFunc(GLenum sfactor, GLenum dfactor);
+    void CullFace(GLenum mode);
+
+    // Sets a uniform of the current program
+    void Uniform1i(GLint location, GLint value);
+
+    void DeletePrograms(GLsizei n, const GLuint *programs);
+    void DeleteTextures(GLsizei n, const GLuint *textures);
+    void DeleteSamplers(GLsizei n, const GLuint *samplers);
+    void DeleteBuffers(GLsizei n, const GLuint *buffers);
+    void DeleteVertexArrays(GLsizei n, const GLuint *vertexArrays);
+    void DeleteFramebuffers(GLsizei n, const GLuint *framebuffers);
+
+    /*!
+     * Forgets everything, the next call of each kind is forwarded.
+     */
+    void Invalidate();
+
+    /*!
+     * Closes the counters of the current frame, once per frame after the swap.
+     */
+    void EndFrame();
+
+    const GLStateCounters& LastFrame() const { return lastFrame_; }
+
+private:
+    static const int kTextureUnits = 16;
+    static const int kTextureTargets = 4;
+    static const int kBufferTargets = 8;
+    static const int kCaps = 5;
+    static const int kUniformBindings = 8;
+
+    struct BufferRange {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    static int TextureTargetIndex(GLenum target);
+    static int BufferTargetIndex(GLenum target);
+    static int CapIndex(GLenum cap);
+
+    /*!
+     * Stores value in shadow and returns true if it differs, counting the call either way.
+     */
+    bool Update(GLuint &shadow, GLuint value);
+
+    void SetCap(GLenum cap, bool enabled);
+
+    GLuint program_;
+    GLuint activeTexture_;
+    GLuint textures_[kTextureUnits][kTextureTargets];
+    GLuint samplers_[kTextureUnits];
+    GLuint buffers_[kBufferTargets];
+    BufferRange uniformBindings_[kUniformBindings];
+    GLuint vertexArray_;
+    GLuint drawFramebuffer_;
+    GLuint readFramebuffer_;
+    GLint viewport_[4];
+    bool viewportKnown_;
+    GLuint caps_[kCaps];
+    GLuint blendSrc_;
+    GLuint blendDst_;
+    GLuint cullFace_;
+
+    // Keyed by program << 32 | location
+    std::unordered_map<unsigned long long, GLint> uniforms_;
+
+    GLStateCounters frame_;
+    GLStateCounters lastFrame_;
+};
+
+#endif //LEARNES3_GLSTATECACHE_H
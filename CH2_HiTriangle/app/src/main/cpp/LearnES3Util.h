@@ -50,6 +50,9 @@
 // #include <android_native_app_glue.h>
 #include <time.h>
 
+#include "FrameConstants.h"
+#include "ProgramCache.h"
+
 ///
 //  Macros
 //
@@ -136,3 +139,121 @@ GLuint LoadShader(GLenum type, const char *shaderSrc) {
    return shader;
 }
 
+//
+///
+/// \brief Load a vertex and fragment shader, create a program object, link program.
+//         Errors output to log.
+/// \param vertShaderSrc Vertex shader source code
+/// \param fragShaderSrc Fragment shader source code
+/// \param retrievable Sets GL_PROGRAM_BINARY_RETRIEVABLE_HINT before linking
+/// \return A new program object linked with the vertex/fragment shader pair, 0 on failure
+//
+GLuint ESUTIL_API esLoadProgram ( const char *vertShaderSrc, const char *fragShaderSrc,
+                                  GLboolean retrievable = GL_FALSE )
+{
+   GLuint vertexShader;
+   GLuint fragmentShader;
+   GLuint programObject;
+   GLint linked;
+
+   // Load the vertex/fragment shaders
+   vertexShader = LoadShader ( GL_VERTEX_SHADER, vertShaderSrc );
+
+   if ( vertexShader == 0 )
+   {
+      return 0;
+   }
+
+   fragmentShader = LoadShader ( GL_FRAGMENT_SHADER, fragShaderSrc );
+
+   if ( fragmentShader == 0 )
+   {
+      glDeleteShader ( vertexShader );
+      return 0;
+   }
+
+   // Create the program object
+   programObject = glCreateProgram ( );
+
+   if ( programObject == 0 )
+   {
+      return 0;
+   }
+
+   glAttachShader ( programObject, vertexShader );
+   glAttachShader ( programObject, fragmentShader );
+
+   if ( retrievable )
+   {
+      glProgramParameteri ( programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+   }
+
+   // Link the program
+   glLinkProgram ( programObject );
+
+   // Check the link status
+   glGetProgramiv ( programObject, GL_LINK_STATUS, &linked );
+
+   if ( !linked )
+   {
+      GLint infoLen = 0;
+
+      glGetProgramiv ( programObject, GL_INFO_LOG_LENGTH, &infoLen );
+
+      if ( infoLen > 1 )
+      {
+         char* infoLog = (char*)malloc(sizeof(char) * infoLen);
+
+         glGetProgramInfoLog ( programObject, infoLen, NULL, infoLog );
+         esLogMessage ( "Error linking program:\n%s\n", infoLog );
+
+         free ( infoLog );
+      }
+
+      glDeleteProgram ( programObject );
+      return 0;
+   }
+
+   // Share the per-frame uniform buffer with every other program
+   esBindFrameConstantsBlock ( programObject );
+
+   // Free up no longer needed shader resources
+   glDeleteShader ( vertexShader );
+   glDeleteShader ( fragmentShader );
+
+   return programObject;
+}
+
+//
+///
+/// \brief Same as esLoadProgram, but goes through a program binary cache first.
+/// \param cache Cache to look in and fill, compiles from source when NULL
+/// \param vertShaderSrc Vertex shader source code
+/// \param fragShaderSrc Fragment shader source code
+/// \return A new program object, 0 on failure
+//
+inline GLuint ESUTIL_API esLoadProgramCached ( ProgramCache *cache, const char *vertShaderSrc,
+                                               const char *fragShaderSrc )
+{
+   GLuint programObject;
+
+   if ( cache == NULL )
+   {
+      return esLoadProgram ( vertShaderSrc, fragShaderSrc );
+   }
+
+   programObject = cache->Load ( vertShaderSrc, fragShaderSrc,
+                                 [] ( const char *vert, const char *frag )
+                                 {
+                                    return esLoadProgram ( vert, frag, GL_TRUE );
+                                 } );
+
+   // glProgramBinary resets the block bindings like a fresh link does
+   if ( programObject != 0 )
+   {
+      esBindFrameConstantsBlock ( programObject );
+   }
+
+   return programObject;
+}
+
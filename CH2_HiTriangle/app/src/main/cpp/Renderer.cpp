@@ -7,11 +7,13 @@
 
 
 #include <cassert>
+#include <chrono>
 #include <memory>
 #include <vector>
 
 #include "AndroidOut.h"
 #include "LearnES3Util.h"
+#include "GLStateCache.h"
 
 //! executes glGetString and outputs the result to logcat
 #define PRINT_GL_STRING(s) { aout << #s": " << glGetString(s) << std::endl; }
@@ -38,17 +40,28 @@ aout << std::endl;\
 //! Color for cornflower blue. Can be sent directly to glClearColor
 #define CORNFLOWER_BLUE 100 / 255.f, 149 / 255.f, 237 / 255.f, 1
 
-// Initialize the shader and program object
-bool TriangleRender::Init() {
+//! Number of frames averaged per line of the frame time log
+static const int kFrameStatsInterval = 120;
+
+//                                        position,          |   color
+static const GLfloat kTriangleVertices[] = {  0.0f,  0.5f, 0.0f,  1.0f, 0.0f, 0.0f,
+                                             -0.5f, -0.5f, 0.0f,  0.0f, 1.0f, 0.0f,
+                                              0.5f, -0.5f, 0.0f,  0.0f, 0.0f, 1.0f
+};
+
+// Queue the program, Init runs once it is linked
+void TriangleRender::AddPrograms(ProgramBatch* batch) {
     char vShaderStr[] =
             "#version 300 es                          \n"
+            ES_FRAME_CONSTANTS_GLSL
             "layout(location = 0) in vec3 vPosition;  \n"
             "layout(location = 1) in vec3 vColor;     \n"
             "                                         \n"
             "smooth out vec3 vertOutColor;            \n"
             "void main()                              \n"
             "{                                        \n"
-            "   gl_Position = vec4(vPosition, 1.0);   \n"
+            "   gl_Position = u_projection * u_view   \n"
+            "               * vec4(vPosition, 1.0);   \n"
             "   vertOutColor = vColor;                \n"
             "}                                        \n";
 
@@ -63,54 +76,29 @@ bool TriangleRender::Init() {
             "    fragColor = vec4(vertOutColor, 1.0);     \n"
             "}                                            \n";
 
-    GLuint vertexShader;
-    GLuint fragmentShader;
-    GLuint programObject;
-    GLint linked;
-
-    // Load the vertex/fragment shaders
-    vertexShader = LoadShader(GL_VERTEX_SHADER, vShaderStr);
-    fragmentShader = LoadShader(GL_FRAGMENT_SHADER, fShaderStr);
-
-    // Create the program object
-    programObject = glCreateProgram ( );
-    if ( programObject == 0 ) {
-        return 0;
-    }
-
-    glAttachShader(programObject, vertexShader);
-    glAttachShader(programObject, fragmentShader);
-
-    // Link the program
-    glLinkProgram ( programObject );
-
-    // Check the link status
-    glGetProgramiv(programObject, GL_LINK_STATUS, &linked);
-    if (!linked) {
-        GLint infoLen = 0;
-
-        glGetProgramiv ( programObject, GL_INFO_LOG_LENGTH, &infoLen );
-
-        if ( infoLen > 1 )
-        {
-            char* infoLog = (char*)malloc ( sizeof ( char ) * infoLen );
-
-            glGetProgramInfoLog ( programObject, infoLen, nullptr, infoLog );
-            esLogMessage ( "Error linking program:\n%s\n", infoLog );
-
-            free ( infoLog );
-        }
+    batch->Add(vShaderStr, fShaderStr, &program_object_);
+}
 
-        glDeleteProgram ( programObject );
+// Initialize the vertex data once the program is linked
+bool TriangleRender::Init() {
+    if (program_object_ == 0) {
         return FALSE;
     }
 
-    // Store the program object
-    program_object_ = programObject;
+    // Upload the triangle once and record its attribute setup for the retained path
+    glGenBuffers(1, &vbo_);
+    state_cache_->BindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(kTriangleVertices), kTriangleVertices, GL_STATIC_DRAW);
+
+    glGenVertexArrays(1, &vao_);
+    state_cache_->BindVertexArray(vao_);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
 
-    // indicate auto delete shader when program been deleted.
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    state_cache_->BindVertexArray(0);
+    state_cache_->BindBuffer(GL_ARRAY_BUFFER, 0);
 
     glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
     return TRUE;
@@ -118,36 +106,65 @@ bool TriangleRender::Init() {
 
 // No EBO, direct draw triangles.
 void TriangleRender::Draw(GLsizei width, GLsizei height) const {
-    //                        position,                      |   color
-    GLfloat vVertices[] = {   0.0f,  0.5f, 0.0f,  1.0f, 0.0f, 0.0f,
-                              -0.5f, -0.5f, 0.0f,  0.0f, 1.0f, 0.0f,
-                              0.5f, -0.5f,0.0f, 0.0f, 0.0f, 1.0f
-    };
-
     // Set the viewport
-    glViewport ( 0, 0, width, height);
+    state_cache_->Viewport ( 0, 0, width, height);
 
     // Clear the color buffer
     glClear(GL_COLOR_BUFFER_BIT);
 
     // Use the program object
-    glUseProgram(program_object_);
+    state_cache_->UseProgram(program_object_);
+
+    if (submit_mode_ == kSubmitRetained) {
+        DrawRetained();
+    } else {
+        DrawClientArrays();
+    }
+}
+
+void TriangleRender::DrawClientArrays() const {
+    // Client pointers are only allowed with the default vertex array object bound.
+    state_cache_->BindVertexArray(0);
 
     // disable vbo.
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    state_cache_->BindBuffer(GL_ARRAY_BUFFER, 0);
 
     // Load the vertex data, position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), vVertices);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), kTriangleVertices);
     glEnableVertexAttribArray(0);
 
     // Load the vertex data, color
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(vVertices + 3));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                          (void*)(kTriangleVertices + 3));
     glEnableVertexAttribArray(1);
 
     glDrawArrays ( GL_TRIANGLES, 0, 3 );
 }
 
+void TriangleRender::DrawRetained() const {
+    // Buffer and attribute state were recorded in Init, nothing to respecify.
+    // It stays bound; the client array path switches back to VAO 0 before touching attributes.
+    state_cache_->BindVertexArray(vao_);
+    glDrawArrays ( GL_TRIANGLES, 0, 3 );
+}
+
 Renderer::~Renderer() {
+    // GL objects have to go while the context is still current
+    delete triangle_render_;
+    triangle_render_ = nullptr;
+
+    delete program_batch_;
+    program_batch_ = nullptr;
+
+    delete program_cache_;
+    program_cache_ = nullptr;
+
+    delete frame_constants_buffer_;
+    frame_constants_buffer_ = nullptr;
+
+    delete state_cache_;
+    state_cache_ = nullptr;
+
     if (display_ != EGL_NO_DISPLAY) {
         eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
         if (context_ != EGL_NO_CONTEXT) {
@@ -161,9 +178,6 @@ Renderer::~Renderer() {
         eglTerminate(display_);
         display_ = EGL_NO_DISPLAY;
     }
-
-    delete triangle_render_;
-    triangle_render_ = nullptr;
 }
 
 void Renderer::render() {
@@ -172,24 +186,93 @@ void Renderer::render() {
     // changed.
     updateRenderArea();
 
+    // Nothing to draw until the programs are linked, keep presenting the clear color
+    if (!finishPrograms()) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        auto swapResult = eglSwapBuffers(display_, surface_);
+        assert(swapResult == EGL_TRUE);
+        return;
+    }
+
     // When the renderable area changes, the projection matrix has to also be updated. This is true
     // even if you change from the sample orthographic projection matrix as your aspect ratio has
     // likely changed.
     if (shaderNeedsNewProjectionMatrix_) {
+        SetAspectOrtho(frameConstants_.projection, width_, height_);
+        frameConstants_.viewport[2] = (GLfloat) width_;
+        frameConstants_.viewport[3] = (GLfloat) height_;
         shaderNeedsNewProjectionMatrix_ = false;
     }
 
-    // clear the color buffer
-    glClear(GL_COLOR_BUFFER_BIT);
+    // Global shader inputs go out once per frame, every program reads them from
+    // ES_FRAME_CONSTANTS_BINDING
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime_)
+            .count();
+    frameConstants_.time[1] = seconds - frameConstants_.time[0];
+    frameConstants_.time[0] = seconds;
+    frameConstants_.time[2] += 1.0f;
+    frame_constants_buffer_->Update(frameConstants_);
+
+    if (switchSubmitModeRequested_) {
+        switchSubmitModeRequested_ = false;
+        bool retained = triangle_render_->GetSubmitMode() == TriangleRender::kSubmitRetained;
+        triangle_render_->SetSubmitMode(retained ? TriangleRender::kSubmitClientArrays
+                                                 : TriangleRender::kSubmitRetained);
+        aout << "Submit mode: " << (retained ? "client arrays" : "retained") << std::endl;
+
+        // Averages must not mix the two modes
+        lastFrameTime_ = std::chrono::steady_clock::time_point();
+        frameCount_ = 0;
+        frameMs_ = 0.0;
+        drawMs_ = 0.0;
+    }
 
-    // Render all the models. There's no depth testing in this sample so they're accepted in the
-    // order provided. But the sample EGL setup requests a 24 bit depth buffer so you could
-    // configure it at the end of initRenderer
+    // Render all the models. The renderer clears the color buffer itself. There's no depth
+    // testing in this sample so they're accepted in the order provided. But the sample EGL setup
+    // requests a 24 bit depth buffer so you could configure it at the end of initRenderer
+    auto drawStart = std::chrono::steady_clock::now();
     triangle_render_->Draw(width_, height_);
+    updateFrameStats(std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - drawStart).count());
 
     // Present the rendered image. This is an implicit glFlush.
     auto swapResult = eglSwapBuffers(display_, surface_);
     assert(swapResult == EGL_TRUE);
+
+    // A steady scene makes the same calls every frame, so only log when the counts move
+    state_cache_->EndFrame();
+    const GLStateCounters &counters = state_cache_->LastFrame();
+    if (counters.forwarded != loggedStateCounters_.forwarded
+        || counters.filtered != loggedStateCounters_.filtered) {
+        aout << "GL state calls per frame: " << counters.forwarded << " forwarded, "
+             << counters.filtered << " filtered" << std::endl;
+        loggedStateCounters_ = counters;
+    }
+}
+
+void Renderer::updateFrameStats(double drawMs) {
+    auto now = std::chrono::steady_clock::now();
+    auto last = lastFrameTime_;
+    lastFrameTime_ = now;
+
+    // The first frame of a mode has no previous frame to measure against
+    if (last == std::chrono::steady_clock::time_point()) {
+        return;
+    }
+
+    frameMs_ += std::chrono::duration<double, std::milli>(now - last).count();
+    drawMs_ += drawMs;
+    if (++frameCount_ < kFrameStatsInterval) {
+        return;
+    }
+
+    bool retained = triangle_render_->GetSubmitMode() == TriangleRender::kSubmitRetained;
+    aout << (retained ? "retained" : "client arrays") << ": " << frameMs_ / frameCount_
+         << " ms/frame, " << drawMs_ / frameCount_ << " ms cpu draw" << std::endl;
+
+    frameCount_ = 0;
+    frameMs_ = 0.0;
+    drawMs_ = 0.0;
 }
 
 void Renderer::initRenderer() {
@@ -269,11 +352,46 @@ void Renderer::initRenderer() {
     glClearColor(CORNFLOWER_BLUE);
 
     // enable alpha globally for now, you probably don't want to do this in a game
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    state_cache_ = new GLStateCache();
+    state_cache_->Enable(GL_BLEND);
+    state_cache_->BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    frame_constants_buffer_ = new FrameConstantsBuffer(state_cache_);
+    SetIdentity(frameConstants_.projection);
+    SetIdentity(frameConstants_.view);
+    startTime_ = std::chrono::steady_clock::now();
+
+    program_cache_ = new ProgramCache(app_->activity->internalDataPath
+                                      ? app_->activity->internalDataPath : "");
+
+    triangle_render_ = new TriangleRender(state_cache_);
+
+    // Compiles run while the first frames are presented, see finishPrograms
+    program_batch_ = new ProgramBatch(program_cache_);
+    triangle_render_->AddPrograms(program_batch_);
+    program_batch_->Submit();
+}
+
+bool Renderer::finishPrograms() {
+    if (!program_batch_) {
+        return true;
+    }
+    if (!program_batch_->IsReady()) {
+        return false;
+    }
 
-    triangle_render_ = new TriangleRender();
-    triangle_render_->Init();
+    program_batch_->Finish();
+    delete program_batch_;
+    program_batch_ = nullptr;
+
+    if (!triangle_render_->Init()) {
+        aout << "Renderer init failed" << std::endl;
+    }
+
+    aout << "Programs: " << program_cache_->Hits() << " cached in " << program_cache_->HitMs()
+         << " ms, " << program_cache_->Misses() << " built in " << program_cache_->MissMs()
+         << " ms (" << program_cache_->Rejected() << " rejected)" << std::endl;
+    return true;
 }
 
 void Renderer::updateRenderArea() {
@@ -286,7 +404,7 @@ void Renderer::updateRenderArea() {
     if (width != width_ || height != height_) {
         width_ = width;
         height_ = height;
-        glViewport(0, 0, width, height);
+        state_cache_->Viewport(0, 0, width, height);
 
         // make sure that we lazily recreate the projection matrix before we render
         shaderNeedsNewProjectionMatrix_ = true;
@@ -322,6 +440,9 @@ void Renderer::handleInput() {
             case AMOTION_EVENT_ACTION_POINTER_DOWN:
                 aout << "(" << pointer.id << ", " << x << ", " << y << ") "
                      << "Pointer Down";
+
+                // A tap switches between client arrays and retained submission
+                switchSubmitModeRequested_ = true;
                 break;
 
             case AMOTION_EVENT_ACTION_CANCEL:
@@ -3,23 +3,59 @@
 
 #include <EGL/egl.h>
 #include <GLES3/gl3.h>
+#include <chrono>
 #include <memory>
 
+#include "FrameConstants.h"
+#include "GLStateCache.h"
+#include "ProgramBatch.h"
+#include "ProgramCache.h"
+
 struct android_app;
 
 class TriangleRender {
 public:
-    TriangleRender(): program_object_(0) {}
+    /*!
+     * How the triangle reaches the GPU
+     */
+    enum SubmitMode {
+        // Vertex data is passed as client pointers on every draw and copied by the driver
+        kSubmitClientArrays,
+        // Vertex data lives in a static buffer, the attribute setup in a vertex array object
+        kSubmitRetained
+    };
+
+    explicit TriangleRender(GLStateCache* state_cache):
+            program_object_(0), vao_(0), vbo_(0), submit_mode_(kSubmitRetained),
+            state_cache_(state_cache) {}
     virtual ~TriangleRender() {
-        glDeleteProgram(program_object_);
+        state_cache_->DeletePrograms(1, &program_object_);
         program_object_ = 0;
+        state_cache_->DeleteVertexArrays(1, &vao_);
+        vao_ = 0;
+        state_cache_->DeleteBuffers(1, &vbo_);
+        vbo_ = 0;
     }
 
+    /*!
+     * Queues the programs of the renderer. Init must wait until the batch has finished.
+     */
+    void AddPrograms(ProgramBatch* batch);
     bool Init();
     void Draw(GLsizei width, GLsizei height) const;
 
+    void SetSubmitMode(SubmitMode mode) { submit_mode_ = mode; }
+    SubmitMode GetSubmitMode() const { return submit_mode_; }
+
 private:
+    void DrawClientArrays() const;
+    void DrawRetained() const;
+
     GLuint program_object_;
+    GLuint vao_;
+    GLuint vbo_;
+    SubmitMode submit_mode_;
+    GLStateCache* state_cache_;
 };
 
 
@@ -36,7 +72,17 @@ public:
             width_(0),
             height_(0),
             shaderNeedsNewProjectionMatrix_(true),
-            triangle_render_(nullptr) {
+            state_cache_(nullptr),
+            loggedStateCounters_(),
+            frame_constants_buffer_(nullptr),
+            frameConstants_(),
+            program_cache_(nullptr),
+            program_batch_(nullptr),
+            triangle_render_(nullptr),
+            switchSubmitModeRequested_(false),
+            frameCount_(0),
+            frameMs_(0.0),
+            drawMs_(0.0) {
         initRenderer();
     }
 
@@ -67,6 +113,12 @@ private:
      */
     void updateRenderArea();
 
+    /*!
+     * Finishes the program batch and initializes the renderer once the driver is done
+     * compiling. Returns false while it is still busy.
+     */
+    bool finishPrograms();
+
     android_app* app_;
     EGLDisplay display_;
     EGLSurface surface_;
@@ -74,9 +126,38 @@ private:
     EGLint width_;
     EGLint height_;
 
+    /*!
+     * Accumulates frame and draw times of the current submit mode and logs their averages
+     * every kFrameStatsInterval frames.
+     */
+    void updateFrameStats(double drawMs);
+
     bool shaderNeedsNewProjectionMatrix_;
 
+    // All GL state changes of the sample go through here
+    GLStateCache* state_cache_;
+    // Counters of the frame last written to the log
+    GLStateCounters loggedStateCounters_;
+
+    // Projection, view, viewport and time shared by all programs, refreshed every frame
+    FrameConstantsBuffer* frame_constants_buffer_;
+    FrameConstants frameConstants_;
+    std::chrono::steady_clock::time_point startTime_;
+
+    // Program binaries of earlier launches, kept in the app's internal data path
+    ProgramCache* program_cache_;
+    // Programs still compiling, the renderer is initialized once it has finished
+    ProgramBatch* program_batch_;
+
     TriangleRender* triangle_render_;
+
+    // Set by a tap, flips the submit mode of triangle_render_ at the start of the next frame
+    bool switchSubmitModeRequested_;
+
+    std::chrono::steady_clock::time_point lastFrameTime_;
+    int frameCount_;
+    double frameMs_;
+    double drawMs_;
 };
 
 #endif //ANDROIDGLINVESTIGATIONS_RENDERER_H
\ No newline at end of file
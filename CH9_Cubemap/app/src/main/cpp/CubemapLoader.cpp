@@ -0,0 +1,221 @@
+#include "CubemapLoader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef ANDROID
+#include <android/asset_manager.h>
+#include <android/imagedecoder.h>
+#endif
+
+#include "AndroidOut.h"
+
+namespace {
+
+// GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+const char *const kFaceNames[6] = { "posx", "negx", "posy", "negy", "posz", "negz" };
+
+// 64-bit FNV-1a, continued from hash
+unsigned long long HashBytes(unsigned long long hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+const unsigned long long kFnvOffset = 14695981039346656037ull;
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+}  // namespace
+
+CubemapLoader::CubemapLoader(AAssetManager *assetManager, const std::string &directory,
+                             TextureFactory *textureFactory, TextureUploadQueue *uploadQueue)
+        : assetManager_(assetManager),
+          directory_(directory),
+          textureFactory_(textureFactory),
+          uploadQueue_(uploadQueue),
+          texture_(0),
+          size_(0),
+          levelCount_(0),
+          lastTicket_(0),
+          contentHash_(kFnvOffset),
+          state_(kLoading),
+          decodeMs_(0.0),
+          stageMs_(0.0),
+          errorLogged_(false) {
+    // The worker only describes the texture, names have to come from the GL thread
+    glGenTextures(1, &texture_);
+    // Last, the worker reads the members above
+    worker_ = std::thread(&CubemapLoader::Load, this);
+}
+
+CubemapLoader::~CubemapLoader() {
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    if (texture_) {
+        textureFactory_->Destroy(&texture_);
+    }
+}
+
+GLuint CubemapLoader::Poll() {
+    if (state_.load(std::memory_order_acquire) != kStaged || !uploadQueue_->Issued(lastTicket_)) {
+        return 0;
+    }
+    worker_.join();
+
+    aout << "CubemapLoader: " << size_ << "x" << size_ << ", " << levelCount_
+         << " levels, decoded in " << decodeMs_ << " ms and staged in " << stageMs_
+         << " ms on the worker" << std::endl;
+
+    GLuint texture = texture_;
+    texture_ = 0;
+    state_.store(kDone);
+    return texture;
+}
+
+bool CubemapLoader::Failed() {
+    // Uploads still queued for the texture must not land on a recycled name
+    if (state_.load(std::memory_order_acquire) != kFailed || !uploadQueue_->Issued(lastTicket_)) {
+        return false;
+    }
+    if (!errorLogged_) {
+        aout << "CubemapLoader: " << error_ << std::endl;
+        errorLogged_ = true;
+    }
+    return true;
+}
+
+void CubemapLoader::Load() {
+    bool ok = true;
+    for (int face = 0; face < 6 && ok; face++) {
+        auto start = std::chrono::steady_clock::now();
+        Image image;
+        ok = DecodeFace(directory_ + "/" + kFaceNames[face] + ".png", &image);
+        if (!ok) {
+            error_ = std::string("cannot decode ") + kFaceNames[face];
+            break;
+        }
+
+        // Cubemap faces have to be square and all the same size, the first one sets it
+        if (face == 0 && image.width == image.height) {
+            size_ = image.width;
+            levelCount_ = MipLevelCount(size_, size_);
+            TextureDesc desc = { GL_TEXTURE_CUBE_MAP, GL_RGBA8, size_, size_, 1, levelCount_ };
+            lastTicket_ = uploadQueue_->Allocate(texture_, desc);
+        }
+        if (image.width != size_ || image.height != size_) {
+            error_ = std::string(kFaceNames[face]) + " is " + std::to_string(image.width) + "x"
+                     + std::to_string(image.height) + ", faces must be square and equal";
+            ok = false;
+            break;
+        }
+
+        contentHash_ = HashBytes(contentHash_, image.pixels.data(), image.pixels.size());
+        std::vector<Image> chain(levelCount_);
+        chain[0] = std::move(image);
+        for (int level = 1; level < levelCount_; level++) {
+            DownsampleImage(chain[level - 1], &chain[level]);
+        }
+        decodeMs_ += MsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        ok = StageFace(face, chain);
+        stageMs_ += MsSince(start);
+    }
+
+    state_.store(ok ? kStaged : kFailed, std::memory_order_release);
+}
+
+bool CubemapLoader::StageFace(int face, const std::vector<Image> &chain) {
+    // Small levels share a buffer, so a face takes two: the base level and all the others
+    std::vector<TextureUploadQueue::Region> regions;
+    unsigned char *staging = nullptr;
+    int slot = -1;
+    size_t used = 0;
+    for (int level = 0; level < levelCount_; level++) {
+        const Image &image = chain[level];
+        size_t size = image.pixels.size();
+        if (size > uploadQueue_->BufferSize()) {
+            error_ = "level " + std::to_string(level) + " needs " + std::to_string(size)
+                     + " bytes, more than a staging buffer";
+            if (staging) {
+                lastTicket_ = uploadQueue_->Submit(slot, regions);
+            }
+            return false;
+        }
+        if (staging && used + size > uploadQueue_->BufferSize()) {
+            lastTicket_ = uploadQueue_->Submit(slot, regions);
+            regions.clear();
+            staging = nullptr;
+        }
+        if (!staging) {
+            staging = (unsigned char *) uploadQueue_->Acquire(&slot);
+            if (!staging) {
+                error_ = "no staging buffer, the upload queue shut down";
+                return false;
+            }
+            used = 0;
+        }
+
+        memcpy(staging + used, image.pixels.data(), size);
+        regions.push_back({ GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face), texture_, level,
+                            image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, used, size });
+        used += size;
+    }
+    if (staging) {
+        lastTicket_ = uploadQueue_->Submit(slot, regions);
+    }
+    return true;
+}
+
+bool CubemapLoader::DecodeFace(const std::string &path, Image *image) const {
+#ifdef ANDROID
+    AAsset *asset = AAssetManager_open(assetManager_, path.c_str(), AASSET_MODE_BUFFER);
+    if (!asset) {
+        return false;
+    }
+
+    AImageDecoder *decoder = nullptr;
+    bool ok = AImageDecoder_createFromAAsset(asset, &decoder) == ANDROID_IMAGE_DECODER_SUCCESS
+              && AImageDecoder_setAndroidBitmapFormat(decoder, ANDROID_BITMAP_FORMAT_RGBA_8888)
+                 == ANDROID_IMAGE_DECODER_SUCCESS;
+    if (ok) {
+        const AImageDecoderHeaderInfo *info = AImageDecoder_getHeaderInfo(decoder);
+        image->width = AImageDecoderHeaderInfo_getWidth(info);
+        image->height = AImageDecoderHeaderInfo_getHeight(info);
+
+        // Tightly packed, the upload uses an unpack alignment of 1
+        size_t stride = (size_t) image->width * 4;
+        image->pixels.resize(stride * image->height);
+        ok = AImageDecoder_decodeImage(decoder, image->pixels.data(), stride,
+                                       image->pixels.size()) == ANDROID_IMAGE_DECODER_SUCCESS;
+    }
+
+    if (decoder) {
+        AImageDecoder_delete(decoder);
+    }
+    AAsset_close(asset);
+    return ok;
+#else
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::vector<unsigned char> data;
+    unsigned char buffer[16384];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + read);
+    }
+    fclose(file);
+    return DecodePng(data.data(), data.size(), image);
+#endif
+}
@@ -0,0 +1,107 @@
+#ifndef LEARNES3_CUBEMAPLOADER_H
+#define LEARNES3_CUBEMAPLOADER_H
+
+#include <GLES3/gl3.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ImageDecode.h"
+#include "TextureFactory.h"
+#include "TextureUploadQueue.h"
+
+struct AAssetManager;
+
+/*!
+ * Loads a cubemap from six face images without stalling the render thread.
+ *
+ * A worker thread reads and decodes the faces (posx, negx, posy, negy, posz, negz .png in GL
+ * face order) one after the other, builds every mip level on the CPU and copies the chain into
+ * staging buffers of a TextureUploadQueue. The queue spreads the uploads over the next frames
+ * under its byte budget. Poll, called by the render thread each frame, returns immediately
+ * until the last level has been issued and then hands the texture over, with immutable storage
+ * from a TextureFactory. It has no sampling state of its own, sample it through a trilinear
+ * sampler object.
+ *
+ * On Android the faces come from the APK assets and are decoded with AImageDecoder. Elsewhere
+ * they are read from the file system and decoded with DecodePng.
+ */
+class CubemapLoader {
+public:
+    /*!
+     * Creates the texture name and starts the worker right away, with the GL context current.
+     * @param assetManager source of the faces on Android, ignored on other platforms
+     * @param directory asset or file system directory holding the six faces
+     * @param textureFactory owns the texture, free it with textureFactory->Destroy once handed
+     *        over
+     * @param uploadQueue stages and uploads the levels, must outlive the loader
+     */
+    CubemapLoader(AAssetManager *assetManager, const std::string &directory,
+                  TextureFactory *textureFactory, TextureUploadQueue *uploadQueue);
+
+    /*!
+     * Waits for the worker and deletes the texture unless it was handed over. A worker blocked
+     * on a staging buffer only returns once the queue processes or is shut down.
+     */
+    virtual ~CubemapLoader();
+
+    /*!
+     * Never blocks. Returns the new texture once, on the first call after all of it was
+     * uploaded, and 0 before and after that or if loading failed.
+     */
+    GLuint Poll();
+
+    /*!
+     * True once loading failed and no upload into the texture is pending any more, so that the
+     * loader can be deleted. Logs the worker's error the first time.
+     */
+    bool Failed();
+
+    /*!
+     * Face size and a 64-bit FNV-1a of the decoded base level of every face, to key results
+     * derived from the cubemap. Only valid once Poll returned the texture.
+     */
+    int Size() const { return size_; }
+    unsigned long long ContentHash() const { return contentHash_; }
+
+private:
+    enum State { kLoading, kStaged, kFailed, kDone };
+
+    /*!
+     * Worker thread body, decodes and stages every face and publishes the result through state_.
+     */
+    void Load();
+
+    /*!
+     * Reads and decodes one face to RGBA8.
+     */
+    bool DecodeFace(const std::string &path, Image *image) const;
+
+    /*!
+     * Copies a face's mip chain into as few staging buffers as fit and submits them.
+     */
+    bool StageFace(int face, const std::vector<Image> &chain);
+
+    AAssetManager *assetManager_;
+    std::string directory_;
+    TextureFactory *textureFactory_;
+    TextureUploadQueue *uploadQueue_;
+    GLuint texture_;
+    int size_;
+    int levelCount_;
+    // Of the last Allocate or Submit, the texture is complete once it was issued
+    uint64_t lastTicket_;
+    unsigned long long contentHash_;
+    std::atomic<int> state_;
+    double decodeMs_;
+    double stageMs_;
+    // Set by the worker before it publishes kFailed, logged on the render thread since aout is
+    // not thread safe
+    std::string error_;
+    bool errorLogged_;
+    std::thread worker_;
+};
+
+#endif //LEARNES3_CUBEMAPLOADER_H
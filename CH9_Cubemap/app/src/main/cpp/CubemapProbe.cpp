@@ -0,0 +1,265 @@
+#include "CubemapProbe.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "AndroidOut.h"
+#include "FrameConstants.h"
+
+namespace {
+
+// Looking direction and up vector of each face, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i. The cube
+// map convention flips t, hence the up vectors along -y
+const GLfloat kFaceForward[6][3] = {
+        { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+const GLfloat kFaceUp[6][3] = {
+        { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+
+const GLfloat kNear = 0.01f;
+const GLfloat kFar = 10.0f;
+
+const char *const kScheduleNames[] = { "every frame", "round robin", "on change" };
+
+// Square 90 degree perspective, column major
+void SetFacePerspective(GLfloat *matrix) {
+    for (int i = 0; i < 16; i++) {
+        matrix[i] = 0.0f;
+    }
+    matrix[0] = 1.0f;
+    matrix[5] = 1.0f;
+    matrix[10] = (kFar + kNear) / (kNear - kFar);
+    matrix[11] = -1.0f;
+    matrix[14] = 2.0f * kFar * kNear / (kNear - kFar);
+}
+
+// View from eye along forward, column major
+void SetFaceView(GLfloat *matrix, const GLfloat *eye, const GLfloat *forward, const GLfloat *up) {
+    GLfloat right[3] = { forward[1] * up[2] - forward[2] * up[1],
+                         forward[2] * up[0] - forward[0] * up[2],
+                         forward[0] * up[1] - forward[1] * up[0] };
+    SetIdentity(matrix);
+    for (int i = 0; i < 3; i++) {
+        matrix[i * 4 + 0] = right[i];
+        matrix[i * 4 + 1] = up[i];
+        matrix[i * 4 + 2] = -forward[i];
+        matrix[12] -= right[i] * eye[i];
+        matrix[13] -= up[i] * eye[i];
+        matrix[14] += forward[i] * eye[i];
+    }
+}
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+}  // namespace
+
+CubemapProbe::CubemapProbe(GLStateCache *stateCache, TextureFactory *textureFactory,
+                           GLsizei size, const GLfloat position[3], Schedule schedule,
+                           int facesPerFrame)
+        : stateCache_(stateCache),
+          textureFactory_(textureFactory),
+          size_(size),
+          schedule_(schedule),
+          facesPerFrame_(facesPerFrame),
+          texture_(0),
+          depthBuffer_(0),
+          framebuffer_(0),
+          constantsBuffer_(0),
+          slotSize_(0),
+          nextFace_(0),
+          pendingFaces_(6),
+          frame_(0),
+          changeFrame_(0),
+          changeTime_(Clock::now()),
+          timerPending_(false),
+          windowFrames_(0),
+          windowFaces_(0),
+          windowCpuMs_(0.0),
+          windowGpuMs_(0.0),
+          windowGpuSamples_(0),
+          windowStaleFrames_(0),
+          windowStaleMs_(0.0) {
+    for (int face = 0; face < 6; face++) {
+        faceFrame_[face] = -1;
+        faceTime_[face] = changeTime_;
+    }
+
+    // One level, the probe is redrawn far too often to rebuild a mip chain each time
+    TextureDesc desc = { GL_TEXTURE_CUBE_MAP, GL_RGBA8, size_, size_, 1, 1 };
+    texture_ = textureFactory_->Create(desc);
+
+    // Shared by all faces, its contents never outlive a face
+    glGenRenderbuffers(1, &depthBuffer_);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, size_, size_);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &framebuffer_);
+    stateCache_->BindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+                           texture_, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        aout << "CubemapProbe: framebuffer incomplete" << std::endl;
+    }
+    stateCache_->BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // The faces never move, so their constants are written once, with time left at 0
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    slotSize_ = (sizeof(FrameConstants) + alignment - 1) / alignment * alignment;
+    std::vector<GLubyte> slots(slotSize_ * 6);
+    for (int face = 0; face < 6; face++) {
+        FrameConstants *constants = (FrameConstants *) (slots.data() + slotSize_ * face);
+        *constants = FrameConstants();
+        SetFacePerspective(constants->projection);
+        SetFaceView(constants->view, position, kFaceForward[face], kFaceUp[face]);
+        constants->viewport[2] = (GLfloat) size_;
+        constants->viewport[3] = (GLfloat) size_;
+    }
+    glGenBuffers(1, &constantsBuffer_);
+    stateCache_->BindBuffer(GL_UNIFORM_BUFFER, constantsBuffer_);
+    glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr) slots.size(), slots.data(), GL_STATIC_DRAW);
+}
+
+CubemapProbe::~CubemapProbe() {
+    stateCache_->DeleteFramebuffers(1, &framebuffer_);
+    glDeleteRenderbuffers(1, &depthBuffer_);
+    stateCache_->DeleteBuffers(1, &constantsBuffer_);
+    textureFactory_->Destroy(&texture_);
+}
+
+void CubemapProbe::SetSchedule(Schedule schedule, int facesPerFrame) {
+    schedule_ = schedule;
+    facesPerFrame_ = facesPerFrame;
+}
+
+void CubemapProbe::Invalidate() {
+    pendingFaces_ = 6;
+    changeFrame_ = frame_ + 1;
+    changeTime_ = Clock::now();
+}
+
+void CubemapProbe::Update(const std::function<void()> &drawScene) {
+    auto start = Clock::now();
+    frame_++;
+
+    double gpuMs = 0.0;
+    if (timerPending_ && timer_.Poll(&gpuMs)) {
+        timerPending_ = false;
+        if (gpuMs >= 0.0) {
+            windowGpuMs_ += gpuMs;
+            windowGpuSamples_++;
+        }
+    }
+
+    int faces = 0;
+    if (schedule_ == kEveryFrame) {
+        faces = 6;
+    } else if (schedule_ == kRoundRobin) {
+        faces = std::min(std::max(facesPerFrame_, 1), 6);
+    } else {
+        faces = std::min(std::max(facesPerFrame_, 1), pendingFaces_);
+    }
+
+    if (faces > 0) {
+        // Only timed when the previous result is in, the timer has a single query
+        bool timed = timer_.Available() && !timerPending_;
+        if (timed) {
+            timer_.Begin();
+        }
+
+        stateCache_->BindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+        stateCache_->Viewport(0, 0, size_, size_);
+        stateCache_->Enable(GL_DEPTH_TEST);
+        const GLenum depth = GL_DEPTH_ATTACHMENT;
+        for (int i = 0; i < faces; i++) {
+            int face = nextFace_;
+            nextFace_ = (nextFace_ + 1) % 6;
+
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, texture_, 0);
+            stateCache_->BindBufferRange(GL_UNIFORM_BUFFER, ES_FRAME_CONSTANTS_BINDING,
+                                         constantsBuffer_, slotSize_ * face,
+                                         sizeof(FrameConstants));
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            drawScene();
+            // Depth is only needed while the face is drawn, a tiler can skip writing it out
+            glInvalidateFramebuffer(GL_FRAMEBUFFER, 1, &depth);
+
+            faceFrame_[face] = frame_;
+            faceTime_[face] = Clock::now();
+        }
+        stateCache_->Disable(GL_DEPTH_TEST);
+        stateCache_->BindFramebuffer(GL_FRAMEBUFFER, 0);
+        pendingFaces_ = std::max(pendingFaces_ - faces, 0);
+
+        if (timed) {
+            timer_.End();
+            timerPending_ = true;
+        }
+    }
+
+    windowFrames_++;
+    windowFaces_ += faces;
+    windowCpuMs_ += MsSince(start);
+    windowStaleFrames_ = std::max(windowStaleFrames_, StaleFrames());
+    windowStaleMs_ = std::max(windowStaleMs_, StaleMs());
+}
+
+bool CubemapProbe::Complete() const {
+    for (int face = 0; face < 6; face++) {
+        if (faceFrame_[face] < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int CubemapProbe::StaleFrames() const {
+    int stale = 0;
+    for (int face = 0; face < 6; face++) {
+        if (schedule_ != kOnChange) {
+            stale = std::max(stale, frame_ - std::max(faceFrame_[face], 0));
+        } else if (faceFrame_[face] < changeFrame_) {
+            stale = std::max(stale, frame_ - changeFrame_ + 1);
+        }
+    }
+    return stale;
+}
+
+double CubemapProbe::StaleMs() const {
+    double stale = 0.0;
+    for (int face = 0; face < 6; face++) {
+        if (schedule_ != kOnChange) {
+            stale = std::max(stale, MsSince(faceTime_[face]));
+        } else if (faceFrame_[face] < changeFrame_) {
+            stale = std::max(stale, MsSince(changeTime_));
+        }
+    }
+    return stale;
+}
+
+void CubemapProbe::LogStats() {
+    if (windowFrames_ == 0) {
+        return;
+    }
+    aout << "CubemapProbe: " << size_ << "x" << size_ << " " << kScheduleNames[schedule_]
+         << ", " << (double) windowFaces_ / windowFrames_ << " faces and "
+         << windowCpuMs_ / windowFrames_ << " ms cpu per frame";
+    if (windowGpuSamples_ > 0) {
+        aout << ", " << windowGpuMs_ / windowGpuSamples_ << " ms gpu per timed update";
+    }
+    aout << ", at most " << windowStaleFrames_ << " frames / " << windowStaleMs_
+         << " ms stale over " << windowFrames_ << " frames" << std::endl;
+
+    windowFrames_ = 0;
+    windowFaces_ = 0;
+    windowCpuMs_ = 0.0;
+    windowGpuMs_ = 0.0;
+    windowGpuSamples_ = 0;
+    windowStaleFrames_ = 0;
+    windowStaleMs_ = 0.0;
+}
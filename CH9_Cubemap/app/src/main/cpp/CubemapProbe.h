@@ -0,0 +1,125 @@
+#ifndef LEARNES3_CUBEMAPPROBE_H
+#define LEARNES3_CUBEMAPPROBE_H
+
+#include <GLES3/gl3.h>
+#include <chrono>
+#include <functional>
+
+#include "DrawBench.h"
+#include "GLStateCache.h"
+#include "TextureFactory.h"
+
+/*!
+ * A cubemap that captures the live scene around a point, for reflections of things that move.
+ *
+ * Each face is a 90 degree view rendered into one face of a cube texture through a framebuffer,
+ * at a resolution of its own, usually well below the screen's. Rendering all six every frame
+ * costs six extra scene passes, so the schedule spreads them over frames: round robin keeps
+ * redrawing a few faces per frame, on change only redraws after Invalidate. Staleness says how
+ * far the texture lags behind the scene, per frame cost and staleness are kept per report
+ * window.
+ *
+ * The scene is drawn by a callback with the probe's framebuffer, viewport and FrameConstants
+ * already bound, so its programs need nothing probe specific. It must not sample Texture().
+ * Must be used and destroyed with the GL context current.
+ */
+class CubemapProbe {
+public:
+    enum Schedule {
+        // All six faces every frame, never behind
+        kEveryFrame,
+        // facesPerFrame faces every frame in turn, for a scene that changes all the time
+        kRoundRobin,
+        // Nothing until Invalidate, then facesPerFrame faces per frame until all six are redrawn
+        kOnChange
+    };
+
+    /*!
+     * Creates the cube texture, its depth buffer and the per-face FrameConstants.
+     * @param size width and height of each face
+     * @param position where the probe sits, in the space of the scene's u_view
+     */
+    CubemapProbe(GLStateCache *stateCache, TextureFactory *textureFactory, GLsizei size,
+                 const GLfloat position[3], Schedule schedule, int facesPerFrame);
+
+    /*!
+     * Deletes the framebuffer, depth buffer and constants. The texture goes back to the factory.
+     */
+    virtual ~CubemapProbe();
+
+    void SetSchedule(Schedule schedule, int facesPerFrame);
+
+    /*!
+     * The scene changed, kOnChange redraws every face from the next Update on.
+     */
+    void Invalidate();
+
+    /*!
+     * Once per frame, before the frame's own FrameConstants are bound: renders the faces the
+     * schedule asks for with drawScene, cleared to the current clear color. Leaves the default
+     * framebuffer bound, the viewport and the FrameConstants binding are the probe's.
+     */
+    void Update(const std::function<void()> &drawScene);
+
+    GLuint Texture() const { return texture_; }
+    GLsizei Size() const { return size_; }
+
+    /*!
+     * True once every face has been drawn, before that Texture() has undefined faces.
+     */
+    bool Complete() const;
+
+    /*!
+     * How long the oldest face has not shown the scene as it is: frames and milliseconds since
+     * it was drawn for the live schedules, since the Invalidate after it for kOnChange.
+     */
+    int StaleFrames() const;
+    double StaleMs() const;
+
+    /*!
+     * Frames in the current report window, and a log line of the window that starts a new one.
+     */
+    int WindowFrames() const { return windowFrames_; }
+    void LogStats();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    GLStateCache *stateCache_;
+    TextureFactory *textureFactory_;
+    GLsizei size_;
+    Schedule schedule_;
+    int facesPerFrame_;
+
+    GLuint texture_;
+    GLuint depthBuffer_;
+    GLuint framebuffer_;
+    // Six FrameConstants, slotSize_ apart
+    GLuint constantsBuffer_;
+    GLsizeiptr slotSize_;
+
+    // Next face in turn, and faces kOnChange still has to redraw
+    int nextFace_;
+    int pendingFaces_;
+
+    // Update calls so far, and when each face was drawn, -1 for never
+    int frame_;
+    int faceFrame_[6];
+    Clock::time_point faceTime_[6];
+    int changeFrame_;
+    Clock::time_point changeTime_;
+
+    // GPU time of the faces, read a few frames late
+    GpuTimer timer_;
+    bool timerPending_;
+
+    int windowFrames_;
+    int windowFaces_;
+    double windowCpuMs_;
+    double windowGpuMs_;
+    int windowGpuSamples_;
+    int windowStaleFrames_;
+    double windowStaleMs_;
+};
+
+#endif //LEARNES3_CUBEMAPPROBE_H
@@ -0,0 +1,178 @@
+#include "DrawBatcher.h"
+
+#include <cstddef>
+
+#include "LearnES3Geometry.h"
+
+namespace {
+
+const int kPassBits = 4;
+const int kIdBits = 12;
+const int kDepthBits = 24;
+
+uint64_t Field(uint64_t value, int bits, int shift) {
+    return (value & ((1ull << bits) - 1)) << shift;
+}
+
+} // namespace
+
+uint64_t DrawBatcher::MakeSortKey(unsigned pass, GLuint program, GLuint texture,
+                                  GLuint vertexBuffer, float depth) {
+    depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+    uint64_t depthBits = (uint64_t) (depth * (float) ((1u << kDepthBits) - 1));
+
+    return Field(pass, kPassBits, kDepthBits + 3 * kIdBits)
+           | Field(program, kIdBits, kDepthBits + 2 * kIdBits)
+           | Field(texture, kIdBits, kDepthBits + kIdBits)
+           | Field(vertexBuffer, kIdBits, kDepthBits)
+           | Field(depthBits, kDepthBits, 0);
+}
+
+void DrawBatcher::RadixSort() {
+    size_t count = packets_.size();
+    order_.resize(count);
+    scratch_.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        order_[i] = (uint32_t) i;
+    }
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {};
+        for (const DrawPacket &packet : packets_) {
+            histogram[(packet.sortKey >> shift) & 0xFF]++;
+        }
+
+        // All keys share this byte, the pass would not move anything
+        if (histogram[(packets_[0].sortKey >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t &bucket : histogram) {
+            uint32_t size = bucket;
+            bucket = offset;
+            offset += size;
+        }
+        for (uint32_t index : order_) {
+            scratch_[histogram[(packets_[index].sortKey >> shift) & 0xFF]++] = index;
+        }
+        order_.swap(scratch_);
+    }
+}
+
+bool DrawBatcher::CanMerge(const DrawPacket &a, const DrawPacket &b) {
+    // Strips and fans would be joined by a spurious triangle
+    if (a.mode != GL_TRIANGLES && a.mode != GL_LINES && a.mode != GL_POINTS) {
+        return false;
+    }
+    return a.framebuffer == b.framebuffer && a.program == b.program
+           && a.textureTarget == b.textureTarget && a.texture == b.texture
+           && a.vertexBuffer == b.vertexBuffer && a.format == b.format
+           && a.indexBuffer == b.indexBuffer && a.indexType == b.indexType && a.mode == b.mode
+           && a.first + (GLuint) a.count == b.first;
+}
+
+DrawBatchStats DrawBatcher::CountStateChanges(const std::vector<DrawPacket> &packets) {
+    DrawBatchStats stats = {};
+    const DrawPacket *previous = nullptr;
+    // Target with a texture bound on the unit, see Emit
+    GLenum boundTarget = 0;
+
+    for (const DrawPacket &packet : packets) {
+        // The first draw of the frame binds everything
+        stats.draws++;
+        stats.framebufferChanges += !previous || previous->framebuffer != packet.framebuffer;
+        stats.programChanges += !previous || previous->program != packet.program;
+        stats.textureChanges += !previous || previous->texture != packet.texture
+                                || previous->textureTarget != packet.textureTarget;
+        if (packet.texture) {
+            // Switching targets also unbinds the old one
+            stats.textureChanges += boundTarget && boundTarget != packet.textureTarget;
+            boundTarget = packet.textureTarget;
+        }
+        stats.vertexBufferChanges += !previous || previous->vertexBuffer != packet.vertexBuffer
+                                     || previous->format != packet.format;
+        stats.indexBufferChanges += !previous || previous->indexBuffer != packet.indexBuffer;
+        previous = &packet;
+    }
+    return stats;
+}
+
+void DrawBatcher::Plan() {
+    commands_.clear();
+    if (packets_.empty()) {
+        submitted_ = batched_ = {};
+        return;
+    }
+
+    submitted_ = CountStateChanges(packets_);
+
+    RadixSort();
+    for (uint32_t index : order_) {
+        const DrawPacket &packet = packets_[index];
+        if (!commands_.empty() && CanMerge(commands_.back(), packet)) {
+            commands_.back().count += packet.count;
+        } else {
+            commands_.push_back(packet);
+        }
+    }
+
+    batched_ = CountStateChanges(commands_);
+}
+
+void DrawBatcher::Emit(GLStateCache *stateCache) const {
+    // Commands arrive grouped by state, the cache drops the bindings they share
+    stateCache->ActiveTexture(GL_TEXTURE0);
+    GLenum boundTarget = 0;
+    for (const DrawPacket &command : commands_) {
+        stateCache->BindFramebuffer(GL_FRAMEBUFFER, command.framebuffer);
+        stateCache->UseProgram(command.program);
+        if (command.texture) {
+            // A unit samples one target per draw, leave no other one bound
+            if (boundTarget && boundTarget != command.textureTarget) {
+                stateCache->BindTexture(boundTarget, 0);
+            }
+            stateCache->BindTexture(command.textureTarget, command.texture);
+            boundTarget = command.textureTarget;
+        }
+        stateCache->BindBuffer(GL_ARRAY_BUFFER, command.vertexBuffer);
+        if (command.format) {
+            esBindVertexFormat(command.format, 0, 0, 1, 2);
+        } else {
+            glDisableVertexAttribArray(0);
+            glDisableVertexAttribArray(1);
+            glDisableVertexAttribArray(2);
+        }
+        stateCache->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, command.indexBuffer);
+
+        // Strips are separated by 0xFFFF / 0xFFFFFFFF, depending on the index type
+        if (command.mode == GL_TRIANGLE_STRIP) {
+            stateCache->Enable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+        } else {
+            stateCache->Disable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+        }
+
+        if (command.indexType) {
+            glDrawElements(command.mode, command.count, command.indexType,
+                           (const void *) ((GLintptr) command.first
+                                           * esIndexTypeSize(command.indexType)));
+        } else {
+            glDrawArrays(command.mode, (GLint) command.first, command.count);
+        }
+    }
+
+    stateCache->BindFramebuffer(GL_FRAMEBUFFER, 0);
+    stateCache->BindBuffer(GL_ARRAY_BUFFER, 0);
+    stateCache->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void DrawBatcher::Flush(GLStateCache *stateCache) {
+    Plan();
+    Emit(stateCache);
+    Reset();
+}
+
+void DrawBatcher::Reset() {
+    packets_.clear();
+    commands_.clear();
+}
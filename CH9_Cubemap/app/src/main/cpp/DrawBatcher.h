@@ -0,0 +1,132 @@
+#ifndef LEARNES3_DRAWBATCHER_H
+#define LEARNES3_DRAWBATCHER_H
+
+#include <GLES3/gl3.h>
+#include <cstdint>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "LearnES3VertexFormat.h"
+
+/*!
+ * Everything needed to issue one draw. Packets carry no per-draw uniforms, so two packets that
+ * agree on all of the state below produce the same pixels in either order.
+ */
+struct DrawPacket {
+    // Built with DrawBatcher::MakeSortKey, packets are emitted in increasing key order
+    uint64_t sortKey;
+
+    GLuint framebuffer;
+    GLuint program;
+
+    // Bound to texture unit 0, texture 0 for none
+    GLenum textureTarget;
+    GLuint texture;
+
+    // Interleaved vertices at offset 0 of vertexBuffer, read by attributes 0, 1 and 2. A null
+    // format disables them, for shaders that build vertices from gl_VertexID
+    GLuint vertexBuffer;
+    const ESVertexFormat *format;
+
+    // indexType 0 draws first..first+count of the vertex buffer with glDrawArrays
+    GLuint indexBuffer;
+    GLenum indexType;
+    // GL_TRIANGLE_STRIP is drawn with GL_PRIMITIVE_RESTART_FIXED_INDEX
+    GLenum mode;
+    GLuint first;
+    GLsizei count;
+};
+
+/*!
+ * Counts of one frame, see DrawBatcher::Submitted and DrawBatcher::Batched.
+ */
+struct DrawBatchStats {
+    int draws;
+    int framebufferChanges;
+    int programChanges;
+    int textureChanges;
+    int vertexBufferChanges;
+    int indexBufferChanges;
+
+    int StateChanges() const {
+        return framebufferChanges + programChanges + textureChanges + vertexBufferChanges
+               + indexBufferChanges;
+    }
+};
+
+/*!
+ * Collects the draws of a frame and issues them grouped by state instead of in submission order.
+ *
+ * Packets are radix sorted by their 64-bit key, then neighbours that share all state and cover
+ * adjacent ranges of the same buffers are merged into one draw. The bindings go through a
+ * GLStateCache, so only those that differ from the previous draw's reach GL.
+ *
+ * Packets carry no uniforms or per-instance data: a renderer sets its programs' uniforms and the
+ * other texture units before Flush, and issues instanced draws itself.
+ */
+class DrawBatcher {
+public:
+    DrawBatcher() {}
+    virtual ~DrawBatcher() {}
+
+    /*!
+     * Key layout, most significant first: pass (4 bits), program (12), texture (12),
+     * vertex buffer (12), depth (24). The ids are GL names masked to their field, two names that
+     * collide are only sorted next to each other, never merged. depth in [0, 1] sorts front to
+     * back; pass 1 - depth for back to front.
+     */
+    static uint64_t MakeSortKey(unsigned pass, GLuint program, GLuint texture,
+                                GLuint vertexBuffer, float depth);
+
+    void Submit(const DrawPacket &packet) { packets_.push_back(packet); }
+
+    /*!
+     * Sorts and merges the submitted packets into the command list and computes both stats.
+     * Does not touch GL, so it can run on the host.
+     */
+    void Plan();
+
+    /*!
+     * Issues the planned commands through stateCache, on texture unit 0. A texture of another
+     * target than the previous one unbinds the previous one first, so a unit never has two
+     * targets bound. Restores framebuffer 0 and unbinds the buffers afterwards.
+     */
+    void Emit(GLStateCache *stateCache) const;
+
+    /*!
+     * Plan, Emit and Reset in one go, once per frame.
+     */
+    void Flush(GLStateCache *stateCache);
+
+    /*!
+     * Drops the packets and commands of the frame. Capacity is kept, so a steady scene does not
+     * allocate.
+     */
+    void Reset();
+
+    // Stats of the last Plan: packets issued as submitted, and after sorting and merging
+    const DrawBatchStats& Submitted() const { return submitted_; }
+    const DrawBatchStats& Batched() const { return batched_; }
+
+    const std::vector<DrawPacket>& Commands() const { return commands_; }
+
+private:
+    /*!
+     * Fills order_ with packet indices sorted by key, stable, 8 bits per pass. Passes where
+     * every key has the same byte are skipped.
+     */
+    void RadixSort();
+
+    static bool CanMerge(const DrawPacket &a, const DrawPacket &b);
+    static DrawBatchStats CountStateChanges(const std::vector<DrawPacket> &packets);
+
+    std::vector<DrawPacket> packets_;
+    std::vector<DrawPacket> commands_;
+    std::vector<uint32_t> order_;
+    std::vector<uint32_t> scratch_;
+
+    DrawBatchStats submitted_ = {};
+    DrawBatchStats batched_ = {};
+};
+
+#endif //LEARNES3_DRAWBATCHER_H
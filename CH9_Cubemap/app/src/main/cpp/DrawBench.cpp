@@ -0,0 +1,114 @@
+#include "DrawBench.h"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT_ = nullptr;
+
+bool HasTimerQuery() {
+    static int supported = -1;
+    if (supported < 0) {
+        const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+        glGetQueryObjectui64vEXT_ = (PFNGLGETQUERYOBJECTUI64VEXTPROC)
+                eglGetProcAddress("glGetQueryObjectui64vEXT");
+        supported = extensions && strstr(extensions, "GL_EXT_disjoint_timer_query")
+                    && glGetQueryObjectui64vEXT_ ? 1 : 0;
+    }
+    return supported == 1;
+}
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+} // namespace
+
+GpuTimer::GpuTimer(): query_(0) {
+    if (HasTimerQuery()) {
+        glGenQueries(1, &query_);
+    }
+}
+
+GpuTimer::~GpuTimer() {
+    if (query_) {
+        glDeleteQueries(1, &query_);
+    }
+}
+
+void GpuTimer::Begin() {
+    if (query_) {
+        // Reading the flag resets it, so a later disjoint event refers to this measurement
+        GLint disjoint = 0;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        glBeginQuery(GL_TIME_ELAPSED_EXT, query_);
+    }
+}
+
+void GpuTimer::End() {
+    if (query_) {
+        glEndQuery(GL_TIME_ELAPSED_EXT);
+    }
+}
+
+double GpuTimer::ElapsedMs() {
+    if (!query_) {
+        return -1.0;
+    }
+
+    double ms = -1.0;
+    while (!Poll(&ms)) {
+    }
+    return ms;
+}
+
+bool GpuTimer::Poll(double *ms) {
+    *ms = -1.0;
+    if (!query_) {
+        return true;
+    }
+
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(query_, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return false;
+    }
+
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (!disjoint) {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64vEXT_(query_, GL_QUERY_RESULT, &nanoseconds);
+        *ms = nanoseconds / 1.0e6;
+    }
+    return true;
+}
+
+DrawBenchResult BenchmarkDraws(const std::function<void()> &draw, int iterations) {
+    DrawBenchResult result;
+    GpuTimer timer;
+
+    // Start from an idle GPU so earlier work does not leak into the numbers
+    glFinish();
+
+    auto start = std::chrono::steady_clock::now();
+    timer.Begin();
+    for (int i = 0; i < iterations; i++) {
+        draw();
+    }
+    timer.End();
+    double submitMs = MsSince(start);
+
+    glFinish();
+    double wallMs = MsSince(start);
+
+    result.gpuTimerQuery = timer.Available();
+    result.cpuSubmitMs = submitMs / iterations;
+    result.gpuMs = (result.gpuTimerQuery ? timer.ElapsedMs() : wallMs) / iterations;
+    return result;
+}
@@ -0,0 +1,55 @@
+#ifndef LEARNES3_DRAWBENCH_H
+#define LEARNES3_DRAWBENCH_H
+
+#include <GLES3/gl3.h>
+#include <functional>
+
+/*!
+ * Measures GPU time with GL_EXT_disjoint_timer_query when the driver exposes it. Without the
+ * extension Available() is false and callers fall back to glFinish-bounded wall time.
+ */
+class GpuTimer {
+public:
+    GpuTimer();
+    virtual ~GpuTimer();
+
+    bool Available() const { return query_ != 0; }
+
+    void Begin();
+    void End();
+
+    /*!
+     * Blocks until the result of the last Begin/End pair is ready. Returns the elapsed GPU time
+     * in milliseconds, or a negative value if the measurement was disjoint.
+     */
+    double ElapsedMs();
+
+    /*!
+     * ElapsedMs without the wait: false while the result of the last Begin/End pair is still
+     * pending, true with *ms set otherwise. For timing every frame, Begin again only after
+     * this returned true.
+     */
+    bool Poll(double *ms);
+
+private:
+    GLuint query_;
+};
+
+/*!
+ * Result of BenchmarkDraws, per iteration.
+ */
+struct DrawBenchResult {
+    // CPU time spent issuing the GL calls
+    double cpuSubmitMs;
+    // GPU time from the timer query, or wall time between two glFinish calls without it
+    double gpuMs;
+    bool gpuTimerQuery;
+};
+
+/*!
+ * Calls draw iterations times between two glFinish calls and reports the average cost of one
+ * call. Only meant for the on-demand benchmarks, it stalls the pipeline.
+ */
+DrawBenchResult BenchmarkDraws(const std::function<void()> &draw, int iterations);
+
+#endif //LEARNES3_DRAWBENCH_H
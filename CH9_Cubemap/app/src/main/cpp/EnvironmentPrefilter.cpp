@@ -0,0 +1,428 @@
+#include "EnvironmentPrefilter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+#include "AndroidOut.h"
+
+namespace {
+
+// Bump when the file layout changes
+const unsigned int kMagic = 0x454e5631;  // "ENV1"
+
+struct CacheHeader {
+    unsigned int magic;
+    unsigned int specularSize;
+    unsigned int specularLevels;
+    unsigned int irradianceSize;
+    unsigned long long key;
+};
+
+// Importance samples per texel of each map
+const char kSpecularSamples[] = "128";
+const char kIrradianceSamples[] = "256";
+
+// One triangle covering the viewport, v_uv runs over [0, 1] across it
+const char kVertexShader[] =
+        "out vec2 v_uv;\n"
+        "void main()\n"
+        "{\n"
+        "    vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+        "    v_uv = corner;\n"
+        "    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+// IRRADIANCE convolves with the cosine lobe, otherwise with a GGX lobe of u_roughness seen
+// head-on (n = v = r). Each sample reads the source level whose texels cover about as much
+// solid angle as the sample does, so few samples give a smooth result.
+const char kFragmentShader[] =
+        "precision PRECISION float;\n"
+        "precision highp int;\n"
+        "uniform samplerCube s_source;\n"
+        "uniform int u_face;\n"
+        "uniform float u_roughness;\n"
+        "uniform float u_sourceSize;\n"
+        "in vec2 v_uv;\n"
+        "layout(location = 0) out vec4 outColor;\n"
+        "const float PI = 3.14159265;\n"
+        "\n"
+        "// Direction through a texel of a face, GL_TEXTURE_CUBE_MAP_POSITIVE_X + u_face\n"
+        "vec3 FaceDirection(int face, vec2 uv)\n"
+        "{\n"
+        "    vec2 st = uv * 2.0 - 1.0;\n"
+        "    if (face == 0) return vec3(1.0, -st.y, -st.x);\n"
+        "    if (face == 1) return vec3(-1.0, -st.y, st.x);\n"
+        "    if (face == 2) return vec3(st.x, 1.0, st.y);\n"
+        "    if (face == 3) return vec3(st.x, -1.0, -st.y);\n"
+        "    if (face == 4) return vec3(st.x, -st.y, 1.0);\n"
+        "    return vec3(-st.x, -st.y, -1.0);\n"
+        "}\n"
+        "\n"
+        "vec2 Hammersley(uint i)\n"
+        "{\n"
+        "    uint bits = (i << 16u) | (i >> 16u);\n"
+        "    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);\n"
+        "    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);\n"
+        "    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);\n"
+        "    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);\n"
+        "    return vec2(float(i) / float(SAMPLES), float(bits) * 2.3283064365386963e-10);\n"
+        "}\n"
+        "\n"
+        "// A direction given around +z, turned to be given around n\n"
+        "vec3 AroundNormal(vec3 v, vec3 n)\n"
+        "{\n"
+        "    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);\n"
+        "    vec3 tangent = normalize(cross(up, n));\n"
+        "    vec3 bitangent = cross(n, tangent);\n"
+        "    return tangent * v.x + bitangent * v.y + n * v.z;\n"
+        "}\n"
+        "\n"
+        "float SourceLod(float pdf)\n"
+        "{\n"
+        "    float sampleAngle = 1.0 / (float(SAMPLES) * pdf + 0.0001);\n"
+        "    float texelAngle = 4.0 * PI / (6.0 * u_sourceSize * u_sourceSize);\n"
+        "    return max(0.5 * log2(sampleAngle / texelAngle) + 1.0, 0.0);\n"
+        "}\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    vec3 n = normalize(FaceDirection(u_face, v_uv));\n"
+        "    vec3 color = vec3(0.0);\n"
+        "    float weight = 0.0;\n"
+        "#if IRRADIANCE\n"
+        "    // Cosine distributed, so every sample has the same weight\n"
+        "    for (uint i = 0u; i < uint(SAMPLES); i++) {\n"
+        "        vec2 xi = Hammersley(i);\n"
+        "        float phi = 2.0 * PI * xi.x;\n"
+        "        float cosTheta = sqrt(1.0 - xi.y);\n"
+        "        float sinTheta = sqrt(xi.y);\n"
+        "        vec3 lobe = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);\n"
+        "        vec3 l = AroundNormal(lobe, n);\n"
+        "        color += textureLod(s_source, l, SourceLod(cosTheta / PI)).rgb;\n"
+        "        weight += 1.0;\n"
+        "    }\n"
+        "#else\n"
+        "    // A mirror just resamples, the implicit derivatives pick the level\n"
+        "    if (u_roughness == 0.0) {\n"
+        "        outColor = vec4(texture(s_source, n).rgb, 1.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    float a2 = u_roughness * u_roughness * u_roughness * u_roughness;\n"
+        "    for (uint i = 0u; i < uint(SAMPLES); i++) {\n"
+        "        vec2 xi = Hammersley(i);\n"
+        "        float phi = 2.0 * PI * xi.x;\n"
+        "        float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a2 - 1.0) * xi.y));\n"
+        "        float sinTheta = sqrt(1.0 - cosTheta * cosTheta);\n"
+        "        vec3 lobe = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);\n"
+        "        vec3 h = AroundNormal(lobe, n);\n"
+        "        vec3 l = 2.0 * dot(n, h) * h - n;\n"
+        "        float nDotL = dot(n, l);\n"
+        "        if (nDotL > 0.0) {\n"
+        "            // With n = v the pdf D * n.h / (4 * v.h) is D / 4\n"
+        "            float d = (cosTheta * cosTheta) * (a2 - 1.0) + 1.0;\n"
+        "            float pdf = a2 / (4.0 * PI * d * d);\n"
+        "            color += textureLod(s_source, l, SourceLod(pdf)).rgb * nDotL;\n"
+        "            weight += nDotL;\n"
+        "        }\n"
+        "    }\n"
+        "#endif\n"
+        "    outColor = vec4(color / max(weight, 0.0001), 1.0);\n"
+        "}\n";
+
+// 64-bit FNV-1a, continued from hash
+unsigned long long HashBytes(unsigned long long hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+const unsigned long long kFnvOffset = 14695981039346656037ull;
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+}  // namespace
+
+EnvironmentPrefilter::EnvironmentPrefilter(GLStateCache *stateCache,
+                                           TextureFactory *textureFactory,
+                                           SamplerPool *samplerPool,
+                                           const std::string &cacheDirectory)
+        : stateCache_(stateCache),
+          textureFactory_(textureFactory),
+          samplerPool_(samplerPool),
+          directory_(cacheDirectory),
+          framebuffer_(0),
+          programsReady_(false),
+          specularProgram_(),
+          irradianceProgram_() {}
+
+EnvironmentPrefilter::~EnvironmentPrefilter() {
+    if (framebuffer_) {
+        stateCache_->DeleteFramebuffers(1, &framebuffer_);
+    }
+}
+
+void EnvironmentPrefilter::AddPrograms(ShaderVariantCache *variants) {
+    // highp keeps the Hammersley bits and the sums over a few hundred samples exact
+    ShaderDefines specular;
+    specular["PRECISION"] = "highp";
+    specular["SAMPLES"] = kSpecularSamples;
+    ShaderDefines irradiance = specular;
+    irradiance["SAMPLES"] = kIrradianceSamples;
+    irradiance["IRRADIANCE"] = "1";
+
+    specularProgram_.variant = variants->Request(kVertexShader, kFragmentShader, specular);
+    irradianceProgram_.variant = variants->Request(kVertexShader, kFragmentShader, irradiance);
+}
+
+bool EnvironmentPrefilter::InitPrograms() {
+    if (programsReady_) {
+        return true;
+    }
+    for (FilterProgram *filter : { &specularProgram_, &irradianceProgram_ }) {
+        GLuint program = filter->variant ? *filter->variant : 0;
+        if (!program) {
+            return false;
+        }
+        filter->sourceLoc = glGetUniformLocation(program, "s_source");
+        filter->faceLoc = glGetUniformLocation(program, "u_face");
+        filter->roughnessLoc = glGetUniformLocation(program, "u_roughness");
+        filter->sourceSizeLoc = glGetUniformLocation(program, "u_sourceSize");
+    }
+    programsReady_ = true;
+    return true;
+}
+
+bool EnvironmentPrefilter::Load(unsigned long long sourceKey, GLuint *specular,
+                                GLuint *irradiance) {
+    *specular = 0;
+    *irradiance = 0;
+    if (directory_.empty()) {
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long key = Key(sourceKey);
+    std::string path = PathFor(key);
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    CacheHeader header;
+    std::vector<GLubyte> pixels;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+                 && header.magic == kMagic && header.key == key
+                 && header.specularSize == (unsigned int) kSpecularSize
+                 && header.specularLevels == (unsigned int) kSpecularLevels
+                 && header.irradianceSize == (unsigned int) kIrradianceSize;
+    if (valid) {
+        pixels.resize(PixelBytes());
+        valid = fread(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    }
+    fclose(file);
+    if (!valid) {
+        aout << "EnvironmentPrefilter: rejected " << path << std::endl;
+        remove(path.c_str());
+        return false;
+    }
+    double readMs = MsSince(start);
+
+    // Same order the file was written in: specular level by level, each level face by face,
+    // then the irradiance faces
+    start = std::chrono::steady_clock::now();
+    CreateMaps(specular, irradiance);
+    const GLubyte *next = pixels.data();
+    for (GLint level = 0; level <= kSpecularLevels; level++) {
+        bool irradianceLevel = level == kSpecularLevels;
+        GLuint texture = irradianceLevel ? *irradiance : *specular;
+        GLint mip = irradianceLevel ? 0 : level;
+        GLsizei size = irradianceLevel ? kIrradianceSize : std::max(1, kSpecularSize >> level);
+        stateCache_->BindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        for (int face = 0; face < 6; face++) {
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, 0, 0, size, size,
+                            GL_RGBA, GL_UNSIGNED_BYTE, next);
+            next += (size_t) size * size * 4;
+        }
+    }
+
+    aout << "EnvironmentPrefilter: loaded " << std::hex << key << std::dec << ", "
+         << pixels.size() << " bytes read in " << readMs << " ms and uploaded in "
+         << MsSince(start) << " ms" << std::endl;
+    return true;
+}
+
+bool EnvironmentPrefilter::Prefilter(GLuint source, GLsizei sourceSize,
+                                     unsigned long long sourceKey, GLuint *specular,
+                                     GLuint *irradiance) {
+    *specular = 0;
+    *irradiance = 0;
+    if (!InitPrograms()) {
+        aout << "EnvironmentPrefilter: programs are not built" << std::endl;
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    CreateMaps(specular, irradiance);
+    if (!framebuffer_) {
+        glGenFramebuffers(1, &framebuffer_);
+    }
+    stateCache_->BindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+                           *specular, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        aout << "EnvironmentPrefilter: cannot render to an RGBA8 cubemap" << std::endl;
+        stateCache_->BindFramebuffer(GL_FRAMEBUFFER, 0);
+        textureFactory_->Destroy(specular);
+        textureFactory_->Destroy(irradiance);
+        return false;
+    }
+
+    // Every texel is written exactly once
+    bool blend = glIsEnabled(GL_BLEND) == GL_TRUE;
+    bool cull = glIsEnabled(GL_CULL_FACE) == GL_TRUE;
+    stateCache_->Disable(GL_BLEND);
+    stateCache_->Disable(GL_CULL_FACE);
+
+    // The filter reads the source's whole chain trilinearly
+    stateCache_->ActiveTexture(GL_TEXTURE0);
+    stateCache_->BindTexture(GL_TEXTURE_CUBE_MAP, source);
+    samplerPool_->Bind(0, MakeSamplerDesc(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE));
+
+    // Nothing is fetched, the vertex shader works from gl_VertexID
+    glDisableVertexAttribArray(0);
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(2);
+    stateCache_->BindBuffer(GL_ARRAY_BUFFER, 0);
+
+    for (FilterProgram *filter : { &specularProgram_, &irradianceProgram_ }) {
+        stateCache_->UseProgram(*filter->variant);
+        stateCache_->Uniform1i(filter->sourceLoc, 0);
+        glUniform1f(filter->sourceSizeLoc, (GLfloat) sourceSize);
+    }
+    for (GLint level = 0; level < kSpecularLevels; level++) {
+        RenderLevel(specularProgram_, *specular, level, std::max(1, kSpecularSize >> level),
+                    (float) level / (float) (kSpecularLevels - 1));
+    }
+    RenderLevel(irradianceProgram_, *irradiance, 0, kIrradianceSize, 1.0f);
+
+    if (blend) {
+        stateCache_->Enable(GL_BLEND);
+    }
+    if (cull) {
+        stateCache_->Enable(GL_CULL_FACE);
+    }
+
+    // The read back waits for the filter to finish, so its time is only known after it
+    std::vector<GLubyte> pixels;
+    pixels.reserve(PixelBytes());
+    for (GLint level = 0; level < kSpecularLevels; level++) {
+        ReadLevel(*specular, level, std::max(1, kSpecularSize >> level), &pixels);
+    }
+    ReadLevel(*irradiance, 0, kIrradianceSize, &pixels);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+                           0, 0);
+    stateCache_->BindFramebuffer(GL_FRAMEBUFFER, 0);
+    double renderMs = MsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    unsigned long long key = Key(sourceKey);
+    if (!directory_.empty()) {
+        Store(key, pixels);
+    }
+
+    aout << "EnvironmentPrefilter: rendered " << std::hex << key << std::dec << ", "
+         << kSpecularLevels << " specular levels from " << kSpecularSize << " and "
+         << kIrradianceSize << " irradiance, filtered and read back in " << renderMs
+         << " ms, " << pixels.size() << " bytes stored in " << MsSince(start) << " ms"
+         << std::endl;
+    return true;
+}
+
+void EnvironmentPrefilter::RenderLevel(const FilterProgram &program, GLuint target, GLint level,
+                                       GLsizei size, float roughness) {
+    stateCache_->UseProgram(*program.variant);
+    glUniform1f(program.roughnessLoc, roughness);
+    stateCache_->Viewport(0, 0, size, size);
+    for (int face = 0; face < 6; face++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, target, level);
+        stateCache_->Uniform1i(program.faceLoc, face);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+}
+
+void EnvironmentPrefilter::ReadLevel(GLuint target, GLint level, GLsizei size,
+                                     std::vector<GLubyte> *pixels) {
+    size_t faceBytes = (size_t) size * size * 4;
+    for (int face = 0; face < 6; face++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, target, level);
+        size_t offset = pixels->size();
+        pixels->resize(offset + faceBytes);
+        glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, pixels->data() + offset);
+    }
+}
+
+void EnvironmentPrefilter::CreateMaps(GLuint *specular, GLuint *irradiance) {
+    TextureDesc specularDesc = { GL_TEXTURE_CUBE_MAP, GL_RGBA8, kSpecularSize, kSpecularSize,
+                                 1, kSpecularLevels };
+    TextureDesc irradianceDesc = { GL_TEXTURE_CUBE_MAP, GL_RGBA8, kIrradianceSize,
+                                   kIrradianceSize, 1, 1 };
+    *specular = textureFactory_->Create(specularDesc);
+    *irradiance = textureFactory_->Create(irradianceDesc);
+}
+
+unsigned long long EnvironmentPrefilter::Key(unsigned long long sourceKey) const {
+    unsigned int settings[] = { (unsigned int) kSpecularSize, (unsigned int) kSpecularLevels,
+                                (unsigned int) kIrradianceSize };
+    unsigned long long key = HashBytes(kFnvOffset, &sourceKey, sizeof(sourceKey));
+    key = HashBytes(key, settings, sizeof(settings));
+    key = HashBytes(key, kSpecularSamples, sizeof(kSpecularSamples));
+    key = HashBytes(key, kIrradianceSamples, sizeof(kIrradianceSamples));
+    // An edited filter must not pick up old results
+    return HashBytes(key, kFragmentShader, sizeof(kFragmentShader));
+}
+
+std::string EnvironmentPrefilter::PathFor(unsigned long long key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/envmap_%016llx.bin", key);
+    return directory_ + name;
+}
+
+void EnvironmentPrefilter::Store(unsigned long long key, const std::vector<GLubyte> &pixels) const {
+    CacheHeader header = { kMagic, (unsigned int) kSpecularSize, (unsigned int) kSpecularLevels,
+                           (unsigned int) kIrradianceSize, key };
+
+    // Write to a temporary name first so that a killed process never leaves half a file
+    std::string path = PathFor(key);
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        aout << "EnvironmentPrefilter: cannot write " << temporary << std::endl;
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+    }
+}
+
+size_t EnvironmentPrefilter::PixelBytes() {
+    TextureDesc specularDesc = { GL_TEXTURE_CUBE_MAP, GL_RGBA8, kSpecularSize, kSpecularSize,
+                                 1, kSpecularLevels };
+    TextureDesc irradianceDesc = { GL_TEXTURE_CUBE_MAP, GL_RGBA8, kIrradianceSize,
+                                   kIrradianceSize, 1, 1 };
+    return TextureFactory::StorageBytes(specularDesc)
+           + TextureFactory::StorageBytes(irradianceDesc);
+}
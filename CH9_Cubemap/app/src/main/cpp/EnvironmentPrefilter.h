@@ -0,0 +1,116 @@
+#ifndef LEARNES3_ENVIRONMENTPREFILTER_H
+#define LEARNES3_ENVIRONMENTPREFILTER_H
+
+#include <GLES3/gl3.h>
+#include <string>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "ShaderVariants.h"
+#include "TextureFactory.h"
+
+/*!
+ * Turns an environment cubemap into the two maps image based lighting samples: a specular cubemap
+ * whose mip levels hold the environment convolved with GGX lobes of rising roughness, and a
+ * small irradiance cubemap holding the cosine weighted convolution for diffuse light.
+ *
+ * Every face of every level is rendered on the GPU, one fullscreen triangle per face into a
+ * framebuffer with the cube level attached, importance sampling the source's own mip chain. The
+ * result is then read back once and kept in a file under the cache directory, keyed by the
+ * source's content and the filter settings, so later launches only load it. Must be used with
+ * the GL context current.
+ */
+class EnvironmentPrefilter {
+public:
+    // Specular map: base size and levels, level l is filtered for roughness l / (levels - 1)
+    static const GLsizei kSpecularSize = 128;
+    static const GLsizei kSpecularLevels = 6;
+    // Diffuse light varies slowly, a few texels per face are plenty
+    static const GLsizei kIrradianceSize = 32;
+
+    /*!
+     * @param cacheDirectory where results are kept, usually the app's internal data path. Empty
+     *        turns the cache off
+     */
+    EnvironmentPrefilter(GLStateCache *stateCache, TextureFactory *textureFactory,
+                         SamplerPool *samplerPool, const std::string &cacheDirectory);
+
+    /*!
+     * Deletes the framebuffer. The maps handed out stay with the factory.
+     */
+    virtual ~EnvironmentPrefilter();
+
+    /*!
+     * Requests the filter programs, owned by variants. Prefilter needs them built.
+     */
+    void AddPrograms(ShaderVariantCache *variants);
+
+    /*!
+     * Creates the maps of a source with sourceKey from the cache. Returns false, with both left
+     * at 0, if there is no valid entry. Needs no programs and no source texture.
+     */
+    bool Load(unsigned long long sourceKey, GLuint *specular, GLuint *irradiance);
+
+    /*!
+     * Renders the maps from source, a complete cubemap with a full mip chain whose base level
+     * is sourceSize wide, and stores them in the cache under sourceKey. Returns false, with both
+     * left at 0, if the programs are missing or the framebuffer cannot be rendered to. GL_BLEND
+     * and GL_CULL_FACE are restored, the framebuffer and viewport are not.
+     */
+    bool Prefilter(GLuint source, GLsizei sourceSize, unsigned long long sourceKey,
+                   GLuint *specular, GLuint *irradiance);
+
+private:
+    // Uniforms of one filter program
+    struct FilterProgram {
+        const GLuint *variant;
+        GLint sourceLoc;
+        GLint faceLoc;
+        GLint roughnessLoc;
+        GLint sourceSizeLoc;
+    };
+
+    /*!
+     * Looks up the uniforms once the programs are linked, false if one of them failed.
+     */
+    bool InitPrograms();
+
+    /*!
+     * Renders every face of one level of target with program.
+     */
+    void RenderLevel(const FilterProgram &program, GLuint target, GLint level, GLsizei size,
+                     float roughness);
+
+    /*!
+     * Reads every face of one level of target back and appends it to pixels.
+     */
+    void ReadLevel(GLuint target, GLint level, GLsizei size, std::vector<GLubyte> *pixels);
+
+    /*!
+     * Creates both maps with immutable storage, left unfilled.
+     */
+    void CreateMaps(GLuint *specular, GLuint *irradiance);
+
+    /*!
+     * Key of the cache entry, from the source's and the filter's settings and shader.
+     */
+    unsigned long long Key(unsigned long long sourceKey) const;
+    std::string PathFor(unsigned long long key) const;
+    void Store(unsigned long long key, const std::vector<GLubyte> &pixels) const;
+
+    /*!
+     * RGBA8 bytes of both maps, every level and face, as laid out in a cache file.
+     */
+    static size_t PixelBytes();
+
+    GLStateCache *stateCache_;
+    TextureFactory *textureFactory_;
+    SamplerPool *samplerPool_;
+    std::string directory_;
+    GLuint framebuffer_;
+    bool programsReady_;
+    FilterProgram specularProgram_;
+    FilterProgram irradianceProgram_;
+};
+
+#endif //LEARNES3_ENVIRONMENTPREFILTER_H
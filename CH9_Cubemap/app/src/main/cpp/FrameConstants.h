@@ -0,0 +1,94 @@
+#ifndef LEARNES3_FRAMECONSTANTS_H
+#define LEARNES3_FRAMECONSTANTS_H
+
+#include <GLES3/gl3.h>
+
+#include "GLStateCache.h"
+
+///
+// Uniform buffer binding point of the FrameConstants block, the same in every program
+//
+#define ES_FRAME_CONSTANTS_BINDING  0
+
+///
+// GLSL declaration of the block, for both shader stages. The members are highp so that vertex
+// and fragment declarations match.
+//
+#define ES_FRAME_CONSTANTS_GLSL                                  \
+    "layout(std140) uniform FrameConstants                  \n"  \
+    "{                                                      \n"  \
+    "   highp mat4 u_projection;                            \n"  \
+    "   highp mat4 u_view;                                  \n"  \
+    "   highp vec4 u_viewport;                              \n"  \
+    "   highp vec4 u_time;                                  \n"  \
+    "};                                                     \n"
+
+//
+/// \brief Attach the FrameConstants block of a linked program to ES_FRAME_CONSTANTS_BINDING.
+///        Programs that do not declare the block are left alone. GLSL ES 3.00 has no binding
+///        layout qualifier, so this has to run once after every link.
+//
+inline void esBindFrameConstantsBlock(GLuint program)
+{
+   GLuint blockIndex = glGetUniformBlockIndex ( program, "FrameConstants" );
+
+   if ( blockIndex != GL_INVALID_INDEX )
+   {
+      glUniformBlockBinding ( program, blockIndex, ES_FRAME_CONSTANTS_BINDING );
+   }
+}
+
+/*!
+ * CPU mirror of the std140 FrameConstants block, 160 bytes.
+ */
+struct FrameConstants {
+    // Column major, like glUniformMatrix4fv without transpose
+    GLfloat projection[16];
+    GLfloat view[16];
+    // x, y, width, height in pixels
+    GLfloat viewport[4];
+    // Seconds since start, seconds since the previous frame, frame number, unused
+    GLfloat time[4];
+};
+
+static_assert(sizeof(FrameConstants) == 160, "FrameConstants must match the std140 layout");
+
+/*!
+ * Fills matrix with an orthographic projection that keeps [-1, 1] visible along the shorter
+ * side of a width x height viewport, so clip-space geometry keeps its aspect ratio.
+ */
+void SetAspectOrtho(GLfloat *matrix, GLsizei width, GLsizei height);
+
+/*!
+ * Fills matrix with the identity.
+ */
+void SetIdentity(GLfloat *matrix);
+
+/*!
+ * Holds FrameConstants in a uniform buffer with one slot per frame in flight. Update writes the
+ * next slot with an unsynchronized mapping, waiting on that slot's fence first, and binds it to
+ * ES_FRAME_CONSTANTS_BINDING. Must be used and destroyed with the GL context current.
+ */
+class FrameConstantsBuffer {
+public:
+    explicit FrameConstantsBuffer(GLStateCache *stateCache);
+    virtual ~FrameConstantsBuffer();
+
+    /*!
+     * Once per frame, before the first draw.
+     */
+    void Update(const FrameConstants &constants);
+
+private:
+    static const int kSlots = 3;
+
+    GLStateCache *stateCache_;
+    GLuint buffer_;
+    // sizeof(FrameConstants) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    GLsizeiptr slotSize_;
+    int slot_;
+    // Signaled once the GPU is done with the frame that read the slot
+    GLsync fences_[kSlots];
+};
+
+#endif //LEARNES3_FRAMECONSTANTS_H
@@ -0,0 +1,457 @@
+#include "ImageDecode.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// ---------------------------------------------------------------------------------------------
+// Inflate (RFC 1950 / 1951), just enough for PNG IDAT streams
+
+struct BitReader {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    unsigned int bits;
+    int count;
+    bool overrun;
+};
+
+unsigned int ReadBits(BitReader &in, int n) {
+    while (in.count < n) {
+        unsigned int byte = 0;
+        if (in.pos < in.size) {
+            byte = in.data[in.pos++];
+        } else {
+            in.overrun = true;
+        }
+        in.bits |= byte << in.count;
+        in.count += 8;
+    }
+    unsigned int value = in.bits & ((1u << n) - 1);
+    in.bits >>= n;
+    in.count -= n;
+    return value;
+}
+
+// Canonical Huffman table, decoded one bit at a time like zlib's puff
+struct Huffman {
+    short counts[16];
+    short symbols[288];
+};
+
+bool BuildHuffman(Huffman &table, const unsigned char *lengths, int n) {
+    memset(table.counts, 0, sizeof(table.counts));
+    for (int i = 0; i < n; i++) {
+        table.counts[lengths[i]]++;
+    }
+    table.counts[0] = 0;
+
+    // Over-subscribed sets are invalid, incomplete ones are allowed
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left <<= 1;
+        left -= table.counts[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    short offsets[16];
+    offsets[1] = 0;
+    for (int len = 1; len < 15; len++) {
+        offsets[len + 1] = offsets[len] + table.counts[len];
+    }
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) {
+            table.symbols[offsets[lengths[i]]++] = (short) i;
+        }
+    }
+    return true;
+}
+
+int DecodeSymbol(BitReader &in, const Huffman &table) {
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= (int) ReadBits(in, 1);
+        int count = table.counts[len];
+        if (code - count < first) {
+            return table.symbols[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+const short kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43,
+                                51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const short kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4,
+                                 4, 4, 4, 5, 5, 5, 5, 0 };
+const short kDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                              513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+                              24577 };
+const short kDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9,
+                               10, 10, 11, 11, 12, 12, 13, 13 };
+
+bool InflateCodes(BitReader &in, std::vector<unsigned char> &out, const Huffman &lengths,
+                  const Huffman &distances) {
+    for (;;) {
+        int symbol = DecodeSymbol(in, lengths);
+        if (symbol < 0 || in.overrun) {
+            return false;
+        }
+        if (symbol < 256) {
+            out.push_back((unsigned char) symbol);
+        } else if (symbol == 256) {
+            return true;
+        } else {
+            symbol -= 257;
+            if (symbol >= 29) {
+                return false;
+            }
+            int length = kLengthBase[symbol] + (int) ReadBits(in, kLengthExtra[symbol]);
+            int distSymbol = DecodeSymbol(in, distances);
+            if (distSymbol < 0 || distSymbol >= 30) {
+                return false;
+            }
+            size_t distance = kDistBase[distSymbol] + ReadBits(in, kDistExtra[distSymbol]);
+            if (distance > out.size()) {
+                return false;
+            }
+            // Byte by byte, the copy may overlap what it writes
+            size_t from = out.size() - distance;
+            for (int i = 0; i < length; i++) {
+                out.push_back(out[from + i]);
+            }
+        }
+    }
+}
+
+bool InflateDynamic(BitReader &in, std::vector<unsigned char> &out) {
+    static const unsigned char kOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13,
+                                              2, 14, 1, 15 };
+    int numLengths = (int) ReadBits(in, 5) + 257;
+    int numDistances = (int) ReadBits(in, 5) + 1;
+    int numCodes = (int) ReadBits(in, 4) + 4;
+    if (numLengths > 286 || numDistances > 30) {
+        return false;
+    }
+
+    unsigned char lengths[320] = { 0 };
+    for (int i = 0; i < numCodes; i++) {
+        lengths[kOrder[i]] = (unsigned char) ReadBits(in, 3);
+    }
+    Huffman codeTable;
+    if (!BuildHuffman(codeTable, lengths, 19)) {
+        return false;
+    }
+
+    int index = 0;
+    while (index < numLengths + numDistances) {
+        int symbol = DecodeSymbol(in, codeTable);
+        if (symbol < 0 || in.overrun) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[index++] = (unsigned char) symbol;
+            continue;
+        }
+
+        unsigned char value = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (index == 0) {
+                return false;
+            }
+            value = lengths[index - 1];
+            repeat = 3 + (int) ReadBits(in, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + (int) ReadBits(in, 3);
+        } else {
+            repeat = 11 + (int) ReadBits(in, 7);
+        }
+        if (index + repeat > numLengths + numDistances) {
+            return false;
+        }
+        while (repeat--) {
+            lengths[index++] = value;
+        }
+    }
+
+    Huffman lengthTable;
+    Huffman distanceTable;
+    if (!BuildHuffman(lengthTable, lengths, numLengths)
+        || !BuildHuffman(distanceTable, lengths + numLengths, numDistances)) {
+        return false;
+    }
+    return InflateCodes(in, out, lengthTable, distanceTable);
+}
+
+bool InflateFixed(BitReader &in, std::vector<unsigned char> &out) {
+    static Huffman lengthTable;
+    static Huffman distanceTable;
+    static bool built = false;
+    if (!built) {
+        unsigned char lengths[288];
+        int i = 0;
+        for (; i < 144; i++) lengths[i] = 8;
+        for (; i < 256; i++) lengths[i] = 9;
+        for (; i < 280; i++) lengths[i] = 7;
+        for (; i < 288; i++) lengths[i] = 8;
+        BuildHuffman(lengthTable, lengths, 288);
+        for (i = 0; i < 30; i++) lengths[i] = 5;
+        BuildHuffman(distanceTable, lengths, 30);
+        built = true;
+    }
+    return InflateCodes(in, out, lengthTable, distanceTable);
+}
+
+bool InflateStored(BitReader &in, std::vector<unsigned char> &out) {
+    // Stored blocks start on a byte boundary
+    in.bits = 0;
+    in.count = 0;
+    if (in.pos + 4 > in.size) {
+        return false;
+    }
+    unsigned int length = in.data[in.pos] | (in.data[in.pos + 1] << 8);
+    unsigned int check = in.data[in.pos + 2] | (in.data[in.pos + 3] << 8);
+    in.pos += 4;
+    if ((length ^ 0xFFFFu) != check || in.pos + length > in.size) {
+        return false;
+    }
+    out.insert(out.end(), in.data + in.pos, in.data + in.pos + length);
+    in.pos += length;
+    return true;
+}
+
+bool ZlibInflate(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    // CMF/FLG: deflate, no preset dictionary, header checksum
+    if (size < 2 || (data[0] & 0x0F) != 8 || (data[1] & 0x20)
+        || ((data[0] << 8) | data[1]) % 31 != 0) {
+        return false;
+    }
+
+    // The Adler-32 trailer is not checked, PNG chunks already carry a CRC
+    BitReader in = { data, size, 2, 0, 0, false };
+    bool last = false;
+    while (!last) {
+        last = ReadBits(in, 1) != 0;
+        unsigned int type = ReadBits(in, 2);
+        bool ok;
+        if (type == 0) {
+            ok = InflateStored(in, out);
+        } else if (type == 1) {
+            ok = InflateFixed(in, out);
+        } else if (type == 2) {
+            ok = InflateDynamic(in, out);
+        } else {
+            ok = false;
+        }
+        if (!ok || in.overrun) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------
+// PNG
+
+unsigned int ReadBE32(const unsigned char *p) {
+    return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16)
+           | ((unsigned int) p[2] << 8) | p[3];
+}
+
+int Paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// Undoes the per-row filters in place, raw holds height rows of 1 + stride bytes
+bool Unfilter(unsigned char *raw, int height, size_t stride, int bpp) {
+    const unsigned char *prior = nullptr;
+    for (int y = 0; y < height; y++) {
+        unsigned char *row = raw + y * (stride + 1);
+        int filter = row[0];
+        unsigned char *cur = row + 1;
+        for (size_t i = 0; i < stride; i++) {
+            int a = i >= (size_t) bpp ? cur[i - bpp] : 0;
+            int b = prior ? prior[i] : 0;
+            int c = prior && i >= (size_t) bpp ? prior[i - bpp] : 0;
+            switch (filter) {
+                case 0: break;
+                case 1: cur[i] = (unsigned char) (cur[i] + a); break;
+                case 2: cur[i] = (unsigned char) (cur[i] + b); break;
+                case 3: cur[i] = (unsigned char) (cur[i] + ((a + b) >> 1)); break;
+                case 4: cur[i] = (unsigned char) (cur[i] + Paeth(a, b, c)); break;
+                default: return false;
+            }
+        }
+        prior = cur;
+    }
+    return true;
+}
+
+}  // namespace
+
+bool DecodePng(const void *data, size_t size, Image *image) {
+    static const unsigned char kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    const unsigned char *bytes = (const unsigned char *) data;
+    if (size < 8 || memcmp(bytes, kSignature, 8) != 0) {
+        return false;
+    }
+
+    int width = 0;
+    int height = 0;
+    int colorType = -1;
+    std::vector<unsigned char> idat;
+    unsigned char palette[256][4];
+    memset(palette, 0xFF, sizeof(palette));
+
+    size_t pos = 8;
+    bool ended = false;
+    while (!ended && pos + 8 <= size) {
+        unsigned int length = ReadBE32(bytes + pos);
+        const unsigned char *type = bytes + pos + 4;
+        const unsigned char *body = bytes + pos + 8;
+        if (length > size - pos - 12) {
+            return false;
+        }
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (length < 13) {
+                return false;
+            }
+            width = (int) ReadBE32(body);
+            height = (int) ReadBE32(body + 4);
+            int bitDepth = body[8];
+            colorType = body[9];
+            int interlace = body[12];
+            if (bitDepth != 8 || interlace != 0 || width <= 0 || height <= 0
+                || width > 16384 || height > 16384) {
+                return false;
+            }
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            for (unsigned int i = 0; i < length / 3 && i < 256; i++) {
+                palette[i][0] = body[i * 3];
+                palette[i][1] = body[i * 3 + 1];
+                palette[i][2] = body[i * 3 + 2];
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0 && colorType == 3) {
+            for (unsigned int i = 0; i < length && i < 256; i++) {
+                palette[i][3] = body[i];
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            idat.insert(idat.end(), body, body + length);
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            ended = true;
+        }
+        pos += 12 + length;
+    }
+
+    int channels;
+    switch (colorType) {
+        case 0: channels = 1; break;
+        case 2: channels = 3; break;
+        case 3: channels = 1; break;
+        case 4: channels = 2; break;
+        case 6: channels = 4; break;
+        default: return false;
+    }
+
+    size_t stride = (size_t) width * channels;
+    std::vector<unsigned char> raw;
+    raw.reserve((stride + 1) * height);
+    if (!ZlibInflate(idat.data(), idat.size(), raw) || raw.size() < (stride + 1) * height
+        || !Unfilter(raw.data(), height, stride, channels)) {
+        return false;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->pixels.resize((size_t) width * height * 4);
+    unsigned char *dst = image->pixels.data();
+    for (int y = 0; y < height; y++) {
+        const unsigned char *src = raw.data() + y * (stride + 1) + 1;
+        for (int x = 0; x < width; x++, dst += 4) {
+            switch (colorType) {
+                case 0:
+                    dst[0] = dst[1] = dst[2] = src[x];
+                    dst[3] = 255;
+                    break;
+                case 2:
+                    dst[0] = src[x * 3];
+                    dst[1] = src[x * 3 + 1];
+                    dst[2] = src[x * 3 + 2];
+                    dst[3] = 255;
+                    break;
+                case 3:
+                    memcpy(dst, palette[src[x]], 4);
+                    break;
+                case 4:
+                    dst[0] = dst[1] = dst[2] = src[x * 2];
+                    dst[3] = src[x * 2 + 1];
+                    break;
+                default:
+                    memcpy(dst, src + x * 4, 4);
+                    break;
+            }
+        }
+    }
+    return true;
+}
+
+void DownsampleImage(const Image &src, Image *dst) {
+    int width = src.width > 1 ? src.width / 2 : 1;
+    int height = src.height > 1 ? src.height / 2 : 1;
+    dst->width = width;
+    dst->height = height;
+    dst->pixels.resize((size_t) width * height * 4);
+
+    // Each destination pixel averages its share of source rows and columns, two of each
+    // except for the last one of an odd size, which takes three
+    for (int y = 0; y < height; y++) {
+        int y0 = y * src.height / height;
+        int y1 = (y + 1) * src.height / height;
+        for (int x = 0; x < width; x++) {
+            int x0 = x * src.width / width;
+            int x1 = (x + 1) * src.width / width;
+            unsigned int sum[4] = { 0, 0, 0, 0 };
+            for (int sy = y0; sy < y1; sy++) {
+                const unsigned char *p = &src.pixels[((size_t) sy * src.width + x0) * 4];
+                for (int sx = x0; sx < x1; sx++, p += 4) {
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                    sum[3] += p[3];
+                }
+            }
+            unsigned int count = (unsigned int) ((y1 - y0) * (x1 - x0));
+            unsigned char *out = &dst->pixels[((size_t) y * width + x) * 4];
+            for (int c = 0; c < 4; c++) {
+                out[c] = (unsigned char) ((sum[c] + count / 2) / count);
+            }
+        }
+    }
+}
+
+int MipLevelCount(int width, int height) {
+    int size = width > height ? width : height;
+    int levels = 1;
+    while (size > 1) {
+        size >>= 1;
+        levels++;
+    }
+    return levels;
+}
@@ -0,0 +1,37 @@
+#ifndef LEARNES3_IMAGEDECODE_H
+#define LEARNES3_IMAGEDECODE_H
+
+#include <cstddef>
+#include <vector>
+
+/*!
+ * Tightly packed RGBA8 pixels, rows top to bottom.
+ */
+struct Image {
+    int width;
+    int height;
+    std::vector<unsigned char> pixels;
+};
+
+/*!
+ * Decodes a PNG held in memory to RGBA8. Handles 8-bit grayscale, gray + alpha, RGB, RGBA and
+ * palette images without interlacing, which covers what asset pipelines usually write. Other
+ * files are refused with false.
+ *
+ * Needs no GL or Android headers, so it also builds into host tools. On device CubemapLoader
+ * prefers AImageDecoder, which handles every PNG.
+ */
+bool DecodePng(const void *data, size_t size, Image *image);
+
+/*!
+ * Fills dst with src halved in each dimension by a 2x2 box filter, never below 1x1. An odd
+ * last row or column is folded into its neighbour.
+ */
+void DownsampleImage(const Image &src, Image *dst);
+
+/*!
+ * Number of levels of a full mip chain for a width x height base level.
+ */
+int MipLevelCount(int width, int height);
+
+#endif //LEARNES3_IMAGEDECODE_H
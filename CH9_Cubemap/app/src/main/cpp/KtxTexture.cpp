@@ -0,0 +1,384 @@
+#include "KtxTexture.h"
+
+#include <GLES2/gl2ext.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef ANDROID
+#include <android/asset_manager.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const unsigned char kKtx1Identifier[12] = {
+        0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const unsigned char kKtx2Identifier[12] = {
+        0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+const uint32_t kKtx1Endianness = 0x04030201;
+const uint32_t kKtx1EndiannessSwapped = 0x01020304;
+
+// KTX 1.1 header after the identifier, 13 words
+const size_t kKtx1HeaderSize = 12 + 13 * 4;
+// KTX 2.0 header, index and the start of the level index
+const size_t kKtx2LevelIndex = 12 + 9 * 4 + 4 * 4 + 2 * 8;
+
+// Vulkan numbers the ETC2/EAC and ASTC LDR formats contiguously
+const uint32_t kVkFormatEtc2First = 147;  // VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK
+const uint32_t kVkFormatEtc2Last = 156;   // VK_FORMAT_EAC_R11G11_SNORM_BLOCK
+const uint32_t kVkFormatAstcFirst = 157;  // VK_FORMAT_ASTC_4x4_UNORM_BLOCK
+const uint32_t kVkFormatAstcLast = 184;   // VK_FORMAT_ASTC_12x12_SRGB_BLOCK
+
+const GLenum kEtc2FromVk[] = {
+        GL_COMPRESSED_RGB8_ETC2, GL_COMPRESSED_SRGB8_ETC2,
+        GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+        GL_COMPRESSED_RGBA8_ETC2_EAC, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC,
+        GL_COMPRESSED_R11_EAC, GL_COMPRESSED_SIGNED_R11_EAC,
+        GL_COMPRESSED_RG11_EAC, GL_COMPRESSED_SIGNED_RG11_EAC };
+
+uint32_t ReadU32(const unsigned char *p, bool swap) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return swap ? __builtin_bswap32(value) : value;
+}
+
+uint64_t ReadU64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+size_t Align4(size_t value) {
+    return (value + 3) & ~(size_t) 3;
+}
+
+// 64-bit FNV-1a, continued from hash
+unsigned long long HashBytes(unsigned long long hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+const unsigned long long kFnvOffset = 14695981039346656037ull;
+
+}  // namespace
+
+KtxTexture::KtxTexture(AAssetManager *assetManager, const std::string &path)
+        : asset_(nullptr),
+          mapping_(nullptr),
+          data_(nullptr),
+          size_(0),
+          version_(0),
+          internalFormat_(0),
+          width_(0),
+          height_(0),
+          faceCount_(0),
+          levelCount_(0) {
+    if (!Map(assetManager, path)) {
+        return;
+    }
+    if (size_ >= 12 && memcmp(data_, kKtx1Identifier, 12) == 0) {
+        version_ = 1;
+        if (ParseKtx1()) {
+            Validate();
+        }
+    } else if (size_ >= 12 && memcmp(data_, kKtx2Identifier, 12) == 0) {
+        version_ = 2;
+        if (ParseKtx2()) {
+            Validate();
+        }
+    } else {
+        Fail("not a KTX file");
+    }
+}
+
+KtxTexture::~KtxTexture() {
+#ifdef ANDROID
+    if (asset_) {
+        AAsset_close(asset_);
+    }
+#else
+    if (mapping_) {
+        munmap(mapping_, size_);
+    }
+#endif
+}
+
+bool KtxTexture::Map(AAssetManager *assetManager, const std::string &path) {
+#ifdef ANDROID
+    asset_ = AAssetManager_open(assetManager, path.c_str(), AASSET_MODE_BUFFER);
+    if (!asset_) {
+        return Fail("cannot open " + path);
+    }
+    data_ = (const unsigned char *) AAsset_getBuffer(asset_);
+    size_ = (size_t) AAsset_getLength(asset_);
+    if (!data_) {
+        return Fail("cannot map " + path);
+    }
+#else
+    (void) assetManager;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return Fail("cannot open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        size_ = (size_t) info.st_size;
+        mapping_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping_ == MAP_FAILED) {
+            mapping_ = nullptr;
+        }
+    }
+    // The mapping outlives the descriptor
+    close(fd);
+    if (!mapping_) {
+        size_ = 0;
+        return Fail("cannot map " + path);
+    }
+    data_ = (const unsigned char *) mapping_;
+#endif
+    return true;
+}
+
+bool KtxTexture::ParseKtx1() {
+    if (size_ < kKtx1HeaderSize) {
+        return Fail("truncated KTX 1.1 header");
+    }
+
+    // Files written on a big endian machine are read with every word swapped, the compressed
+    // blocks are byte streams and stay as they are
+    uint32_t endianness = ReadU32(data_ + 12, false);
+    if (endianness != kKtx1Endianness && endianness != kKtx1EndiannessSwapped) {
+        return Fail("bad KTX 1.1 endianness");
+    }
+    bool swap = endianness == kKtx1EndiannessSwapped;
+    uint32_t header[13];
+    for (int i = 0; i < 13; i++) {
+        header[i] = ReadU32(data_ + 12 + 4 * i, swap);
+    }
+    uint32_t glType = header[1];
+    uint32_t glFormat = header[3];
+    uint32_t glInternalFormat = header[4];
+    uint32_t pixelDepth = header[8];
+    uint32_t arrayElements = header[9];
+    uint32_t bytesOfKeyValueData = header[12];
+
+    if (glType != 0 || glFormat != 0) {
+        return Fail("KTX 1.1 file is not block compressed");
+    }
+    if (pixelDepth != 0 || arrayElements != 0) {
+        return Fail("3D and array textures are not supported");
+    }
+    internalFormat_ = glInternalFormat;
+    width_ = (int) header[6];
+    height_ = (int) header[7];
+    faceCount_ = (int) header[10];
+    // 0 asks the loader to generate mipmaps, which compressed formats cannot
+    levelCount_ = header[11] ? (int) header[11] : 1;
+    if (levelCount_ > kMaxLevels) {
+        return Fail("too many mip levels");
+    }
+
+    size_t offset = kKtx1HeaderSize + (size_t) bytesOfKeyValueData;
+    for (int level = 0; level < levelCount_; level++) {
+        if (offset > size_ || size_ - offset < 4) {
+            return Fail("truncated KTX 1.1 level");
+        }
+        size_t imageSize = ReadU32(data_ + offset, swap);
+        offset += 4;
+
+        // imageSize is one face for cubemaps, which pad each face to 4 bytes, and the whole
+        // level otherwise
+        Level &entry = levels_[level];
+        entry.offset = offset;
+        entry.faceSize = imageSize;
+        entry.faceStride = faceCount_ == 6 ? Align4(imageSize) : imageSize;
+        offset = Align4(offset + entry.faceStride * (faceCount_ == 6 ? 6 : 1));
+    }
+    return true;
+}
+
+bool KtxTexture::ParseKtx2() {
+    if (size_ < kKtx2LevelIndex) {
+        return Fail("truncated KTX 2.0 header");
+    }
+
+    const unsigned char *header = data_ + 12;
+    uint32_t vkFormat = ReadU32(header, false);
+    uint32_t pixelDepth = ReadU32(header + 16, false);
+    uint32_t layerCount = ReadU32(header + 20, false);
+    uint32_t supercompression = ReadU32(header + 32, false);
+
+    if (supercompression != 0) {
+        return Fail("supercompressed KTX 2.0 files are not supported");
+    }
+    if (pixelDepth != 0 || layerCount != 0) {
+        return Fail("3D and array textures are not supported");
+    }
+    internalFormat_ = GlFormatFromVk(vkFormat);
+    if (!internalFormat_) {
+        return Fail("VkFormat " + std::to_string(vkFormat) + " is not block compressed");
+    }
+    width_ = (int) ReadU32(header + 8, false);
+    height_ = (int) ReadU32(header + 12, false);
+    faceCount_ = (int) ReadU32(header + 24, false);
+    uint32_t levelCount = ReadU32(header + 28, false);
+    levelCount_ = levelCount ? (int) levelCount : 1;
+    if (levelCount_ > kMaxLevels) {
+        return Fail("too many mip levels");
+    }
+    if (size_ < kKtx2LevelIndex + 24 * (size_t) levelCount_) {
+        return Fail("truncated KTX 2.0 level index");
+    }
+
+    // Without supercompression the faces of a level are packed back to back
+    for (int level = 0; level < levelCount_; level++) {
+        const unsigned char *entry = data_ + kKtx2LevelIndex + 24 * level;
+        uint64_t byteOffset = ReadU64(entry);
+        uint64_t byteLength = ReadU64(entry + 8);
+        if (byteOffset > size_ || byteLength > size_ || faceCount_ <= 0) {
+            return Fail("KTX 2.0 level outside the file");
+        }
+        levels_[level].offset = (size_t) byteOffset;
+        levels_[level].faceSize = (size_t) byteLength / faceCount_;
+        levels_[level].faceStride = levels_[level].faceSize;
+    }
+    return true;
+}
+
+bool KtxTexture::Validate() {
+    int blockWidth, blockHeight, blockBytes;
+    if (!TextureFactory::BlockInfo(internalFormat_, &blockWidth, &blockHeight, &blockBytes)) {
+        return Fail("internal format " + std::to_string(internalFormat_)
+                    + " is not block compressed");
+    }
+    if (width_ <= 0 || height_ <= 0) {
+        return Fail("1D textures are not supported");
+    }
+    if (faceCount_ != 1 && faceCount_ != 6) {
+        return Fail("face count must be 1 or 6");
+    }
+    if (faceCount_ == 6 && width_ != height_) {
+        return Fail("cubemap faces must be square");
+    }
+    int maxLevels = 1;
+    while ((std::max(width_, height_) >> maxLevels) > 0) {
+        maxLevels++;
+    }
+    if (levelCount_ > maxLevels) {
+        return Fail("more mip levels than the size allows");
+    }
+
+    for (int level = 0; level < levelCount_; level++) {
+        const Level &entry = levels_[level];
+        size_t width = (size_t) std::max(1, width_ >> level);
+        size_t height = (size_t) std::max(1, height_ >> level);
+        size_t expected = (width + blockWidth - 1) / blockWidth
+                          * ((height + blockHeight - 1) / blockHeight) * blockBytes;
+        if (entry.faceSize != expected) {
+            return Fail("level " + std::to_string(level) + " has " + std::to_string(entry.faceSize)
+                        + " bytes per face, expected " + std::to_string(expected));
+        }
+        size_t span = entry.faceStride * (faceCount_ - 1) + entry.faceSize;
+        if (entry.offset > size_ || size_ - entry.offset < span) {
+            return Fail("level " + std::to_string(level) + " runs past the end of the file");
+        }
+    }
+    return true;
+}
+
+bool KtxTexture::Fail(const std::string &error) {
+    error_ = error;
+    internalFormat_ = 0;
+    return false;
+}
+
+bool KtxTexture::Supported() const {
+    if (!Valid()) {
+        return false;
+    }
+    // ETC2 and EAC are core in ES 3.0, ASTC is an extension
+    bool astc = internalFormat_ >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+                && internalFormat_ <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR;
+    if (!astc) {
+        return true;
+    }
+    const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+    return extensions && strstr(extensions, "GL_KHR_texture_compression_astc_ldr") != nullptr;
+}
+
+GLuint KtxTexture::Upload(TextureFactory *textureFactory) {
+    if (!Supported()) {
+        return 0;
+    }
+
+    // Immutable storage, then every level straight from the mapping
+    TextureDesc desc = { Target(), internalFormat_, width_, height_, 1, levelCount_ };
+    GLuint texture = textureFactory->Create(desc);
+    if (!texture) {
+        return 0;
+    }
+    for (int level = 0; level < levelCount_; level++) {
+        GLsizei width = std::max(1, width_ >> level);
+        GLsizei height = std::max(1, height_ >> level);
+        for (int face = 0; face < faceCount_; face++) {
+            size_t size;
+            const void *data = FaceData(level, face, &size);
+            glCompressedTexSubImage2D(faceCount_ == 6 ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+                                                      : GL_TEXTURE_2D,
+                                      level, 0, 0, width, height, internalFormat_,
+                                      (GLsizei) size, data);
+        }
+    }
+    return texture;
+}
+
+const void *KtxTexture::FaceData(int level, int face, size_t *size) const {
+    const Level &entry = levels_[level];
+    *size = entry.faceSize;
+    return data_ + entry.offset + entry.faceStride * face;
+}
+
+size_t KtxTexture::CompressedBytes() const {
+    size_t total = 0;
+    for (int level = 0; level < levelCount_; level++) {
+        total += levels_[level].faceSize * faceCount_;
+    }
+    return total;
+}
+
+size_t KtxTexture::UncompressedBytes() const {
+    size_t total = 0;
+    for (int level = 0; level < levelCount_; level++) {
+        total += (size_t) std::max(1, width_ >> level) * std::max(1, height_ >> level) * 4
+                 * faceCount_;
+    }
+    return total;
+}
+
+unsigned long long KtxTexture::ContentHash() const {
+    return HashBytes(kFnvOffset, data_, size_);
+}
+
+GLenum KtxTexture::GlFormatFromVk(uint32_t vkFormat) {
+    if (vkFormat >= kVkFormatEtc2First && vkFormat <= kVkFormatEtc2Last) {
+        return kEtc2FromVk[vkFormat - kVkFormatEtc2First];
+    }
+    if (vkFormat >= kVkFormatAstcFirst && vkFormat <= kVkFormatAstcLast) {
+        // UNORM and SRGB alternate for each footprint
+        uint32_t index = (vkFormat - kVkFormatAstcFirst) / 2;
+        bool srgb = (vkFormat - kVkFormatAstcFirst) % 2 == 1;
+        return (srgb ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR : GL_COMPRESSED_RGBA_ASTC_4x4_KHR)
+               + index;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#ifndef LEARNES3_KTXTEXTURE_H
+#define LEARNES3_KTXTEXTURE_H
+
+#include <GLES3/gl3.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "TextureFactory.h"
+
+struct AAssetManager;
+struct AAsset;
+
+/*!
+ * A block compressed texture in a KTX 1.1 or KTX 2.0 container, uploaded straight from the file.
+ *
+ * The file is mapped rather than read: on Android the asset is opened with AASSET_MODE_BUFFER and
+ * AAsset_getBuffer, which points into the APK when the asset is stored uncompressed (see
+ * noCompress in build.gradle), elsewhere it is mmap'ed. Every mip level of every face is handed
+ * to glCompressedTexSubImage2D from the mapping, nothing is copied or decoded on the CPU.
+ *
+ * Handles 2D textures and cubemaps with ETC2/EAC data, which every ES 3.0 device samples, and
+ * ASTC LDR data when GL_KHR_texture_compression_astc_ldr is exposed. Array, 3D and supercompressed
+ * (Basis, zstd) files are refused.
+ */
+class KtxTexture {
+public:
+    /*!
+     * Maps and parses the file, check Valid afterwards.
+     * @param assetManager source of the file on Android, ignored on other platforms
+     * @param path asset path on Android, file system path elsewhere
+     */
+    KtxTexture(AAssetManager *assetManager, const std::string &path);
+
+    /*!
+     * Unmaps the file. Textures made by Upload stay valid.
+     */
+    virtual ~KtxTexture();
+
+    /*!
+     * False if the file could not be mapped or parsed, Error says why.
+     */
+    bool Valid() const { return internalFormat_ != 0; }
+    const std::string &Error() const { return error_; }
+
+    /*!
+     * Creates a texture for the whole chain with textureFactory and uploads every level, free it
+     * with textureFactory->Destroy. The texture is left bound to Target and has no sampling state
+     * of its own, bind a sampler object with it. Returns 0 if the device cannot sample the
+     * format, which only happens for ASTC.
+     */
+    GLuint Upload(TextureFactory *textureFactory);
+
+    /*!
+     * True if the GL context can sample the format, needs the context current.
+     */
+    bool Supported() const;
+
+    // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+    GLenum Target() const { return faceCount_ == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D; }
+    GLenum InternalFormat() const { return internalFormat_; }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    int Faces() const { return faceCount_; }
+    int Levels() const { return levelCount_; }
+    // 1 for KTX 1.1, 2 for KTX 2.0
+    int Version() const { return version_; }
+
+    /*!
+     * Compressed bytes of one face of a level and where they start in the mapping.
+     */
+    const void *FaceData(int level, int face, size_t *size) const;
+
+    /*!
+     * Compressed bytes of every face and level, and what the same chain takes as RGBA8.
+     */
+    size_t CompressedBytes() const;
+    size_t UncompressedBytes() const;
+
+    /*!
+     * 64-bit FNV-1a of the whole file, to key results derived from it.
+     */
+    unsigned long long ContentHash() const;
+
+    /*!
+     * The GL format of a Vulkan format number as used by KTX 2.0, 0 if it has none here.
+     */
+    static GLenum GlFormatFromVk(uint32_t vkFormat);
+
+private:
+    static const int kMaxLevels = 16;
+
+    struct Level {
+        // Of the first face in the mapping, the other faces follow faceStride bytes apart
+        size_t offset;
+        size_t faceSize;
+        size_t faceStride;
+    };
+
+    bool Map(AAssetManager *assetManager, const std::string &path);
+    bool ParseKtx1();
+    bool ParseKtx2();
+
+    /*!
+     * Checks the dimensions and that every level is as big as the format says and inside the
+     * mapping. Sets error_ and returns false otherwise.
+     */
+    bool Validate();
+
+    bool Fail(const std::string &error);
+
+    AAsset *asset_;
+    void *mapping_;
+    const unsigned char *data_;
+    size_t size_;
+
+    int version_;
+    GLenum internalFormat_;
+    int width_;
+    int height_;
+    int faceCount_;
+    int levelCount_;
+    Level levels_[kMaxLevels];
+    std::string error_;
+};
+
+#endif //LEARNES3_KTXTEXTURE_H
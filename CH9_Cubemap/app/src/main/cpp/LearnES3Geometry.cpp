@@ -0,0 +1,695 @@
+//
+// LearnES3Geometry.cpp
+//
+//    Mesh generators declared in LearnES3Geometry.h.
+//
+
+#include "LearnES3Geometry.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <unordered_map>
+#include <vector>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ES_GEOMETRY_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ES_GEOMETRY_SSE 1
+#endif
+
+namespace {
+
+///
+// Per-sphere lookup tables. ringSin/ringCos hold the polar angle of every ring,
+// sliceSin/sliceCos/sliceU the azimuth and u coordinate of every slice.
+//
+struct SphereTables {
+    float *ringSin;
+    float *ringCos;
+    float *sliceSin;
+    float *sliceCos;
+    float *sliceU;
+};
+
+//
+/// \brief Fill the lookup tables with the same expressions esGenSphere uses per vertex,
+///        so the products computed from them are bit-identical.
+//
+void BuildSphereTables(int numSlices, int numParallels, SphereTables *tables) {
+    float angleStep = ( 2.0f * ES_PI ) / ( ( float ) numSlices );
+    int i;
+    int j;
+
+    for ( i = 0; i < numParallels + 1; i++ ) {
+        tables->ringSin[i] = sinf ( angleStep * ( float ) i );
+        tables->ringCos[i] = cosf ( angleStep * ( float ) i );
+    }
+
+    for ( j = 0; j < numSlices + 1; j++ ) {
+        tables->sliceSin[j] = sinf ( angleStep * ( float ) j );
+        tables->sliceCos[j] = cosf ( angleStep * ( float ) j );
+        tables->sliceU[j] = ( float ) j / ( float ) numSlices;
+    }
+}
+
+//
+/// \brief Write the positions and normals of one ring. Either output may be NULL.
+/// \param ringScale radius * sin(ring angle)
+/// \param ringY radius * cos(ring angle)
+//
+void FillRingPositions(int count, float ringScale, float ringY, float radius,
+                       const float *sliceSin, const float *sliceCos,
+                       GLfloat *positions, GLfloat *normals) {
+    int j = 0;
+
+#if defined(ES_GEOMETRY_NEON)
+    float32x4_t scale = vdupq_n_f32 ( ringScale );
+    float32x4_t rad = vdupq_n_f32 ( radius );
+    float32x4x3_t pos;
+    float32x4x3_t nrm;
+    pos.val[1] = vdupq_n_f32 ( ringY );
+    nrm.val[1] = vdivq_f32 ( pos.val[1], rad );
+
+    for ( ; j + 4 <= count; j += 4 ) {
+        pos.val[0] = vmulq_f32 ( scale, vld1q_f32 ( sliceSin + j ) );
+        pos.val[2] = vmulq_f32 ( scale, vld1q_f32 ( sliceCos + j ) );
+
+        if ( positions ) {
+            vst3q_f32 ( positions + j * 3, pos );
+        }
+
+        if ( normals ) {
+            nrm.val[0] = vdivq_f32 ( pos.val[0], rad );
+            nrm.val[2] = vdivq_f32 ( pos.val[2], rad );
+            vst3q_f32 ( normals + j * 3, nrm );
+        }
+    }
+#elif defined(ES_GEOMETRY_SSE)
+    __m128 scale = _mm_set1_ps ( ringScale );
+    __m128 rad = _mm_set1_ps ( radius );
+    __m128 y = _mm_set1_ps ( ringY );
+    __m128 ny = _mm_div_ps ( y, rad );
+
+    for ( ; j + 4 <= count; j += 4 ) {
+        __m128 x = _mm_mul_ps ( scale, _mm_loadu_ps ( sliceSin + j ) );
+        __m128 z = _mm_mul_ps ( scale, _mm_loadu_ps ( sliceCos + j ) );
+
+        for ( int k = 0; k < 2; k++ ) {
+            GLfloat *out = k == 0 ? positions : normals;
+            if ( out == NULL ) {
+                continue;
+            }
+
+            __m128 vx = x;
+            __m128 vy = y;
+            __m128 vz = z;
+            if ( k == 1 ) {
+                vx = _mm_div_ps ( x, rad );
+                vy = ny;
+                vz = _mm_div_ps ( z, rad );
+            }
+
+            // Transpose x0..3 / y0..3 / z0..3 into x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+            __m128 xy01 = _mm_unpacklo_ps ( vx, vy );
+            __m128 xy23 = _mm_unpackhi_ps ( vx, vy );
+            __m128 z0x1 = _mm_shuffle_ps ( vz, xy01, _MM_SHUFFLE ( 2, 2, 0, 0 ) );
+            __m128 y1z1 = _mm_shuffle_ps ( xy01, vz, _MM_SHUFFLE ( 1, 1, 3, 3 ) );
+            __m128 z2x3 = _mm_shuffle_ps ( vz, xy23, _MM_SHUFFLE ( 2, 2, 2, 2 ) );
+            __m128 y3z3 = _mm_shuffle_ps ( xy23, vz, _MM_SHUFFLE ( 3, 3, 3, 3 ) );
+
+            _mm_storeu_ps ( out + j * 3 + 0, _mm_shuffle_ps ( xy01, z0x1, _MM_SHUFFLE ( 2, 0, 1, 0 ) ) );
+            _mm_storeu_ps ( out + j * 3 + 4, _mm_shuffle_ps ( y1z1, xy23, _MM_SHUFFLE ( 1, 0, 2, 0 ) ) );
+            _mm_storeu_ps ( out + j * 3 + 8, _mm_shuffle_ps ( z2x3, y3z3, _MM_SHUFFLE ( 2, 0, 2, 0 ) ) );
+        }
+    }
+#endif
+
+    // Scalar fallback and tail of the ring
+    for ( ; j < count; j++ ) {
+        GLfloat x = ringScale * sliceSin[j];
+        GLfloat z = ringScale * sliceCos[j];
+
+        if ( positions ) {
+            positions[j * 3 + 0] = x;
+            positions[j * 3 + 1] = ringY;
+            positions[j * 3 + 2] = z;
+        }
+
+        if ( normals ) {
+            normals[j * 3 + 0] = x / radius;
+            normals[j * 3 + 1] = ringY / radius;
+            normals[j * 3 + 2] = z / radius;
+        }
+    }
+}
+
+//
+/// \brief Write the texCoords of one ring: u comes from the slice table, v is constant.
+//
+void FillRingTexCoords(int count, float v, const float *sliceU, GLfloat *texCoords) {
+    int j = 0;
+
+#if defined(ES_GEOMETRY_NEON)
+    float32x4x2_t uv;
+    uv.val[1] = vdupq_n_f32 ( v );
+
+    for ( ; j + 4 <= count; j += 4 ) {
+        uv.val[0] = vld1q_f32 ( sliceU + j );
+        vst2q_f32 ( texCoords + j * 2, uv );
+    }
+#elif defined(ES_GEOMETRY_SSE)
+    __m128 vv = _mm_set1_ps ( v );
+
+    for ( ; j + 4 <= count; j += 4 ) {
+        __m128 u = _mm_loadu_ps ( sliceU + j );
+        _mm_storeu_ps ( texCoords + j * 2 + 0, _mm_unpacklo_ps ( u, vv ) );
+        _mm_storeu_ps ( texCoords + j * 2 + 4, _mm_unpackhi_ps ( u, vv ) );
+    }
+#endif
+
+    for ( ; j < count; j++ ) {
+        texCoords[j * 2 + 0] = sliceU[j];
+        texCoords[j * 2 + 1] = v;
+    }
+}
+
+//
+/// \brief Write the triangle list indices of the sphere in ring order, two triangles per quad.
+//
+void FillSphereListIndices(int numSlices, GLuint *indexBuf) {
+    int numParallels = numSlices / 2;
+    int rowLength = numSlices + 1;
+    int i;
+    int j;
+
+    for ( i = 0; i < numParallels; i++ ) {
+        GLuint top = i * rowLength;
+        GLuint bottom = top + rowLength;
+
+        for ( j = 0; j < numSlices; j++ ) {
+            *indexBuf++ = top + j;
+            *indexBuf++ = bottom + j;
+            *indexBuf++ = bottom + j + 1;
+
+            *indexBuf++ = top + j;
+            *indexBuf++ = bottom + j + 1;
+            *indexBuf++ = top + j + 1;
+        }
+    }
+}
+
+//
+/// \brief Write one triangle strip per ring, zig-zagging between the ring and the next one,
+///        with restartIndex between rings. Winding matches FillSphereListIndices.
+/// \return The number of indices written
+//
+int FillSphereStripIndices(int numSlices, GLuint restartIndex, GLuint *indexBuf) {
+    int numParallels = numSlices / 2;
+    int rowLength = numSlices + 1;
+    GLuint *start = indexBuf;
+    int i;
+    int j;
+
+    for ( i = 0; i < numParallels; i++ ) {
+        GLuint top = i * rowLength;
+        GLuint bottom = top + rowLength;
+
+        if ( i > 0 ) {
+            *indexBuf++ = restartIndex;
+        }
+
+        for ( j = 0; j < rowLength; j++ ) {
+            *indexBuf++ = top + j;
+            *indexBuf++ = bottom + j;
+        }
+    }
+
+    return ( int ) ( indexBuf - start );
+}
+
+///
+// Tuning constants of the Forsyth vertex cache optimizer, as published
+//
+const int kForsythCacheSize = 32;
+const float kForsythCacheDecayPower = 1.5f;
+const float kForsythLastTriScore = 0.75f;
+const float kForsythValenceBoostScale = 2.0f;
+const float kForsythValenceBoostPower = 0.5f;
+
+//
+/// \brief Score of a vertex from its position in the modelled LRU cache (-1 if not cached)
+///        and the number of triangles still waiting to use it.
+//
+float ForsythVertexScore(int cachePosition, int remainingTriangles) {
+    float score = 0.0f;
+
+    if ( remainingTriangles == 0 ) {
+        // No triangle needs it any more
+        return -1.0f;
+    }
+
+    if ( cachePosition >= 0 ) {
+        if ( cachePosition < 3 ) {
+            // Used by the last triangle; fixed score so it is not favoured over the others
+            score = kForsythLastTriScore;
+        } else {
+            const float scaler = 1.0f / ( kForsythCacheSize - 3 );
+            score = powf ( 1.0f - ( cachePosition - 3 ) * scaler, kForsythCacheDecayPower );
+        }
+    }
+
+    // Boost vertices with few triangles left so lone triangles are not stranded
+    score += kForsythValenceBoostScale * powf ( ( float ) remainingTriangles,
+                                                -kForsythValenceBoostPower );
+    return score;
+}
+
+//
+/// \brief Append the base solid of esGenGeoSphereLods as unit vectors and CCW triangles.
+//
+void AddGeoSphereBase(int base, std::vector<float> *positions, std::vector<GLuint> *triangles) {
+    if ( base == ES_GEOSPHERE_OCTAHEDRON ) {
+        static const float octaVertices[] = {
+                1.0f, 0.0f, 0.0f,   -1.0f, 0.0f, 0.0f,
+                0.0f, 1.0f, 0.0f,    0.0f, -1.0f, 0.0f,
+                0.0f, 0.0f, 1.0f,    0.0f, 0.0f, -1.0f,
+        };
+        static const GLuint octaTriangles[] = {
+                0, 2, 4,   2, 1, 4,   1, 3, 4,   3, 0, 4,
+                2, 0, 5,   1, 2, 5,   3, 1, 5,   0, 3, 5,
+        };
+        positions->assign ( octaVertices, octaVertices + sizeof ( octaVertices ) / sizeof ( float ) );
+        triangles->assign ( octaTriangles,
+                            octaTriangles + sizeof ( octaTriangles ) / sizeof ( GLuint ) );
+        return;
+    }
+
+    // Three orthogonal golden rectangles
+    const float t = ( 1.0f + sqrtf ( 5.0f ) ) / 2.0f;
+    const float s = 1.0f / sqrtf ( 1.0f + t * t );
+    const float icoVertices[] = {
+            -1, t, 0,   1, t, 0,   -1, -t, 0,   1, -t, 0,
+            0, -1, t,   0, 1, t,   0, -1, -t,   0, 1, -t,
+            t, 0, -1,   t, 0, 1,   -t, 0, -1,   -t, 0, 1,
+    };
+    static const GLuint icoTriangles[] = {
+            0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+            1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+            3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+            4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1,
+    };
+    positions->clear();
+    for ( float c : icoVertices ) {
+        positions->push_back ( c * s );
+    }
+    triangles->assign ( icoTriangles, icoTriangles + sizeof ( icoTriangles ) / sizeof ( GLuint ) );
+}
+
+float EdgeLength(const std::vector<float> &positions, GLuint a, GLuint b) {
+    float dx = positions[a * 3 + 0] - positions[b * 3 + 0];
+    float dy = positions[a * 3 + 1] - positions[b * 3 + 1];
+    float dz = positions[a * 3 + 2] - positions[b * 3 + 2];
+    return sqrtf ( dx * dx + dy * dy + dz * dz );
+}
+
+} // namespace
+
+int esGenSphereFast(int numSlices, float radius, GLfloat **vertices, GLfloat **normals,
+                    GLfloat **texCoords, GLuint **indices) {
+    int i;
+    int numParallels = numSlices / 2;
+    int numVertices = ( numParallels + 1 ) * ( numSlices + 1 );
+    int numIndices = numParallels * numSlices * 6;
+    int rowLength = numSlices + 1;
+    SphereTables tables;
+
+    // Allocate memory for buffers
+    if ( vertices != NULL ) {
+        *vertices = (GLfloat*)malloc(sizeof(GLfloat) * 3 * numVertices);
+    }
+
+    if ( normals != NULL ) {
+        *normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * numVertices);
+    }
+
+    if ( texCoords != NULL ) {
+        *texCoords = (GLfloat*)malloc(sizeof(GLfloat) * 2 * numVertices);
+    }
+
+    if ( indices != NULL ) {
+        *indices = (GLuint*)malloc(sizeof(GLuint) * numIndices);
+    }
+
+    // One allocation for all five tables
+    tables.ringSin = (float*)malloc(sizeof(float) * ( 2 * ( numParallels + 1 ) + 3 * rowLength ));
+    tables.ringCos = tables.ringSin + ( numParallels + 1 );
+    tables.sliceSin = tables.ringCos + ( numParallels + 1 );
+    tables.sliceCos = tables.sliceSin + rowLength;
+    tables.sliceU = tables.sliceCos + rowLength;
+    BuildSphereTables ( numSlices, numParallels, &tables );
+
+    for ( i = 0; i < numParallels + 1; i++ ) {
+        int vertex = i * rowLength;
+
+        if ( vertices != NULL || normals != NULL ) {
+            FillRingPositions ( rowLength, radius * tables.ringSin[i], radius * tables.ringCos[i],
+                                radius, tables.sliceSin, tables.sliceCos,
+                                vertices ? *vertices + vertex * 3 : NULL,
+                                normals ? *normals + vertex * 3 : NULL );
+        }
+
+        if ( texCoords != NULL ) {
+            float v = ( 1.0f - ( float ) i ) / ( float ) ( numParallels - 1 );
+            FillRingTexCoords ( rowLength, v, tables.sliceU, *texCoords + vertex * 2 );
+        }
+    }
+
+    free ( tables.ringSin );
+
+    // Generate the indices
+    if ( indices != NULL ) {
+        FillSphereListIndices ( numSlices, *indices );
+    }
+
+    return numIndices;
+}
+
+GLenum esIndexTypeForVertexCount(int numVertices) {
+    return numVertices <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+GLsizei esIndexTypeSize(GLenum indexType) {
+    switch ( indexType ) {
+        case GL_UNSIGNED_BYTE:
+            return sizeof ( GLubyte );
+        case GL_UNSIGNED_SHORT:
+            return sizeof ( GLushort );
+        default:
+            return sizeof ( GLuint );
+    }
+}
+
+int esGenSphereIndices(int numSlices, unsigned int flags, GLenum *indexType, void **indices) {
+    int numParallels = numSlices / 2;
+    int numVertices = ( numParallels + 1 ) * ( numSlices + 1 );
+    int numIndices;
+    GLuint *wide;
+    int i;
+
+    *indexType = esIndexTypeForVertexCount ( numVertices );
+
+    // Fewer than 2 slices leave no parallels, so there is no ring to index
+    if ( numParallels < 1 ) {
+        *indices = NULL;
+        return 0;
+    }
+
+    if ( flags & ES_INDEX_TRIANGLE_STRIP ) {
+        // 2 indices per vertex of a ring pair plus a restart between rings
+        numIndices = numParallels * 2 * ( numSlices + 1 ) + ( numParallels - 1 );
+        wide = (GLuint*)malloc(sizeof(GLuint) * numIndices);
+        FillSphereStripIndices ( numSlices, 0xFFFFFFFFu, wide );
+    } else {
+        numIndices = numParallels * numSlices * 6;
+        wide = (GLuint*)malloc(sizeof(GLuint) * numIndices);
+        FillSphereListIndices ( numSlices, wide );
+
+        if ( flags & ES_INDEX_OPTIMIZE_VERTEX_CACHE ) {
+            esOptimizeVertexCache ( wide, numIndices, numVertices );
+        }
+    }
+
+    if ( *indexType == GL_UNSIGNED_INT ) {
+        *indices = wide;
+        return numIndices;
+    }
+
+    // Narrow to 16 bits; the 32-bit restart index truncates to the 16-bit one
+    GLushort *narrow = (GLushort*)malloc(sizeof(GLushort) * numIndices);
+    for ( i = 0; i < numIndices; i++ ) {
+        narrow[i] = ( GLushort ) wide[i];
+    }
+    free ( wide );
+
+    *indices = narrow;
+    return numIndices;
+}
+
+void esOptimizeVertexCache(GLuint *indices, int numIndices, int numVertices) {
+    int numTriangles = numIndices / 3;
+    int i;
+
+    if ( numTriangles == 0 ) {
+        return;
+    }
+
+    // Per vertex: range of adjacent triangles in triList, how many are still unemitted
+    // (kept at the front of the range), current cache slot and score
+    std::vector<int> triStart ( numVertices + 1, 0 );
+    std::vector<int> remaining ( numVertices, 0 );
+    std::vector<int> cachePosition ( numVertices, -1 );
+    std::vector<float> vertexScore ( numVertices, 0.0f );
+
+    for ( i = 0; i < numIndices; i++ ) {
+        remaining[indices[i]]++;
+    }
+    for ( i = 0; i < numVertices; i++ ) {
+        triStart[i + 1] = triStart[i] + remaining[i];
+        vertexScore[i] = ForsythVertexScore ( -1, remaining[i] );
+    }
+
+    std::vector<int> triList ( numIndices );
+    std::vector<int> fill ( triStart.begin(), triStart.end() - 1 );
+    for ( i = 0; i < numIndices; i++ ) {
+        triList[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<float> triScore ( numTriangles );
+    std::vector<bool> triEmitted ( numTriangles, false );
+    for ( i = 0; i < numTriangles; i++ ) {
+        triScore[i] = vertexScore[indices[i * 3]] + vertexScore[indices[i * 3 + 1]] +
+                      vertexScore[indices[i * 3 + 2]];
+    }
+
+    std::vector<GLuint> output;
+    output.reserve ( numIndices );
+    std::vector<int> cache;
+    std::vector<int> newCache;
+    cache.reserve ( kForsythCacheSize + 3 );
+    newCache.reserve ( kForsythCacheSize + 3 );
+
+    int bestTri = -1;
+    int nextScan = 0;
+
+    while ( ( int ) output.size() < numIndices ) {
+        if ( bestTri < 0 ) {
+            // Nothing useful in the cache; fall back to the best remaining triangle overall
+            float bestScore = -1e30f;
+            for ( i = nextScan; i < numTriangles; i++ ) {
+                if ( !triEmitted[i] && triScore[i] > bestScore ) {
+                    bestScore = triScore[i];
+                    bestTri = i;
+                }
+            }
+            while ( nextScan < numTriangles && triEmitted[nextScan] ) {
+                nextScan++;
+            }
+        }
+
+        // Emit it and drop it from the adjacency of its vertices
+        const GLuint *tri = indices + bestTri * 3;
+        triEmitted[bestTri] = true;
+        newCache.clear();
+
+        for ( int k = 0; k < 3; k++ ) {
+            int v = tri[k];
+            int begin = triStart[v];
+            int end = begin + remaining[v];
+
+            output.push_back ( v );
+            for ( int t = begin; t < end; t++ ) {
+                if ( triList[t] == bestTri ) {
+                    triList[t] = triList[end - 1];
+                    triList[end - 1] = bestTri;
+                    break;
+                }
+            }
+            remaining[v]--;
+            newCache.push_back ( v );
+        }
+
+        // Rebuild the LRU cache: this triangle's vertices in front, then the old contents
+        for ( int v : cache ) {
+            if ( v != ( int ) tri[0] && v != ( int ) tri[1] && v != ( int ) tri[2] ) {
+                newCache.push_back ( v );
+            }
+        }
+
+        for ( int slot = 0; slot < ( int ) newCache.size(); slot++ ) {
+            int v = newCache[slot];
+            cachePosition[v] = slot < kForsythCacheSize ? slot : -1;
+            vertexScore[v] = ForsythVertexScore ( cachePosition[v], remaining[v] );
+        }
+
+        // Rescore the triangles that touch the cache and pick the best one for the next step
+        float bestScore = -1e30f;
+        bestTri = -1;
+        for ( int v : newCache ) {
+            for ( int t = triStart[v]; t < triStart[v] + remaining[v]; t++ ) {
+                int candidate = triList[t];
+                const GLuint *ct = indices + candidate * 3;
+                triScore[candidate] = vertexScore[ct[0]] + vertexScore[ct[1]] + vertexScore[ct[2]];
+                if ( triScore[candidate] > bestScore ) {
+                    bestScore = triScore[candidate];
+                    bestTri = candidate;
+                }
+            }
+        }
+
+        if ( newCache.size() > ( size_t ) kForsythCacheSize ) {
+            newCache.resize ( kForsythCacheSize );
+        }
+        cache.swap ( newCache );
+    }
+
+    for ( i = 0; i < numIndices; i++ ) {
+        indices[i] = output[i];
+    }
+}
+
+void esMeasureVertexCache(const GLuint *indices, int numIndices, int numVertices, int cacheSize,
+                          float *acmr, float *atvr) {
+    // A vertex is in the FIFO if it was inserted fewer than cacheSize misses ago
+    std::vector<int> insertedAt ( numVertices, -1 );
+    std::vector<bool> referenced ( numVertices, false );
+    int misses = 0;
+    int numReferenced = 0;
+    int i;
+
+    for ( i = 0; i < numIndices; i++ ) {
+        GLuint v = indices[i];
+
+        if ( insertedAt[v] < 0 || misses - insertedAt[v] >= cacheSize ) {
+            insertedAt[v] = misses;
+            misses++;
+        }
+        if ( !referenced[v] ) {
+            referenced[v] = true;
+            numReferenced++;
+        }
+    }
+
+    if ( acmr ) {
+        *acmr = numIndices ? ( float ) misses / ( float ) ( numIndices / 3 ) : 0.0f;
+    }
+    if ( atvr ) {
+        *atvr = numReferenced ? ( float ) misses / ( float ) numReferenced : 0.0f;
+    }
+}
+
+int esGenGeoSphereLods(int base, int maxLevel, float radius, GLfloat **vertices,
+                       GLfloat **normals, GLenum *indexType, void **indices, ESLodRange *lods) {
+    std::vector<float> positions;
+    std::vector<GLuint> level;
+    std::vector<GLuint> allIndices;
+    int numVertices;
+    int i;
+
+    AddGeoSphereBase ( base, &positions, &level );
+
+    for ( int l = 0; l <= maxLevel; l++ ) {
+        if ( l > 0 ) {
+            // Split every triangle in four; midpoints are shared through the edge map
+            std::unordered_map<unsigned long long, GLuint> midpoints;
+            std::vector<GLuint> next;
+            next.reserve ( level.size() * 4 );
+
+            auto midpoint = [&] ( GLuint a, GLuint b ) -> GLuint {
+                unsigned long long key = a < b ? ( ( unsigned long long ) a << 32 ) | b
+                                               : ( ( unsigned long long ) b << 32 ) | a;
+                auto found = midpoints.find ( key );
+                if ( found != midpoints.end() ) {
+                    return found->second;
+                }
+
+                float x = positions[a * 3 + 0] + positions[b * 3 + 0];
+                float y = positions[a * 3 + 1] + positions[b * 3 + 1];
+                float z = positions[a * 3 + 2] + positions[b * 3 + 2];
+                float invLength = 1.0f / sqrtf ( x * x + y * y + z * z );
+                GLuint index = ( GLuint ) ( positions.size() / 3 );
+
+                positions.push_back ( x * invLength );
+                positions.push_back ( y * invLength );
+                positions.push_back ( z * invLength );
+                midpoints[key] = index;
+                return index;
+            };
+
+            for ( size_t t = 0; t < level.size(); t += 3 ) {
+                GLuint a = level[t];
+                GLuint b = level[t + 1];
+                GLuint c = level[t + 2];
+                GLuint ab = midpoint ( a, b );
+                GLuint bc = midpoint ( b, c );
+                GLuint ca = midpoint ( c, a );
+
+                GLuint split[] = { a, ab, ca,   ab, b, bc,   ca, bc, c,   ab, bc, ca };
+                next.insert ( next.end(), split, split + 12 );
+            }
+            level.swap ( next );
+        }
+
+        ESLodRange *range = &lods[l];
+        range->firstIndex = ( int ) allIndices.size();
+        range->numIndices = ( int ) level.size();
+        range->numVertices = ( int ) ( positions.size() / 3 );
+        range->maxEdgeLength = 0.0f;
+        for ( size_t t = 0; t < level.size(); t += 3 ) {
+            float e0 = EdgeLength ( positions, level[t], level[t + 1] );
+            float e1 = EdgeLength ( positions, level[t + 1], level[t + 2] );
+            float e2 = EdgeLength ( positions, level[t + 2], level[t] );
+            range->maxEdgeLength = fmaxf ( range->maxEdgeLength, fmaxf ( e0, fmaxf ( e1, e2 ) ) );
+        }
+
+        // Subdivision order is poor for the vertex cache; reorder a copy of the level
+        size_t first = allIndices.size();
+        allIndices.insert ( allIndices.end(), level.begin(), level.end() );
+        esOptimizeVertexCache ( allIndices.data() + first, range->numIndices, range->numVertices );
+    }
+
+    numVertices = ( int ) ( positions.size() / 3 );
+
+    if ( vertices != NULL ) {
+        *vertices = (GLfloat*)malloc(sizeof(GLfloat) * 3 * numVertices);
+        for ( i = 0; i < numVertices * 3; i++ ) {
+            ( *vertices ) [i] = positions[i] * radius;
+        }
+    }
+
+    if ( normals != NULL ) {
+        *normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * numVertices);
+        for ( i = 0; i < numVertices * 3; i++ ) {
+            ( *normals ) [i] = positions[i];
+        }
+    }
+
+    *indexType = esIndexTypeForVertexCount ( numVertices );
+    if ( *indexType == GL_UNSIGNED_SHORT ) {
+        GLushort *narrow = (GLushort*)malloc(sizeof(GLushort) * allIndices.size());
+        for ( i = 0; i < ( int ) allIndices.size(); i++ ) {
+            narrow[i] = ( GLushort ) allIndices[i];
+        }
+        *indices = narrow;
+    } else {
+        GLuint *wide = (GLuint*)malloc(sizeof(GLuint) * allIndices.size());
+        for ( i = 0; i < ( int ) allIndices.size(); i++ ) {
+            wide[i] = allIndices[i];
+        }
+        *indices = wide;
+    }
+
+    return numVertices;
+}
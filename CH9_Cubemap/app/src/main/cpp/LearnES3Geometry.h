@@ -0,0 +1,119 @@
+//
+// LearnES3Geometry.h
+//
+//    Mesh generators for the samples. Unlike LearnES3Util.h this header only
+//    declares the functions, so it can be shared between the app and the
+//    host-side programs under bench/.
+//
+
+#ifndef LEARNES3_GEOMETRY_H
+#define LEARNES3_GEOMETRY_H
+
+#include <GLES3/gl3.h>
+
+#ifndef ES_PI
+#define ES_PI  (3.14159265f)
+#endif
+
+//
+/// \brief Table-driven version of esGenSphere. Produces exactly the same buffers (bit for bit)
+///        as esGenSphere, but evaluates sinf/cosf once per ring and once per slice instead of
+///        per vertex, and writes positions, normals and texCoords of a ring in one SIMD pass
+///        (NEON on arm64, SSE2 on x86, scalar elsewhere).
+/// \param numSlices The number of slices in the sphere
+/// \param radius The radius of the sphere
+/// \param vertices If not NULL, will contain array of float3 positions
+/// \param normals If not NULL, will contain array of float3 normals
+/// \param texCoords If not NULL, will contain array of float2 texCoords
+/// \param indices If not NULL, will contain the array of indices for the triangle list
+/// \return The number of indices required for rendering the buffers as GL_TRIANGLES
+//
+int esGenSphereFast(int numSlices, float radius, GLfloat **vertices, GLfloat **normals,
+                    GLfloat **texCoords, GLuint **indices);
+
+///
+// Flags for esGenSphereIndices
+//
+#define ES_INDEX_OPTIMIZE_VERTEX_CACHE  0x1u
+#define ES_INDEX_TRIANGLE_STRIP         0x2u
+
+//
+/// \brief Index type needed to address numVertices vertices. GL_UNSIGNED_SHORT is used up to
+///        65535 vertices, which keeps 0xFFFF free as the fixed primitive restart index.
+//
+GLenum esIndexTypeForVertexCount(int numVertices);
+
+//
+/// \brief Size in bytes of one index of the given type
+//
+GLsizei esIndexTypeSize(GLenum indexType);
+
+//
+/// \brief Generates the index buffer for the sphere of esGenSphere/esGenSphereFast in the
+///        narrowest type the vertex count allows.
+/// \param numSlices The number of slices in the sphere
+/// \param flags ES_INDEX_OPTIMIZE_VERTEX_CACHE to reorder the triangles for the
+///        post-transform vertex cache (triangle lists only). ES_INDEX_TRIANGLE_STRIP for one
+///        strip per ring, separated by the fixed primitive restart index of indexType
+/// \param indexType Will contain GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+/// \param indices Will contain the malloc'd index array of that type
+/// \return The number of indices for rendering as GL_TRIANGLES, or as GL_TRIANGLE_STRIP with
+///         GL_PRIMITIVE_RESTART_FIXED_INDEX enabled. 0 with indices set to NULL for numSlices
+///         below 2
+//
+int esGenSphereIndices(int numSlices, unsigned int flags, GLenum *indexType, void **indices);
+
+//
+/// \brief Reorders the triangles of an indexed triangle list in place to improve
+///        post-transform vertex cache reuse (Tom Forsyth's linear-speed optimizer).
+//
+void esOptimizeVertexCache(GLuint *indices, int numIndices, int numVertices);
+
+//
+/// \brief Runs a triangle list through a simulated FIFO post-transform cache.
+/// \param acmr If not NULL, will contain the average cache miss ratio (misses per triangle)
+/// \param atvr If not NULL, will contain the average transform to vertex ratio
+///        (misses per referenced vertex, 1.0 is ideal)
+//
+void esMeasureVertexCache(const GLuint *indices, int numIndices, int numVertices, int cacheSize,
+                          float *acmr, float *atvr);
+
+///
+// Base solids for esGenGeoSphereLods
+//
+#define ES_GEOSPHERE_ICOSAHEDRON  0
+#define ES_GEOSPHERE_OCTAHEDRON   1
+
+///
+// One level of detail inside the shared index buffer of esGenGeoSphereLods
+//
+typedef struct {
+    // First index of the level, in indices from the start of the buffer
+    int firstIndex;
+    // Number of indices, drawn as GL_TRIANGLES
+    int numIndices;
+    // The level only references vertices [0, numVertices)
+    int numVertices;
+    // Longest edge of the level on the unit sphere, for picking a level by screen size
+    float maxEdgeLength;
+} ESLodRange;
+
+//
+/// \brief Generates a sphere by repeatedly subdividing an icosahedron or octahedron and keeps
+///        every level 0..maxLevel. Subdividing only appends edge midpoints, so all levels
+///        share one vertex array; the indices of all levels are stored back to back, each level
+///        reordered for the vertex cache.
+/// \param base ES_GEOSPHERE_ICOSAHEDRON or ES_GEOSPHERE_OCTAHEDRON
+/// \param maxLevel The highest subdivision level (0 is the plain solid)
+/// \param radius The radius of the sphere
+/// \param vertices If not NULL, will contain array of float3 positions
+/// \param normals If not NULL, will contain array of float3 normals
+/// \param indexType Will contain GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+/// \param indices Will contain the malloc'd indices of all levels
+/// \param lods Array of maxLevel + 1 entries, will contain the range of each level
+/// \return The number of vertices
+//
+int esGenGeoSphereLods(int base, int maxLevel, float radius, GLfloat **vertices,
+                       GLfloat **normals, GLenum *indexType, void **indices, ESLodRange *lods);
+
+#endif // LEARNES3_GEOMETRY_H
@@ -0,0 +1,216 @@
+//
+// LearnES3VertexFormat.cpp
+//
+//    Vertex layouts declared in LearnES3VertexFormat.h.
+//
+
+#include "LearnES3VertexFormat.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LearnES3Geometry.h"
+
+namespace {
+
+GLsizei PositionSize(int position) {
+    return position == ES_POSITION_HALF ? 4 * sizeof ( GLushort ) : 3 * sizeof ( GLfloat );
+}
+
+GLsizei NormalSize(int normal) {
+    switch ( normal ) {
+        case ES_NORMAL_FLOAT:
+            return 3 * sizeof ( GLfloat );
+        case ES_NORMAL_INT_2_10_10_10:
+            return sizeof ( GLuint );
+        default:
+            return 0;
+    }
+}
+
+GLsizei TexCoordSize(int texCoord) {
+    switch ( texCoord ) {
+        case ES_TEXCOORD_FLOAT:
+            return 2 * sizeof ( GLfloat );
+        case ES_TEXCOORD_UNORM16:
+            return 2 * sizeof ( GLushort );
+        default:
+            return 0;
+    }
+}
+
+GLushort PackUnorm16(float value) {
+    value = value < 0.0f ? 0.0f : ( value > 1.0f ? 1.0f : value );
+    return ( GLushort ) lrintf ( value * 65535.0f );
+}
+
+} // namespace
+
+void esInitVertexFormat(ESVertexFormat *format, int position, int normal, int texCoord) {
+    GLsizei offset = 0;
+
+    format->position = position;
+    format->normal = normal;
+    format->texCoord = texCoord;
+
+    format->positionOffset = offset;
+    offset += PositionSize ( position );
+
+    format->normalOffset = normal != ES_NORMAL_NONE ? offset : -1;
+    offset += NormalSize ( normal );
+
+    format->texCoordOffset = texCoord != ES_TEXCOORD_NONE ? offset : -1;
+    offset += TexCoordSize ( texCoord );
+
+    format->stride = offset;
+}
+
+void *esPackVertices(const ESVertexFormat *format, int numVertices, const GLfloat *positions,
+                     const GLfloat *normals, const GLfloat *texCoords) {
+    GLubyte *buffer = (GLubyte*)malloc(( size_t ) format->stride * numVertices);
+    int i;
+
+    for ( i = 0; i < numVertices; i++ ) {
+        GLubyte *vertex = buffer + ( size_t ) i * format->stride;
+        const GLfloat *p = positions + i * 3;
+
+        if ( format->position == ES_POSITION_HALF ) {
+            GLushort half[4] = { esFloatToHalf ( p[0] ), esFloatToHalf ( p[1] ),
+                                 esFloatToHalf ( p[2] ), esFloatToHalf ( 1.0f ) };
+            memcpy ( vertex + format->positionOffset, half, sizeof ( half ) );
+        } else {
+            memcpy ( vertex + format->positionOffset, p, 3 * sizeof ( GLfloat ) );
+        }
+
+        if ( format->normal == ES_NORMAL_FLOAT ) {
+            memcpy ( vertex + format->normalOffset, normals + i * 3, 3 * sizeof ( GLfloat ) );
+        } else if ( format->normal == ES_NORMAL_INT_2_10_10_10 ) {
+            const GLfloat *n = normals + i * 3;
+            GLuint packed = esPackSnorm2101010 ( n[0], n[1], n[2], 0.0f );
+            memcpy ( vertex + format->normalOffset, &packed, sizeof ( packed ) );
+        }
+
+        if ( format->texCoord == ES_TEXCOORD_FLOAT ) {
+            memcpy ( vertex + format->texCoordOffset, texCoords + i * 2, 2 * sizeof ( GLfloat ) );
+        } else if ( format->texCoord == ES_TEXCOORD_UNORM16 ) {
+            GLushort uv[2] = { PackUnorm16 ( texCoords[i * 2] ), PackUnorm16 ( texCoords[i * 2 + 1] ) };
+            memcpy ( vertex + format->texCoordOffset, uv, sizeof ( uv ) );
+        }
+    }
+
+    return buffer;
+}
+
+void esBindVertexFormat(const ESVertexFormat *format, GLintptr baseOffset, GLuint positionLoc,
+                        GLuint normalLoc, GLuint texCoordLoc) {
+    if ( format->position == ES_POSITION_HALF ) {
+        glVertexAttribPointer ( positionLoc, 4, GL_HALF_FLOAT, GL_FALSE, format->stride,
+                                ( const void * ) ( baseOffset + format->positionOffset ) );
+    } else {
+        glVertexAttribPointer ( positionLoc, 3, GL_FLOAT, GL_FALSE, format->stride,
+                                ( const void * ) ( baseOffset + format->positionOffset ) );
+    }
+    glEnableVertexAttribArray ( positionLoc );
+
+    if ( format->normal == ES_NORMAL_FLOAT ) {
+        glVertexAttribPointer ( normalLoc, 3, GL_FLOAT, GL_FALSE, format->stride,
+                                ( const void * ) ( baseOffset + format->normalOffset ) );
+        glEnableVertexAttribArray ( normalLoc );
+    } else if ( format->normal == ES_NORMAL_INT_2_10_10_10 ) {
+        glVertexAttribPointer ( normalLoc, 4, GL_INT_2_10_10_10_REV, GL_TRUE, format->stride,
+                                ( const void * ) ( baseOffset + format->normalOffset ) );
+        glEnableVertexAttribArray ( normalLoc );
+    } else {
+        glDisableVertexAttribArray ( normalLoc );
+    }
+
+    if ( format->texCoord == ES_TEXCOORD_FLOAT ) {
+        glVertexAttribPointer ( texCoordLoc, 2, GL_FLOAT, GL_FALSE, format->stride,
+                                ( const void * ) ( baseOffset + format->texCoordOffset ) );
+        glEnableVertexAttribArray ( texCoordLoc );
+    } else if ( format->texCoord == ES_TEXCOORD_UNORM16 ) {
+        glVertexAttribPointer ( texCoordLoc, 2, GL_UNSIGNED_SHORT, GL_TRUE, format->stride,
+                                ( const void * ) ( baseOffset + format->texCoordOffset ) );
+        glEnableVertexAttribArray ( texCoordLoc );
+    } else {
+        glDisableVertexAttribArray ( texCoordLoc );
+    }
+}
+
+int esGenSphereInterleaved(int numSlices, float radius, const ESVertexFormat *format,
+                           void **vertexData) {
+    GLfloat *positions = NULL;
+    GLfloat *normals = NULL;
+    GLfloat *texCoords = NULL;
+    int numVertices = ( numSlices / 2 + 1 ) * ( numSlices + 1 );
+
+    esGenSphereFast ( numSlices, radius, &positions,
+                      format->normal != ES_NORMAL_NONE ? &normals : NULL,
+                      format->texCoord != ES_TEXCOORD_NONE ? &texCoords : NULL, NULL );
+
+    *vertexData = esPackVertices ( format, numVertices, positions, normals, texCoords );
+
+    free ( positions );
+    free ( normals );
+    free ( texCoords );
+    return numVertices;
+}
+
+GLushort esFloatToHalf(float value) {
+    GLuint bits;
+    memcpy ( &bits, &value, sizeof ( bits ) );
+
+    GLuint sign = ( bits >> 16 ) & 0x8000;
+    GLuint biased = ( bits >> 23 ) & 0xFF;
+    GLuint mantissa = bits & 0x7FFFFF;
+    int exponent = ( int ) biased - 127 + 15;
+
+    if ( biased == 0xFF ) {
+        // Inf stays inf, NaN stays a quiet NaN
+        return ( GLushort ) ( sign | 0x7C00 | ( mantissa ? 0x200 : 0 ) );
+    }
+    if ( exponent >= 31 ) {
+        // Too large, round to inf
+        return ( GLushort ) ( sign | 0x7C00 );
+    }
+
+    if ( exponent <= 0 ) {
+        // Half subnormal, or zero if even that is too small
+        if ( exponent < -10 ) {
+            return ( GLushort ) sign;
+        }
+        mantissa |= 0x800000;
+        GLuint shift = ( GLuint ) ( 14 - exponent );
+        GLuint half = mantissa >> shift;
+        GLuint rest = mantissa & ( ( 1u << shift ) - 1 );
+        GLuint halfway = 1u << ( shift - 1 );
+        if ( rest > halfway || ( rest == halfway && ( half & 1 ) ) ) {
+            half++;
+        }
+        return ( GLushort ) ( sign | half );
+    }
+
+    // Rounding may carry into the exponent, which is still the correctly rounded result
+    GLuint half = ( ( GLuint ) exponent << 10 ) | ( mantissa >> 13 );
+    GLuint rest = mantissa & 0x1FFF;
+    if ( rest > 0x1000 || ( rest == 0x1000 && ( half & 1 ) ) ) {
+        half++;
+    }
+    return ( GLushort ) ( sign | half );
+}
+
+GLuint esPackSnorm2101010(float x, float y, float z, float w) {
+    const float scale[4] = { 511.0f, 511.0f, 511.0f, 1.0f };
+    const GLuint mask[4] = { 0x3FF, 0x3FF, 0x3FF, 0x3 };
+    const int shift[4] = { 0, 10, 20, 30 };
+    float value[4] = { x, y, z, w };
+    GLuint packed = 0;
+
+    for ( int i = 0; i < 4; i++ ) {
+        float v = value[i] < -1.0f ? -1.0f : ( value[i] > 1.0f ? 1.0f : value[i] );
+        int component = ( int ) lrintf ( v * scale[i] );
+        packed |= ( ( GLuint ) component & mask[i] ) << shift[i];
+    }
+    return packed;
+}
@@ -0,0 +1,86 @@
+//
+// LearnES3VertexFormat.h
+//
+//    Interleaved (array of structures) vertex layouts with optionally quantized
+//    attributes, shared by the mesh generators and loaders.
+//
+
+#ifndef LEARNES3_VERTEXFORMAT_H
+#define LEARNES3_VERTEXFORMAT_H
+
+#include <GLES3/gl3.h>
+
+///
+// Attribute encodings
+//
+#define ES_POSITION_FLOAT          0   // 3 x GL_FLOAT, 12 bytes
+#define ES_POSITION_HALF           1   // 4 x GL_HALF_FLOAT with w = 1, 8 bytes
+
+#define ES_NORMAL_NONE             0
+#define ES_NORMAL_FLOAT            1   // 3 x GL_FLOAT, 12 bytes
+#define ES_NORMAL_INT_2_10_10_10   2   // GL_INT_2_10_10_10_REV normalized, 4 bytes
+
+#define ES_TEXCOORD_NONE           0
+#define ES_TEXCOORD_FLOAT          1   // 2 x GL_FLOAT, 8 bytes
+#define ES_TEXCOORD_UNORM16        2   // 2 x GL_UNSIGNED_SHORT normalized, clamped to [0, 1], 4 bytes
+
+///
+// One interleaved vertex layout. Fill with esInitVertexFormat.
+//
+typedef struct {
+    int position;
+    int normal;
+    int texCoord;
+
+    // Bytes per vertex
+    GLsizei stride;
+
+    // Byte offsets inside a vertex, -1 for absent attributes
+    GLintptr positionOffset;
+    GLintptr normalOffset;
+    GLintptr texCoordOffset;
+} ESVertexFormat;
+
+//
+/// \brief Compute stride and attribute offsets of a layout. Every attribute starts on a
+///        4-byte boundary.
+//
+void esInitVertexFormat(ESVertexFormat *format, int position, int normal, int texCoord);
+
+//
+/// \brief Interleave and encode float streams into format.
+/// \param positions Array of float3 positions
+/// \param normals Array of float3 normals, may be NULL if format has no normal
+/// \param texCoords Array of float2 texCoords, may be NULL if format has no texCoord
+/// \return malloc'd buffer of numVertices * format->stride bytes
+//
+void *esPackVertices(const ESVertexFormat *format, int numVertices, const GLfloat *positions,
+                     const GLfloat *normals, const GLfloat *texCoords);
+
+//
+/// \brief Point the attribute locations at an interleaved buffer that is bound to
+///        GL_ARRAY_BUFFER, and enable them. Absent attributes are disabled.
+/// \param baseOffset Byte offset of the first vertex in the buffer
+//
+void esBindVertexFormat(const ESVertexFormat *format, GLintptr baseOffset, GLuint positionLoc,
+                        GLuint normalLoc, GLuint texCoordLoc);
+
+//
+/// \brief Generates the sphere of esGenSphereFast directly in an interleaved format.
+/// \param vertexData Will contain the malloc'd vertex buffer
+/// \return The number of vertices
+//
+int esGenSphereInterleaved(int numSlices, float radius, const ESVertexFormat *format,
+                           void **vertexData);
+
+//
+/// \brief IEEE half float with round to nearest even
+//
+GLushort esFloatToHalf(float value);
+
+//
+/// \brief Pack a signed normalized vector as GL_INT_2_10_10_10_REV
+//
+GLuint esPackSnorm2101010(float x, float y, float z, float w);
+
+#endif // LEARNES3_VERTEXFORMAT_H
@@ -0,0 +1,141 @@
+#include "MeshCache.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "AndroidOut.h"
+#include "LearnES3Geometry.h"
+
+bool SphereMeshKey::operator<(const SphereMeshKey &other) const {
+    if (shape != other.shape) {
+        return shape < other.shape;
+    }
+    if (tessellation != other.tessellation) {
+        return tessellation < other.tessellation;
+    }
+    if (radius != other.radius) {
+        return radius < other.radius;
+    }
+    if (positionFormat != other.positionFormat) {
+        return positionFormat < other.positionFormat;
+    }
+    if (normalFormat != other.normalFormat) {
+        return normalFormat < other.normalFormat;
+    }
+    if (texCoordFormat != other.texCoordFormat) {
+        return texCoordFormat < other.texCoordFormat;
+    }
+    return indexFlags < other.indexFlags;
+}
+
+SphereMeshCache::~SphereMeshCache() {
+    for (auto &entry : meshes_) {
+        stateCache_->DeleteBuffers(1, &entry.second.vbo);
+        stateCache_->DeleteBuffers(1, &entry.second.ibo);
+    }
+    meshes_.clear();
+}
+
+const SphereMesh* SphereMeshCache::Acquire(const SphereMeshKey &key) {
+    auto found = meshes_.find(key);
+    if (found != meshes_.end()) {
+        found->second.refCount++;
+        return &found->second;
+    }
+
+    SphereMesh &mesh = meshes_[key];
+    mesh.key = key;
+    mesh.refCount = 1;
+    Upload(&mesh);
+    return &mesh;
+}
+
+void SphereMeshCache::Release(const SphereMesh *mesh) {
+    if (mesh == nullptr) {
+        return;
+    }
+
+    auto found = meshes_.find(mesh->key);
+    if (found == meshes_.end() || --found->second.refCount > 0) {
+        return;
+    }
+
+    stateCache_->DeleteBuffers(1, &found->second.vbo);
+    stateCache_->DeleteBuffers(1, &found->second.ibo);
+    meshes_.erase(found);
+}
+
+void SphereMeshCache::Generate(SphereMesh *mesh, GLfloat **vertices, GLfloat **normals,
+                               GLfloat **texCoords, void **indices) {
+    const SphereMeshKey &key = mesh->key;
+
+    bool wantNormals = mesh->format.normal != ES_NORMAL_NONE;
+
+    if (key.shape != kSphereShapeUV) {
+        mesh->lods.resize(key.tessellation + 1);
+        mesh->numVertices = esGenGeoSphereLods(
+                key.shape == kSphereShapeOctahedron ? ES_GEOSPHERE_OCTAHEDRON
+                                                    : ES_GEOSPHERE_ICOSAHEDRON,
+                key.tessellation, key.radius, vertices, wantNormals ? normals : nullptr,
+                &mesh->indexType, indices, mesh->lods.data());
+        mesh->numIndices = mesh->lods.back().firstIndex + mesh->lods.back().numIndices;
+        mesh->mode = GL_TRIANGLES;
+        return;
+    }
+
+    esGenSphereFast(key.tessellation, key.radius, vertices, wantNormals ? normals : nullptr,
+                    mesh->format.texCoord != ES_TEXCOORD_NONE ? texCoords : nullptr, nullptr);
+    mesh->numIndices = esGenSphereIndices(key.tessellation, key.indexFlags, &mesh->indexType,
+                                          indices);
+    mesh->numVertices = (key.tessellation / 2 + 1) * (key.tessellation + 1);
+    mesh->mode = (key.indexFlags & ES_INDEX_TRIANGLE_STRIP) ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+
+    // A single level; its longest edge is the chord of one slice on the equator
+    ESLodRange range = { 0, mesh->numIndices, mesh->numVertices,
+                         2.0f * sinf(ES_PI / (float) key.tessellation) };
+    mesh->lods.assign(1, range);
+}
+
+void SphereMeshCache::Upload(SphereMesh *mesh) {
+    const SphereMeshKey &key = mesh->key;
+    GLfloat *vertices = nullptr;
+    GLfloat *normals = nullptr;
+    GLfloat *texCoords = nullptr;
+    void *indices = nullptr;
+
+    // Generate the CPU copy
+    esInitVertexFormat(&mesh->format, key.positionFormat, key.normalFormat,
+                       key.shape == kSphereShapeUV ? key.texCoordFormat : ES_TEXCOORD_NONE);
+    Generate(mesh, &vertices, &normals, &texCoords, &indices);
+    generations_++;
+
+    // Interleave and encode into one buffer
+    void *packed = esPackVertices(&mesh->format, mesh->numVertices, vertices, normals, texCoords);
+
+    glGenBuffers(1, &mesh->vbo);
+    stateCache_->BindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) mesh->format.stride * mesh->numVertices, packed,
+                 GL_STATIC_DRAW);
+    stateCache_->BindBuffer(GL_ARRAY_BUFFER, 0);
+    free(packed);
+
+    glGenBuffers(1, &mesh->ibo);
+    stateCache_->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, esIndexTypeSize(mesh->indexType) * mesh->numIndices,
+                 indices, GL_STATIC_DRAW);
+    stateCache_->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    uploads_++;
+
+    // The GPU owns the data from here on
+    free(vertices);
+    free(normals);
+    free(texCoords);
+    free(indices);
+
+    aout << "SphereMeshCache: uploaded shape " << key.shape << " tessellation "
+         << key.tessellation << ", " << mesh->lods.size() << " lods, "
+         << mesh->numVertices << " vertices, " << mesh->numIndices
+         << (mesh->indexType == GL_UNSIGNED_SHORT ? " 16-bit" : " 32-bit") << " indices, "
+         << mesh->format.stride << " bytes per vertex ("
+         << generations_ << " generations, " << uploads_ << " uploads)" << std::endl;
+}
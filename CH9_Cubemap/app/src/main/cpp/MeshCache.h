@@ -0,0 +1,109 @@
+#ifndef LEARNES3_MESHCACHE_H
+#define LEARNES3_MESHCACHE_H
+
+#include <GLES3/gl3.h>
+#include <map>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "LearnES3Geometry.h"
+#include "LearnES3VertexFormat.h"
+
+/*!
+ * How a cached sphere is tessellated
+ */
+enum SphereShape {
+    // Latitude/longitude sphere from esGenSphereFast
+    kSphereShapeUV,
+    // Subdivided solids from esGenGeoSphereLods, with the whole LOD chain in one mesh
+    kSphereShapeIcosahedron,
+    kSphereShapeOctahedron
+};
+
+/*!
+ * Identifies one generated sphere. Two requests with an equal key share the same buffers.
+ */
+struct SphereMeshKey {
+    SphereShape shape;
+    // Number of slices of a UV sphere, highest subdivision level of the other shapes
+    int tessellation;
+    float radius;
+
+    // ES_POSITION_* / ES_NORMAL_* / ES_TEXCOORD_* encodings of the interleaved vertex
+    int positionFormat;
+    int normalFormat;
+    int texCoordFormat;
+
+    // ES_INDEX_* flags passed to esGenSphereIndices, UV spheres only
+    unsigned int indexFlags;
+
+    bool operator<(const SphereMeshKey &other) const;
+};
+
+/*!
+ * A sphere that lives only on the GPU, as one interleaved vertex buffer and one index buffer.
+ */
+struct SphereMesh {
+    SphereMeshKey key;
+
+    GLuint vbo;
+    GLuint ibo;
+
+    // Layout of vbo. Geospheres never carry texture coordinates.
+    ESVertexFormat format;
+
+    GLsizei numVertices;
+    GLsizei numIndices;
+    GLenum indexType;
+
+    // GL_TRIANGLES, or GL_TRIANGLE_STRIP drawn with GL_PRIMITIVE_RESTART_FIXED_INDEX
+    GLenum mode;
+
+    // Index ranges from coarsest to finest. UV spheres have a single level.
+    std::vector<ESLodRange> lods;
+
+    int refCount;
+};
+
+/*!
+ * Generates each distinct sphere once, uploads it into buffer objects and hands out refcounted
+ * handles to it. The CPU copies are freed as soon as the upload is done. Must be used and
+ * destroyed with the GL context current.
+ */
+class SphereMeshCache {
+public:
+    explicit SphereMeshCache(GLStateCache *stateCache)
+            : stateCache_(stateCache), generations_(0), uploads_(0) {}
+    virtual ~SphereMeshCache();
+
+    /*!
+     * Returns the mesh for key, generating and uploading it on first use. Every call must be
+     * balanced by a Release.
+     */
+    const SphereMesh* Acquire(const SphereMeshKey &key);
+
+    /*!
+     * Drops one reference; the buffers are deleted when the last one goes away.
+     */
+    void Release(const SphereMesh *mesh);
+
+    int Generations() const { return generations_; }
+    int Uploads() const { return uploads_; }
+
+private:
+    void Upload(SphereMesh *mesh);
+
+    /*!
+     * Fills the CPU copy of mesh and returns the malloc'd float streams, nullptr for the ones
+     * mesh->format does not contain.
+     */
+    void Generate(SphereMesh *mesh, GLfloat **vertices, GLfloat **normals, GLfloat **texCoords,
+                  void **indices);
+
+    GLStateCache *stateCache_;
+    std::map<SphereMeshKey, SphereMesh> meshes_;
+    int generations_;
+    int uploads_;
+};
+
+#endif //LEARNES3_MESHCACHE_H
@@ -0,0 +1,199 @@
+#include "ProgramBatch.h"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+
+#include <cstring>
+
+#include "AndroidOut.h"
+#include "FrameConstants.h"
+
+namespace {
+
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR_ = nullptr;
+
+bool HasParallelCompile() {
+    static int supported = -1;
+    if (supported < 0) {
+        const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+        glMaxShaderCompilerThreadsKHR_ = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)
+                eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        supported = extensions && strstr(extensions, "GL_KHR_parallel_shader_compile")
+                    && glMaxShaderCompilerThreadsKHR_ ? 1 : 0;
+        if (supported) {
+            // Let the driver pick the thread count
+            glMaxShaderCompilerThreadsKHR_(0xFFFFFFFFu);
+        }
+    }
+    return supported == 1;
+}
+
+GLuint CompileShader(GLenum type, const std::string &source) {
+    GLuint shader = glCreateShader(type);
+    if (shader) {
+        const char *text = source.c_str();
+        glShaderSource(shader, 1, &text, nullptr);
+        glCompileShader(shader);
+    }
+    return shader;
+}
+
+void LogInfo(const char *what, const std::vector<char> &log) {
+    aout << "ProgramBatch: " << what << " failed:\n" << log.data() << std::endl;
+}
+
+}  // namespace
+
+ProgramBatch::ProgramBatch(ProgramCache *programCache)
+        : programCache_(programCache), parallel_(HasParallelCompile()), submitted_(false) {}
+
+ProgramBatch::~ProgramBatch() {
+    // Only left over if Finish never ran
+    for (Entry &entry : entries_) {
+        glDeleteShader(entry.vertShader);
+        glDeleteShader(entry.fragShader);
+        if (entry.program && !entry.cached) {
+            glDeleteProgram(entry.program);
+        }
+    }
+}
+
+void ProgramBatch::Add(const char *vertShaderSrc, const char *fragShaderSrc, GLuint *program) {
+    Entry entry = { vertShaderSrc, fragShaderSrc, program, 0, 0, 0, false };
+    entries_.push_back(entry);
+}
+
+void ProgramBatch::Submit() {
+    if (submitted_) {
+        return;
+    }
+    submitted_ = true;
+    submitTime_ = std::chrono::steady_clock::now();
+
+    int compiled = 0;
+    for (Entry &entry : entries_) {
+        if (programCache_) {
+            entry.program = programCache_->Find(entry.vertSrc.c_str(), entry.fragSrc.c_str());
+            if (entry.program) {
+                entry.cached = true;
+                continue;
+            }
+        }
+
+        entry.vertShader = CompileShader(GL_VERTEX_SHADER, entry.vertSrc);
+        entry.fragShader = CompileShader(GL_FRAGMENT_SHADER, entry.fragSrc);
+        entry.program = glCreateProgram();
+        if (!entry.vertShader || !entry.fragShader || !entry.program) {
+            continue;
+        }
+
+        // Linking a program whose shaders failed is harmless, Finish reports the shader error
+        glAttachShader(entry.program, entry.vertShader);
+        glAttachShader(entry.program, entry.fragShader);
+        if (programCache_) {
+            glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glLinkProgram(entry.program);
+        compiled++;
+    }
+
+    aout << "ProgramBatch: " << compiled << " of " << entries_.size() << " programs compiling"
+         << (parallel_ ? " in parallel" : "") << std::endl;
+}
+
+bool ProgramBatch::IsReady() const {
+    if (!parallel_ || !submitted_) {
+        return true;
+    }
+    for (const Entry &entry : entries_) {
+        if (entry.cached || !entry.program) {
+            continue;
+        }
+        GLint done = GL_TRUE;
+        glGetProgramiv(entry.program, GL_COMPLETION_STATUS_KHR, &done);
+        if (!done) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ProgramBatch::Finish() {
+    Submit();
+
+    bool ok = true;
+    int built = 0;
+    for (Entry &entry : entries_) {
+        if (!entry.cached) {
+            GLint linked = GL_FALSE;
+            if (entry.program) {
+                glGetProgramiv(entry.program, GL_LINK_STATUS, &linked);
+            }
+
+            // Shader logs are only worth fetching when something went wrong
+            if (!linked) {
+                bool shadersOk = CheckShader(entry.vertShader, "vertex shader")
+                                 & CheckShader(entry.fragShader, "fragment shader");
+                if (shadersOk && entry.program) {
+                    GLint length = 0;
+                    glGetProgramiv(entry.program, GL_INFO_LOG_LENGTH, &length);
+                    std::vector<char> log(length > 1 ? length : 1, '\0');
+                    glGetProgramInfoLog(entry.program, (GLsizei) log.size(), nullptr,
+                                        log.data());
+                    LogInfo("link", log);
+                }
+                glDeleteProgram(entry.program);
+                entry.program = 0;
+                ok = false;
+            } else {
+                built++;
+            }
+
+            glDeleteShader(entry.vertShader);
+            glDeleteShader(entry.fragShader);
+            entry.vertShader = 0;
+            entry.fragShader = 0;
+        }
+
+        if (entry.program) {
+            esBindFrameConstantsBlock(entry.program);
+        }
+        *entry.result = entry.program;
+    }
+
+    // The compiles overlapped, so each built program is charged an equal share of the wall time
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()
+                                                          - submitTime_).count();
+    if (programCache_) {
+        for (Entry &entry : entries_) {
+            if (!entry.cached && entry.program) {
+                programCache_->Store(entry.vertSrc.c_str(), entry.fragSrc.c_str(), entry.program,
+                                     ms / built);
+            }
+        }
+    }
+    aout << "ProgramBatch: " << entries_.size() << " programs ready after " << ms << " ms"
+         << std::endl;
+
+    entries_.clear();
+    submitted_ = false;
+    return ok;
+}
+
+bool ProgramBatch::CheckShader(GLuint shader, const char *stage) {
+    if (!shader) {
+        return false;
+    }
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled) {
+        return true;
+    }
+
+    GLint length = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    std::vector<char> log(length > 1 ? length : 1, '\0');
+    glGetShaderInfoLog(shader, (GLsizei) log.size(), nullptr, log.data());
+    LogInfo(stage, log);
+    return false;
+}
@@ -0,0 +1,72 @@
+#ifndef LEARNES3_PROGRAMBATCH_H
+#define LEARNES3_PROGRAMBATCH_H
+
+#include <GLES3/gl3.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "ProgramCache.h"
+
+/*!
+ * Builds many programs without waiting on the compiler between them.
+ *
+ * Querying GL_COMPILE_STATUS or GL_LINK_STATUS right after glCompileShader / glLinkProgram
+ * blocks until that one shader is done, which serializes the driver's compiler threads. A batch
+ * first issues every compile and link, then only asks for status and logs in Finish. With
+ * GL_KHR_parallel_shader_compile the driver compiles on its own threads and IsReady polls
+ * GL_COMPLETION_STATUS_KHR, so a caller can keep presenting frames until the batch is done.
+ *
+ * Programs found in the ProgramCache skip compilation entirely. Must be used with the GL
+ * context current.
+ */
+class ProgramBatch {
+public:
+    explicit ProgramBatch(ProgramCache *programCache);
+    virtual ~ProgramBatch();
+
+    /*!
+     * Queues a program. The sources are copied. *program is written by Finish, 0 on failure.
+     */
+    void Add(const char *vertShaderSrc, const char *fragShaderSrc, GLuint *program);
+
+    /*!
+     * Issues all compiles and links of the queued programs without querying any status.
+     */
+    void Submit();
+
+    /*!
+     * True once Finish will not block. Always true without GL_KHR_parallel_shader_compile.
+     */
+    bool IsReady() const;
+
+    /*!
+     * Checks every program, logs compile and link errors and writes the results. Blocks if the
+     * driver is not done yet. Returns false if any program failed.
+     */
+    bool Finish();
+
+    int Size() const { return (int) entries_.size(); }
+
+private:
+    struct Entry {
+        std::string vertSrc;
+        std::string fragSrc;
+        GLuint *result;
+        GLuint vertShader;
+        GLuint fragShader;
+        GLuint program;
+        // Loaded from the cache, nothing to check
+        bool cached;
+    };
+
+    static bool CheckShader(GLuint shader, const char *stage);
+
+    ProgramCache *programCache_;
+    std::vector<Entry> entries_;
+    bool parallel_;
+    bool submitted_;
+    std::chrono::steady_clock::time_point submitTime_;
+};
+
+#endif //LEARNES3_PROGRAMBATCH_H
@@ -0,0 +1,75 @@
+#ifndef LEARNES3_PROGRAMCACHE_H
+#define LEARNES3_PROGRAMCACHE_H
+
+#include <GLES3/gl3.h>
+#include <string>
+
+/*!
+ * Compiles and links a vertex/fragment pair, returns 0 on failure. The program must be linked
+ * with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set so that ProgramCache can read it back.
+ */
+typedef GLuint (*ProgramLinkFunc)(const char *vertShaderSrc, const char *fragShaderSrc);
+
+/*!
+ * Keeps glGetProgramBinary output of linked programs in files under one directory, so that later
+ * launches skip compiling and linking.
+ *
+ * Entries are keyed by a hash of both shader sources, GL_RENDERER and GL_VERSION, so a driver
+ * update or an edited shader simply misses. A binary the driver rejects is deleted and the
+ * program is built from source again. Must be used with the GL context current.
+ */
+class ProgramCache {
+public:
+    /*!
+     * @param directory where the binaries are kept, usually the app's internal data path
+     */
+    explicit ProgramCache(const std::string &directory);
+    virtual ~ProgramCache() {}
+
+    /*!
+     * Returns the cached program for the sources, or builds it with link and caches it. Returns
+     * 0 if link fails.
+     */
+    GLuint Load(const char *vertShaderSrc, const char *fragShaderSrc, ProgramLinkFunc link);
+
+    /*!
+     * The two halves of Load, for callers that build programs themselves. Find returns the
+     * cached program or 0 and counts a hit. Store caches a program built from the sources after a
+     * failed Find and counts a miss that took buildMs.
+     */
+    GLuint Find(const char *vertShaderSrc, const char *fragShaderSrc);
+    void Store(const char *vertShaderSrc, const char *fragShaderSrc, GLuint program,
+               double buildMs);
+
+    // Totals since construction
+    int Hits() const { return hits_; }
+    int Misses() const { return misses_; }
+    // Binaries found on disk but refused by glProgramBinary, also counted as misses
+    int Rejected() const { return rejected_; }
+    double HitMs() const { return hitMs_; }
+    double MissMs() const { return missMs_; }
+
+private:
+    unsigned long long Key(const char *vertShaderSrc, const char *fragShaderSrc) const;
+    std::string PathFor(unsigned long long key) const;
+
+    /*!
+     * Returns a linked program made from the file of key, or 0 if there is none or GL refused it.
+     */
+    GLuint LoadBinary(unsigned long long key);
+    void StoreBinary(unsigned long long key, GLuint program) const;
+
+    std::string directory_;
+    // Hash of GL_RENDERER and GL_VERSION, mixed into every key
+    unsigned long long driverHash_;
+    // False when the driver offers no binary formats, every Load then just links
+    bool enabled_;
+
+    int hits_;
+    int misses_;
+    int rejected_;
+    double hitMs_;
+    double missMs_;
+};
+
+#endif //LEARNES3_PROGRAMCACHE_H
@@ -3,15 +3,23 @@
 
 #include <game-activity/native_app_glue/android_native_app_glue.h>
 #include <GLES3/gl3.h>
-#include <android/imagedecoder.h>
 
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
 #include <memory>
 #include <vector>
 
 #include "AndroidOut.h"
 #include "LearnES3Util.h"
+#include "LearnES3Geometry.h"
+#include "LearnES3VertexFormat.h"
+#include "DrawBench.h"
+#include "GLStateCache.h"
 
 //! executes glGetString and outputs the result to logcat
 #define PRINT_GL_STRING(s) { aout << #s": " << glGetString(s) << std::endl; }
@@ -38,43 +46,235 @@ aout << std::endl;\
 //! Color for cornflower blue. Can be sent directly to glClearColor
 #define CORNFLOWER_BLUE 100 / 255.f, 149 / 255.f, 237 / 255.f, 1
 
-// Initialize the shader and program object
-bool CubemapRender::Init() {
-    RenderUserData* userData = &UserData_;
-    char vShaderStr[] =
-            "#version 300 es                            \n"
+//! Tessellation and size of the UV sphere
+static const int kSphereSlices = 20;
+static const float kSphereRadius = 0.75f;
+
+//! Highest subdivision level kept in the geosphere LOD chain
+static const int kGeoSphereMaxLevel = 6;
+
+//! Longest on-screen edge, in pixels, a geosphere level may have before a finer one is used
+static const float kLodEdgePixels = 16.0f;
+
+//! GGX roughness the sphere reflects with, picks the level of the prefiltered specular map
+static const float kSphereRoughness = 0.4f;
+
+//! Dynamic reflections: probe face size, where it sits below the instanced sphere field, its
+//! schedule and how often its cost is logged
+static const GLsizei kProbeSize = 64;
+static const GLfloat kProbePosition[3] = { 0.0f, 0.0f, -0.25f };
+static const CubemapProbe::Schedule kProbeSchedule = CubemapProbe::kRoundRobin;
+static const int kProbeFacesPerFrame = 1;
+static const int kProbeReportFrames = 300;
+
+//! Staging for streamed texture uploads: one 256x256 RGBA8 face level per buffer, and at most
+//! that much issued per frame
+static const size_t kUploadBufferSize = 256 * 256 * 4;
+static const int kUploadBufferCount = 4;
+static const size_t kUploadFrameBudget = 256 * 256 * 4;
+
+//! Per-instance vertex data of kSphereInstanced, 20 bytes
+struct SphereInstance {
+    // xyz: center in clip space, w: scale applied to the sphere
+    GLfloat offsetScale[4];
+    // Normalized RGBA multiplied into the reflection
+    GLubyte tint[4];
+};
+
+//! Spheres on a square grid that covers clip space, each one filling 90% of its cell
+static std::vector<SphereInstance> LayoutSphereInstances(int instanceCount) {
+    std::vector<SphereInstance> instances(instanceCount);
+    int grid = (int) ceilf(sqrtf((float) instanceCount));
+    float cell = 2.0f / (float) grid;
+    float scale = cell * 0.45f / kSphereRadius;
+
+    for (int i = 0; i < instanceCount; i++) {
+        SphereInstance &instance = instances[i];
+        instance.offsetScale[0] = -1.0f + cell * ((float) (i % grid) + 0.5f);
+        instance.offsetScale[1] = 1.0f - cell * ((float) (i / grid) + 0.5f);
+        instance.offsetScale[2] = 0.0f;
+        instance.offsetScale[3] = scale;
+        instance.tint[0] = (GLubyte) (128 + (i * 37) % 128);
+        instance.tint[1] = (GLubyte) (128 + (i * 71) % 128);
+        instance.tint[2] = (GLubyte) (128 + (i * 113) % 128);
+        instance.tint[3] = 255;
+    }
+    return instances;
+}
+
+// Request the program variants, Init runs once they are linked
+void CubemapRender::AddPrograms(ShaderVariantCache* variants) {
+    // Templates, ShaderVariantCache adds the #version line and the defines
+    const char vShaderStr[] =
+            ES_FRAME_CONSTANTS_GLSL
             "layout(location = 0) in vec4 a_position;   \n"
             "layout(location = 1) in vec3 a_normal;     \n"
             "out vec3 v_normal;                         \n"
             "void main()                                \n"
             "{                                          \n"
-            "   gl_Position = a_position;               \n"
+            "   gl_Position = u_projection * u_view     \n"
+            "               * a_position;               \n"
             "   v_normal = a_normal;                    \n"
             "}                                          \n";
 
-    char fShaderStr[] =
-            "#version 300 es                                     \n"
-            "precision mediump float;                            \n"
+    // Same sphere as esGenSphere, evaluated per vertex: every 6 vertices form the two
+    // triangles of one quad, in the corner order of the generated index list
+    const char vProceduralShaderStr[] =
+            ES_FRAME_CONSTANTS_GLSL
+            "uniform int u_numSlices;                                           \n"
+            "uniform float u_radius;                                            \n"
+            "out vec3 v_normal;                                                 \n"
+            "const ivec2 corners[6] = ivec2[6] ( ivec2 ( 0, 0 ), ivec2 ( 1, 0 ),\n"
+            "                                    ivec2 ( 1, 1 ), ivec2 ( 0, 0 ),\n"
+            "                                    ivec2 ( 1, 1 ), ivec2 ( 0, 1 ) );\n"
+            "void main()                                                        \n"
+            "{                                                                  \n"
+            "   int quad = gl_VertexID / 6;                                     \n"
+            "   ivec2 corner = corners[gl_VertexID - quad * 6];                 \n"
+            "   int ring = quad / u_numSlices + corner.x;                       \n"
+            "   int slice = quad - ( quad / u_numSlices ) * u_numSlices         \n"
+            "               + corner.y;                                         \n"
+            "   float angleStep = 6.28318531 / float ( u_numSlices );           \n"
+            "   float theta = angleStep * float ( ring );                       \n"
+            "   float phi = angleStep * float ( slice );                        \n"
+            "   vec3 normal = vec3 ( sin ( theta ) * sin ( phi ), cos ( theta ),\n"
+            "                        sin ( theta ) * cos ( phi ) );             \n"
+            "   gl_Position = u_projection * u_view                             \n"
+            "               * vec4 ( u_radius * normal, 1.0 );                  \n"
+            "   v_normal = normal;                                              \n"
+            "}                                                                  \n";
+
+    // Same sphere, moved and scaled per instance
+    const char vInstancedShaderStr[] =
+            ES_FRAME_CONSTANTS_GLSL
+            "layout(location = 0) in vec4 a_position;                             \n"
+            "layout(location = 1) in vec3 a_normal;                               \n"
+            "layout(location = 3) in vec4 a_offsetScale;                          \n"
+            "layout(location = 4) in vec4 a_tint;                                 \n"
+            "out vec3 v_normal;                                                   \n"
+            "out vec4 v_tint;                                                     \n"
+            "void main()                                                          \n"
+            "{                                                                    \n"
+            "   gl_Position = u_projection * u_view                               \n"
+            "               * vec4 ( a_position.xyz * a_offsetScale.w             \n"
+            "                        + a_offsetScale.xyz, 1.0 );                  \n"
+            "   v_normal = a_normal;                                              \n"
+            "   v_tint = a_tint;                                                  \n"
+            "}                                                                    \n";
+
+    // USE_CUBEMAP mixes the SPECULAR_LOD level of the prefiltered s_texture with the diffuse
+    // light of s_irradiance, otherwise the normal is shown. USE_TINT multiplies by the
+    // per-instance tint.
+    const char fShaderStr[] =
+            "precision PRECISION float;                          \n"
             "in vec3 v_normal;                                   \n"
+            "#if USE_TINT                                        \n"
+            "in vec4 v_tint;                                     \n"
+            "#endif                                              \n"
             "layout(location = 0) out vec4 outColor;             \n"
+            "#if USE_CUBEMAP                                     \n"
             "uniform samplerCube s_texture;                      \n"
+            "uniform samplerCube s_irradiance;                   \n"
+            "#endif                                              \n"
             "void main()                                         \n"
             "{                                                   \n"
-            "   outColor = texture( s_texture, v_normal );       \n"
+            "#if USE_CUBEMAP                                     \n"
+            "   vec3 specular = textureLod( s_texture, v_normal, SPECULAR_LOD ).rgb;\n"
+            "   vec3 diffuse = texture( s_irradiance, v_normal ).rgb;\n"
+            "   outColor = vec4( mix( diffuse, specular, 0.5 ), 1.0 );\n"
+            "#else                                               \n"
+            "   outColor = vec4( normalize( v_normal ) * 0.5 + 0.5, 1.0 );\n"
+            "#endif                                              \n"
+            "#if USE_TINT                                        \n"
+            "   outColor *= v_tint;                              \n"
+            "#endif                                              \n"
             "}                                                   \n";
 
-    // Load the shaders and get a linked program object
-    userData->programObject = esLoadProgram ( vShaderStr, fShaderStr );
+    // Level l of the specular map is filtered for roughness l / (levels - 1)
+    char specularLod[16];
+    snprintf ( specularLod, sizeof ( specularLod ), "%.2f",
+               kSphereRoughness * ( float ) ( EnvironmentPrefilter::kSpecularLevels - 1 ) );
+
+    ShaderDefines cubemap;
+    cubemap["USE_CUBEMAP"] = "1";
+    cubemap["SPECULAR_LOD"] = specularLod;
+    ShaderDefines tintedCubemap = cubemap;
+    tintedCubemap["USE_TINT"] = "1";
+
+    mesh_variant_ = variants->Request ( vShaderStr, fShaderStr, cubemap );
+
+    // The procedural and instanced programs are also used by the benchmarks, so always build them
+    procedural_variant_ = variants->Request ( vProceduralShaderStr, fShaderStr, cubemap );
+    instanced_variant_ = variants->Request ( vInstancedShaderStr, fShaderStr, tintedCubemap );
+}
+
+// Initialize the resources that need the linked programs
+bool CubemapRender::Init() {
+    RenderUserData* userData = &UserData_;
+    userData->programObject = mesh_variant_ ? *mesh_variant_ : 0;
+    userData->proceduralProgram = procedural_variant_ ? *procedural_variant_ : 0;
+    userData->instancedProgram = instanced_variant_ ? *instanced_variant_ : 0;
+    if ( userData->programObject == 0 || userData->proceduralProgram == 0
+         || userData->instancedProgram == 0 ) {
+        return FALSE;
+    }
 
     // Get the sampler locations
     userData->samplerLoc = glGetUniformLocation ( userData->programObject, "s_texture" );
-
-    // Load the texture
+    userData->irradianceLoc = glGetUniformLocation ( userData->programObject, "s_irradiance" );
+
+    userData->proceduralSamplerLoc = glGetUniformLocation ( userData->proceduralProgram,
+                                                            "s_texture" );
+    userData->proceduralIrradianceLoc = glGetUniformLocation ( userData->proceduralProgram,
+                                                               "s_irradiance" );
+    userData->proceduralSlicesLoc = glGetUniformLocation ( userData->proceduralProgram,
+                                                           "u_numSlices" );
+    userData->proceduralRadiusLoc = glGetUniformLocation ( userData->proceduralProgram,
+                                                           "u_radius" );
+
+    userData->instancedSamplerLoc = glGetUniformLocation ( userData->instancedProgram,
+                                                           "s_texture" );
+    userData->instancedIrradianceLoc = glGetUniformLocation ( userData->instancedProgram,
+                                                              "s_irradiance" );
+
+    // The irradiance map always sits on unit 1, the benchmarks draw with all three programs
+    state_cache_->UseProgram ( userData->programObject );
+    state_cache_->Uniform1i ( userData->irradianceLoc, 1 );
+    state_cache_->UseProgram ( userData->proceduralProgram );
+    state_cache_->Uniform1i ( userData->proceduralIrradianceLoc, 1 );
+    state_cache_->UseProgram ( userData->instancedProgram );
+    state_cache_->Uniform1i ( userData->instancedIrradianceLoc, 1 );
+
+    // The instance buffer is also used by the benchmarks, so always build it
+    glGenBuffers ( 1, &userData->instanceBuffer );
+    UploadInstances ( instance_count_ );
+
+    // Load the texture, filtering comes from the shared trilinear sampler. With a single level
+    // the placeholder reads the same as with nearest filtering.
     userData->textureId = CreateSimpleTextureCubemap ();
+    userData->samplerId = sampler_pool_->Get ( MakeSamplerDesc ( GL_LINEAR_MIPMAP_LINEAR,
+                                                                 GL_LINEAR, GL_CLAMP_TO_EDGE ) );
+
+    // The procedural sphere needs no vertex data at all
+    if ( sphere_mode_ == kSphereProcedural ) {
+        glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
+        return TRUE;
+    }
 
-    // Generate the vertex data
-    userData->numIndices = esGenSphere ( 20, 0.75f, &userData->vertices, &userData->normals,
-                                         NULL, &userData->indices );
+    // Generate the vertex data, or share it if a sphere like this was already uploaded.
+    // Half positions and 2_10_10_10 normals are 12 bytes per vertex instead of 24.
+    SphereMeshKey sphereKey = { kSphereShapeUV, kSphereSlices, kSphereRadius,
+                                ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10, ES_TEXCOORD_NONE,
+                                ES_INDEX_OPTIMIZE_VERTEX_CACHE };
+    if ( sphere_mode_ == kSphereTriangleStrip ) {
+        sphereKey.indexFlags = ES_INDEX_TRIANGLE_STRIP;
+    } else if ( sphere_mode_ == kSphereIcosphere || sphere_mode_ == kSphereOctasphere ) {
+        sphereKey.shape = sphere_mode_ == kSphereIcosphere ? kSphereShapeIcosahedron
+                                                           : kSphereShapeOctahedron;
+        sphereKey.tessellation = kGeoSphereMaxLevel;
+        sphereKey.indexFlags = 0;
+    }
+    userData->sphere = mesh_cache_->Acquire ( sphereKey );
 
 
     glClearColor ( 1.0f, 1.0f, 1.0f, 0.0f );
@@ -100,41 +300,69 @@ GLuint CubemapRender::CreateSimpleTextureCubemap() {
                     255, 255, 255
             };
 
-    // Generate a texture object
-    glGenTextures ( 1, &textureId );
+    // Immutable storage with exactly one level, no sampling state of its own
+    TextureDesc desc = { GL_TEXTURE_CUBE_MAP, GL_RGB8, 1, 1, 1, 1 };
+    textureId = texture_factory_->Create ( desc );
 
-    // Bind the texture object
-    glBindTexture ( GL_TEXTURE_CUBE_MAP, textureId );
+    // Load the six faces, +X -X +Y -Y +Z -Z
+    glPixelStorei ( GL_UNPACK_ALIGNMENT, 1 );
+    for ( int face = 0; face < 6; face++ ) {
+        glTexSubImage2D ( GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0, 1, 1,
+                          GL_RGB, GL_UNSIGNED_BYTE, &cubePixels[face] );
+    }
+    glPixelStorei ( GL_UNPACK_ALIGNMENT, 4 );
 
-    // Load the cube face - Positive X
-    glTexImage2D ( GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGB, 1, 1, 0,
-                   GL_RGB, GL_UNSIGNED_BYTE, &cubePixels[0] );
+    return textureId;
+}
 
-    // Load the cube face - Negative X
-    glTexImage2D ( GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RGB, 1, 1, 0,
-                   GL_RGB, GL_UNSIGNED_BYTE, &cubePixels[1] );
+void CubemapRender::SetCubemap(GLuint texture) {
+    texture_factory_->Destroy ( &UserData_.textureId );
+    texture_factory_->Destroy ( &UserData_.irradianceId );
+    UserData_.textureId = texture;
+    if ( probe_ ) {
+        probe_->Invalidate ();
+    }
+}
+
+void CubemapRender::SetEnvironment(GLuint specular, GLuint irradiance) {
+    SetCubemap ( specular );
+    UserData_.irradianceId = irradiance;
+}
 
-    // Load the cube face - Positive Y
-    glTexImage2D ( GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_RGB, 1, 1, 0,
-                   GL_RGB, GL_UNSIGNED_BYTE, &cubePixels[2] );
+void CubemapRender::SetProbe(CubemapProbe* probe) {
+    probe_ = probe;
+    if ( probe_ && !probe_sphere_ ) {
+        SphereMeshKey key = { kSphereShapeUV, kSphereSlices, kSphereRadius,
+                              ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10, ES_TEXCOORD_NONE,
+                              ES_INDEX_OPTIMIZE_VERTEX_CACHE };
+        probe_sphere_ = mesh_cache_->Acquire ( key );
+    }
+}
 
-    // Load the cube face - Negative Y
-    glTexImage2D ( GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RGB, 1, 1, 0,
-                   GL_RGB, GL_UNSIGNED_BYTE, &cubePixels[3] );
+void CubemapRender::BindTextures(GLuint specular) const {
+    const RenderUserData* userData = &UserData_;
 
-    // Load the cube face - Positive Z
-    glTexImage2D ( GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RGB, 1, 1, 0,
-                   GL_RGB, GL_UNSIGNED_BYTE, &cubePixels[4] );
+    // The placeholder and an unfiltered cubemap stand in for their own irradiance
+    state_cache_->ActiveTexture ( GL_TEXTURE1 );
+    state_cache_->BindTexture ( GL_TEXTURE_CUBE_MAP, userData->irradianceId ? userData->irradianceId
+                                                                            : userData->textureId );
+    state_cache_->BindSampler ( 1, userData->samplerId );
+    state_cache_->ActiveTexture ( GL_TEXTURE0 );
+    state_cache_->BindTexture ( GL_TEXTURE_CUBE_MAP, specular );
+    state_cache_->BindSampler ( 0, userData->samplerId );
+}
 
-    // Load the cube face - Negative Z
-    glTexImage2D ( GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGB, 1, 1, 0,
-                   GL_RGB, GL_UNSIGNED_BYTE, &cubePixels[5] );
+void CubemapRender::DrawProbeScene() const {
+    const RenderUserData* userData = &UserData_;
 
-    // Set the filtering mode
-    glTexParameteri ( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-    glTexParameteri ( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    state_cache_->CullFace ( GL_BACK );
+    state_cache_->Enable ( GL_CULL_FACE );
 
-    return textureId;
+    // Never the probe itself, it is the render target
+    BindTextures ( userData->textureId );
+    state_cache_->UseProgram ( userData->instancedProgram );
+    state_cache_->Uniform1i ( userData->instancedSamplerLoc, 0 );
+    DrawInstanced ( probe_sphere_, instance_count_ );
 }
 
 ///
@@ -144,40 +372,429 @@ void CubemapRender::Draw (GLsizei width, GLsizei height) const {
     const RenderUserData* userData = &UserData_;
 
     // Set the viewport
-    glViewport ( 0, 0, width, height );
+    state_cache_->Viewport ( 0, 0, width, height );
 
     // Clear the color buffer
     glClear ( GL_COLOR_BUFFER_BIT );
 
 
-    glCullFace ( GL_BACK );
-    glEnable ( GL_CULL_FACE );
+    state_cache_->CullFace ( GL_BACK );
+    state_cache_->Enable ( GL_CULL_FACE );
 
-    // Use the program object
-    glUseProgram ( userData->programObject );
+    // Bind the textures, the probe's reflections replace the specular map once it is complete
+    BindTextures ( probe_ && probe_->Complete () ? probe_->Texture () : userData->textureId );
 
-    // Load the vertex position
-    glVertexAttribPointer ( 0, 3, GL_FLOAT,
-                            GL_FALSE, 0, userData->vertices );
-    // Load the normal
-    glVertexAttribPointer ( 1, 3, GL_FLOAT,
-                            GL_FALSE, 0, userData->normals );
+    GLuint specular = probe_ && probe_->Complete () ? probe_->Texture () : userData->textureId;
 
-    glEnableVertexAttribArray ( 0 );
-    glEnableVertexAttribArray ( 1 );
+    // The uniforms stay with the programs, so they are set now and the batcher only binds
+    if ( sphere_mode_ == kSphereProcedural ) {
+        state_cache_->UseProgram ( userData->proceduralProgram );
+        state_cache_->Uniform1i ( userData->proceduralSamplerLoc, 0 );
+        state_cache_->Uniform1i ( userData->proceduralSlicesLoc, kSphereSlices );
+        glUniform1f ( userData->proceduralRadiusLoc, kSphereRadius );
 
-    // Bind the texture
-    glActiveTexture ( GL_TEXTURE0 );
-    glBindTexture ( GL_TEXTURE_CUBE_MAP, userData->textureId );
+        // No vertex data, the vertex shader builds the sphere from gl_VertexID
+        DrawPacket packet = { DrawBatcher::MakeSortKey ( 1, userData->proceduralProgram,
+                                                         specular, 0, 0.5f ),
+                              0, userData->proceduralProgram, GL_TEXTURE_CUBE_MAP, specular,
+                              0, nullptr, 0, 0, GL_TRIANGLES, 0,
+                              ( kSphereSlices / 2 ) * kSphereSlices * 6 };
+        draw_batcher_->Submit ( packet );
+        return;
+    }
+
+    if ( sphere_mode_ == kSphereInstanced ) {
+        state_cache_->UseProgram ( userData->instancedProgram );
+        state_cache_->Uniform1i ( userData->instancedSamplerLoc, 0 );
+        DrawInstanced ( userData->sphere, instance_count_ );
+        return;
+    }
+
+    // Use the program object
+    state_cache_->UseProgram ( userData->programObject );
 
     // Set the sampler texture unit to 0
-    glUniform1i ( userData->samplerLoc, 0 );
+    state_cache_->Uniform1i ( userData->samplerLoc, 0 );
+
+    int lod = SelectLod ( width, height );
+    if ( lod != current_lod_ ) {
+        current_lod_ = lod;
+        aout << "Sphere lod " << lod << ": " << userData->sphere->lods[lod].numIndices / 3
+             << " triangles" << std::endl;
+    }
+
+    const SphereMesh* mesh = userData->sphere;
+    const ESLodRange &range = mesh->lods[lod];
+    DrawPacket packet = { DrawBatcher::MakeSortKey ( 1, userData->programObject, specular,
+                                                     mesh->vbo, 0.5f ),
+                          0, userData->programObject, GL_TEXTURE_CUBE_MAP, specular, mesh->vbo,
+                          &mesh->format, mesh->ibo, mesh->indexType, mesh->mode,
+                          ( GLuint ) range.firstIndex, range.numIndices };
+    draw_batcher_->Submit ( packet );
+}
+
+int CubemapRender::SelectLod(GLsizei width, GLsizei height) const {
+    const SphereMesh* mesh = UserData_.sphere;
+
+    // The aspect-correct projection maps [-1, 1] to the shorter side, so the radius spans
+    // radius * min(width, height) / 2 pixels
+    float radiusPixels = mesh->key.radius * 0.5f * ( float ) std::min ( width, height );
+
+    for ( size_t lod = 0; lod < mesh->lods.size(); lod++ ) {
+        if ( mesh->lods[lod].maxEdgeLength * radiusPixels <= kLodEdgePixels ) {
+            return ( int ) lod;
+        }
+    }
+    return ( int ) mesh->lods.size() - 1;
+}
+
+void CubemapRender::DrawMesh(const SphereMesh* mesh, int lod) const {
+    const ESLodRange &range = mesh->lods[lod];
+
+    // Load the vertex position and normal from the shared interleaved buffer
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, mesh->vbo );
+    esBindVertexFormat ( &mesh->format, 0, 0, 1, 2 );
+
+    // Strips are separated by 0xFFFF / 0xFFFFFFFF, depending on the index type
+    if ( mesh->mode == GL_TRIANGLE_STRIP ) {
+        state_cache_->Enable ( GL_PRIMITIVE_RESTART_FIXED_INDEX );
+    } else {
+        state_cache_->Disable ( GL_PRIMITIVE_RESTART_FIXED_INDEX );
+    }
 
-    glDrawElements ( GL_TRIANGLES, userData->numIndices,
-                     GL_UNSIGNED_INT, userData->indices );
+    state_cache_->BindBuffer ( GL_ELEMENT_ARRAY_BUFFER, mesh->ibo );
+    glDrawRangeElements ( mesh->mode, 0, range.numVertices - 1, range.numIndices, mesh->indexType,
+                          ( const void * ) ( ( GLintptr ) range.firstIndex *
+                                             esIndexTypeSize ( mesh->indexType ) ) );
+}
+
+void CubemapRender::DrawInstanced(const SphereMesh* mesh, int instanceCount) const {
+    const RenderUserData* userData = &UserData_;
+    const ESLodRange &range = mesh->lods[0];
+
+    // Per-vertex data from the shared sphere buffer
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, mesh->vbo );
+    esBindVertexFormat ( &mesh->format, 0, 0, 1, 2 );
+
+    // Per-instance data, advancing once per sphere instead of once per vertex
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, userData->instanceBuffer );
+    glVertexAttribPointer ( 3, 4, GL_FLOAT, GL_FALSE, sizeof ( SphereInstance ),
+                            ( const void * ) offsetof ( SphereInstance, offsetScale ) );
+    glVertexAttribPointer ( 4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof ( SphereInstance ),
+                            ( const void * ) offsetof ( SphereInstance, tint ) );
+    glEnableVertexAttribArray ( 3 );
+    glEnableVertexAttribArray ( 4 );
+    glVertexAttribDivisor ( 3, 1 );
+    glVertexAttribDivisor ( 4, 1 );
+
+    if ( mesh->mode == GL_TRIANGLE_STRIP ) {
+        state_cache_->Enable ( GL_PRIMITIVE_RESTART_FIXED_INDEX );
+    } else {
+        state_cache_->Disable ( GL_PRIMITIVE_RESTART_FIXED_INDEX );
+    }
+
+    state_cache_->BindBuffer ( GL_ELEMENT_ARRAY_BUFFER, mesh->ibo );
+    glDrawElementsInstanced ( mesh->mode, range.numIndices, mesh->indexType,
+                              ( const void * ) ( ( GLintptr ) range.firstIndex *
+                                                 esIndexTypeSize ( mesh->indexType ) ),
+                              std::min ( instanceCount, userData->instanceBufferCount ) );
+
+    // The other paths read 3 and 4 as constant generic attributes
+    glVertexAttribDivisor ( 3, 0 );
+    glVertexAttribDivisor ( 4, 0 );
+    glDisableVertexAttribArray ( 3 );
+    glDisableVertexAttribArray ( 4 );
+}
+
+void CubemapRender::UploadInstances(int instanceCount) {
+    RenderUserData* userData = &UserData_;
+    std::vector<SphereInstance> instances = LayoutSphereInstances ( instanceCount );
+
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, userData->instanceBuffer );
+    glBufferData ( GL_ARRAY_BUFFER, instances.size() * sizeof ( SphereInstance ),
+                   instances.data(), GL_STATIC_DRAW );
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, 0 );
+    userData->instanceBufferCount = instanceCount;
+}
+
+void CubemapRender::SetInstanceCount(int instance_count) {
+    instance_count_ = instance_count;
+    if ( UserData_.instanceBuffer ) {
+        UploadInstances ( instance_count_ );
+    }
+    if ( probe_ ) {
+        probe_->Invalidate ();
+    }
+}
+
+void CubemapRender::DrawProcedural(int numSlices) const {
+    // Nothing is fetched; make sure no stale array is left enabled
+    glDisableVertexAttribArray ( 0 );
+    glDisableVertexAttribArray ( 1 );
+    glDisableVertexAttribArray ( 2 );
+    state_cache_->BindBuffer ( GL_ARRAY_BUFFER, 0 );
+
+    glDrawArrays ( GL_TRIANGLES, 0, ( numSlices / 2 ) * numSlices * 6 );
+}
+
+void CubemapRender::RunBenchmarks(GLsizei width, GLsizei height) {
+    const RenderUserData* userData = &UserData_;
+    const int sliceCounts[] = { 20, 64, 128, 256 };
+    const int iterations = 100;
+
+    // Leaves texture and viewport bound for the draws below
+    Draw ( width, height );
+    draw_batcher_->Flush ( state_cache_ );
+
+    for ( int numSlices : sliceCounts ) {
+        SphereMeshKey listKey = { kSphereShapeUV, numSlices, kSphereRadius,
+                                  ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10, ES_TEXCOORD_NONE,
+                                  ES_INDEX_OPTIMIZE_VERTEX_CACHE };
+        SphereMeshKey stripKey = listKey;
+        stripKey.indexFlags = ES_INDEX_TRIANGLE_STRIP;
+
+        const SphereMesh* list = mesh_cache_->Acquire ( listKey );
+        const SphereMesh* strip = mesh_cache_->Acquire ( stripKey );
+
+        state_cache_->UseProgram ( userData->programObject );
+        state_cache_->Uniform1i ( userData->samplerLoc, 0 );
+        DrawBenchResult listResult = BenchmarkDraws ( [&] { DrawMesh ( list, 0 ); }, iterations );
+        DrawBenchResult stripResult = BenchmarkDraws ( [&] { DrawMesh ( strip, 0 ); }, iterations );
+
+        state_cache_->UseProgram ( userData->proceduralProgram );
+        state_cache_->Uniform1i ( userData->proceduralSamplerLoc, 0 );
+        state_cache_->Uniform1i ( userData->proceduralSlicesLoc, numSlices );
+        glUniform1f ( userData->proceduralRadiusLoc, kSphereRadius );
+        DrawBenchResult proceduralResult = BenchmarkDraws ( [&] { DrawProcedural ( numSlices ); },
+                                                            iterations );
+
+        aout << "Sphere " << numSlices << " slices: list " << list->numIndices << " indices "
+             << listResult.cpuSubmitMs << " ms cpu / " << listResult.gpuMs << " ms gpu, strip "
+             << strip->numIndices << " indices " << stripResult.cpuSubmitMs << " ms cpu / "
+             << stripResult.gpuMs << " ms gpu, procedural " << proceduralResult.cpuSubmitMs
+             << " ms cpu / " << proceduralResult.gpuMs << " ms gpu"
+             << (listResult.gpuTimerQuery ? "" : " (gpu = glFinish wall time)") << std::endl;
+
+        mesh_cache_->Release ( list );
+        mesh_cache_->Release ( strip );
+    }
+
+    // Same dense sphere in every vertex format, so only the fetch cost differs
+    struct {
+        const char *name;
+        int position;
+        int normal;
+        int texCoord;
+    } formats[] = {
+            { "float pos/nrm", ES_POSITION_FLOAT, ES_NORMAL_FLOAT, ES_TEXCOORD_NONE },
+            { "float pos/nrm/uv", ES_POSITION_FLOAT, ES_NORMAL_FLOAT, ES_TEXCOORD_FLOAT },
+            { "half pos, 2_10_10_10 nrm", ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10,
+              ES_TEXCOORD_NONE },
+            { "half pos, 2_10_10_10 nrm, unorm16 uv", ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10,
+              ES_TEXCOORD_UNORM16 },
+    };
+    const int formatSlices = 256;
+
+    state_cache_->UseProgram ( userData->programObject );
+    state_cache_->Uniform1i ( userData->samplerLoc, 0 );
+    for ( const auto &format : formats ) {
+        SphereMeshKey key = { kSphereShapeUV, formatSlices, kSphereRadius, format.position,
+                              format.normal, format.texCoord, ES_INDEX_OPTIMIZE_VERTEX_CACHE };
+        const SphereMesh* mesh = mesh_cache_->Acquire ( key );
+
+        DrawBenchResult result = BenchmarkDraws ( [&] { DrawMesh ( mesh, 0 ); }, iterations );
+
+        // Counts one fetch per index, an upper bound since cache hits skip the fetch
+        double vertices = ( double ) mesh->numIndices;
+        double bytes = vertices * mesh->format.stride;
+        aout << "Vertex format " << format.name << ": " << mesh->format.stride
+             << " bytes/vertex, " << mesh->numVertices * ( size_t ) mesh->format.stride
+             << " bytes/mesh, " << result.gpuMs << " ms gpu, "
+             << vertices / ( result.gpuMs * 1.0e3 ) << " Mverts/s, "
+             << bytes / ( result.gpuMs * 1.0e3 ) << " MB/s fetched"
+             << (result.gpuTimerQuery ? "" : " (gpu = glFinish wall time)") << std::endl;
+
+        mesh_cache_->Release ( mesh );
+    }
+
+    // One instanced call against one draw per sphere with the instance data as constant
+    // attributes, same mesh and shader
+    const int instanceCounts[] = { 1, 64, 1024, 4096, 16384 };
+    SphereMeshKey instanceKey = { kSphereShapeUV, kSphereSlices, kSphereRadius,
+                                  ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10, ES_TEXCOORD_NONE,
+                                  ES_INDEX_OPTIMIZE_VERTEX_CACHE };
+    const SphereMesh* instanceMesh = mesh_cache_->Acquire ( instanceKey );
+
+    state_cache_->UseProgram ( userData->instancedProgram );
+    state_cache_->Uniform1i ( userData->instancedSamplerLoc, 0 );
+    for ( int instanceCount : instanceCounts ) {
+        std::vector<SphereInstance> instances = LayoutSphereInstances ( instanceCount );
+        UploadInstances ( instanceCount );
+
+        DrawBenchResult instancedResult = BenchmarkDraws (
+                [&] { DrawInstanced ( instanceMesh, instanceCount ); }, 10 );
+        DrawBenchResult separateResult = BenchmarkDraws ( [&] {
+            for ( const SphereInstance &instance : instances ) {
+                glVertexAttrib4fv ( 3, instance.offsetScale );
+                glVertexAttrib4f ( 4, instance.tint[0] / 255.0f, instance.tint[1] / 255.0f,
+                                   instance.tint[2] / 255.0f, instance.tint[3] / 255.0f );
+                DrawMesh ( instanceMesh, 0 );
+            }
+        }, 10 );
+
+        aout << "Instances " << instanceCount << ": instanced "
+             << instanceCount / instancedResult.gpuMs << " instances/ms gpu, "
+             << instancedResult.cpuSubmitMs << " ms cpu, separate draws "
+             << instanceCount / separateResult.gpuMs << " instances/ms gpu, "
+             << separateResult.cpuSubmitMs << " ms cpu"
+             << (instancedResult.gpuTimerQuery ? "" : " (gpu = glFinish wall time)")
+             << std::endl;
+    }
+
+    UploadInstances ( instance_count_ );
+    mesh_cache_->Release ( instanceMesh );
+
+    // Mutable textures carrying their own filtering against immutable storage read through the
+    // shared sampler. Every draw binds the next texture, so the driver has to validate it again.
+    const int textureCount = 16;
+    const GLsizei textureSize = 64;
+    const GLsizei textureLevels = TextureFactory::FullMipLevels ( textureSize, textureSize );
+    std::vector<GLubyte> pixels ( textureSize * textureSize * 4, 128 );
+    GLuint mutableTextures[textureCount];
+    GLuint immutableTextures[textureCount];
+    size_t factoryBytes = texture_factory_->Bytes ();
+
+    auto start = std::chrono::steady_clock::now ();
+    glGenTextures ( textureCount, mutableTextures );
+    for ( GLuint texture : mutableTextures ) {
+        state_cache_->BindTexture ( GL_TEXTURE_CUBE_MAP, texture );
+        for ( int face = 0; face < 6; face++ ) {
+            for ( GLsizei level = 0; level < textureLevels; level++ ) {
+                GLsizei size = std::max ( 1, textureSize >> level );
+                glTexImage2D ( GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA8, size, size,
+                               0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data () );
+            }
+        }
+        glTexParameteri ( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexParameteri ( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri ( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri ( GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    }
+    glFinish ();
+    double mutableCreateMs = std::chrono::duration<double, std::milli> (
+            std::chrono::steady_clock::now () - start ).count ();
+
+    start = std::chrono::steady_clock::now ();
+    for ( GLuint &texture : immutableTextures ) {
+        TextureDesc desc = { GL_TEXTURE_CUBE_MAP, GL_RGBA8, textureSize, textureSize, 1, 0 };
+        texture = texture_factory_->Create ( desc );
+        for ( int face = 0; face < 6; face++ ) {
+            for ( GLsizei level = 0; level < textureLevels; level++ ) {
+                GLsizei size = std::max ( 1, textureSize >> level );
+                glTexSubImage2D ( GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size,
+                                  GL_RGBA, GL_UNSIGNED_BYTE, pixels.data () );
+            }
+        }
+    }
+    glFinish ();
+    double immutableCreateMs = std::chrono::duration<double, std::milli> (
+            std::chrono::steady_clock::now () - start ).count ();
+    factoryBytes = texture_factory_->Bytes () - factoryBytes;
+
+    // A mesh of its own, the procedural mode has no userData->sphere
+    SphereMeshKey textureKey = { kSphereShapeUV, kSphereSlices, kSphereRadius,
+                                 ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10, ES_TEXCOORD_NONE,
+                                 ES_INDEX_OPTIMIZE_VERTEX_CACHE };
+    const SphereMesh* textureMesh = mesh_cache_->Acquire ( textureKey );
+
+    state_cache_->UseProgram ( userData->programObject );
+    state_cache_->Uniform1i ( userData->samplerLoc, 0 );
+
+    // Without a sampler bound the texture's own parameters apply
+    state_cache_->BindSampler ( 0, 0 );
+    DrawBenchResult mutableResult = BenchmarkDraws ( [&] {
+        for ( GLuint texture : mutableTextures ) {
+            state_cache_->BindTexture ( GL_TEXTURE_CUBE_MAP, texture );
+            DrawMesh ( textureMesh, 0 );
+        }
+    }, iterations );
+
+    state_cache_->BindSampler ( 0, userData->samplerId );
+    DrawBenchResult immutableResult = BenchmarkDraws ( [&] {
+        for ( GLuint texture : immutableTextures ) {
+            state_cache_->BindTexture ( GL_TEXTURE_CUBE_MAP, texture );
+            DrawMesh ( textureMesh, 0 );
+        }
+    }, iterations );
+    mesh_cache_->Release ( textureMesh );
+
+    aout << "Textures, " << textureCount << " cubemaps of " << textureSize << "x" << textureSize
+         << ": mutable created in " << mutableCreateMs << " ms, " << mutableResult.cpuSubmitMs
+         << " ms cpu / " << mutableResult.gpuMs << " ms gpu per pass, immutable created in "
+         << immutableCreateMs << " ms, " << immutableResult.cpuSubmitMs << " ms cpu / "
+         << immutableResult.gpuMs << " ms gpu per pass, " << factoryBytes
+         << " bytes of storage, " << sampler_pool_->Samplers () << " samplers for "
+         << sampler_pool_->Requests () << " requests"
+         << (immutableResult.gpuTimerQuery ? "" : " (gpu = glFinish wall time)") << std::endl;
+
+    state_cache_->DeleteTextures ( textureCount, mutableTextures );
+    for ( GLuint &texture : immutableTextures ) {
+        texture_factory_->Destroy ( &texture );
+    }
+    state_cache_->BindTexture ( GL_TEXTURE_CUBE_MAP, userData->textureId );
 }
 
 Renderer::~Renderer() {
+    // GL objects have to go while the context is still current
+    delete cubemap_ktx_;
+    cubemap_ktx_ = nullptr;
+
+    // A worker waiting for a staging buffer is released before the loader joins it
+    if (upload_queue_) {
+        upload_queue_->Shutdown();
+    }
+    delete cubemap_loader_;
+    cubemap_loader_ = nullptr;
+
+    delete upload_queue_;
+    upload_queue_ = nullptr;
+
+    delete env_prefilter_;
+    env_prefilter_ = nullptr;
+
+    delete cubemap_render_;
+    cubemap_render_ = nullptr;
+
+    delete draw_batcher_;
+    draw_batcher_ = nullptr;
+
+    delete cubemap_probe_;
+    cubemap_probe_ = nullptr;
+
+    delete mesh_cache_;
+    mesh_cache_ = nullptr;
+
+    delete program_batch_;
+    program_batch_ = nullptr;
+
+    delete shader_variants_;
+    shader_variants_ = nullptr;
+
+    delete texture_factory_;
+    texture_factory_ = nullptr;
+
+    delete sampler_pool_;
+    sampler_pool_ = nullptr;
+
+    delete program_cache_;
+    program_cache_ = nullptr;
+
+    delete frame_constants_buffer_;
+    frame_constants_buffer_ = nullptr;
+
+    delete state_cache_;
+    state_cache_ = nullptr;
+
     if (display_ != EGL_NO_DISPLAY) {
         eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
         if (context_ != EGL_NO_CONTEXT) {
@@ -191,9 +808,6 @@ Renderer::~Renderer() {
         eglTerminate(display_);
         display_ = EGL_NO_DISPLAY;
     }
-
-    delete cubemap_render_;
-    cubemap_render_ = nullptr;
 }
 
 void Renderer::render() {
@@ -202,24 +816,121 @@ void Renderer::render() {
     // changed.
     updateRenderArea();
 
+    // Streamed uploads make progress even while the programs are still compiling
+    upload_queue_->Process();
+
+    // Nothing to draw until the programs are linked, keep presenting the clear color
+    if (!finishPrograms()) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        auto swapResult = eglSwapBuffers(display_, surface_);
+        assert(swapResult == EGL_TRUE);
+        return;
+    }
+
+    // The compressed cubemap needs no decoding, its maps replace the 1x1 one on the first
+    // frame. With cached maps it is not even uploaded
+    if (cubemap_ktx_) {
+        auto start = std::chrono::steady_clock::now();
+        unsigned long long key = cubemap_ktx_->ContentHash();
+        GLuint texture = loadEnvironment(key) ? 0 : cubemap_ktx_->Upload(texture_factory_);
+        if (texture) {
+            aout << "KtxTexture: " << cubemap_ktx_->Width() << "x" << cubemap_ktx_->Height()
+                 << ", " << cubemap_ktx_->Levels() << " levels, "
+                 << cubemap_ktx_->CompressedBytes() << " bytes instead of "
+                 << cubemap_ktx_->UncompressedBytes() << " as RGBA8, uploaded in "
+                 << std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start).count()
+                 << " ms" << std::endl;
+            filterEnvironment(texture, cubemap_ktx_->Width(), key);
+        }
+        delete cubemap_ktx_;
+        cubemap_ktx_ = nullptr;
+    }
+
+    // Swap in the asset cubemap once the worker has decoded it, until then the 1x1 one is used
+    if (cubemap_loader_) {
+        GLuint texture = cubemap_loader_->Poll();
+        if (texture) {
+            aout << "TextureUploadQueue: " << upload_queue_->Uploads() << " uploads, "
+                 << upload_queue_->BytesUploaded() << " bytes, at most "
+                 << upload_queue_->MaxFrameBytes() << " in one frame, latency "
+                 << upload_queue_->MeanLatencyMs() << " ms mean, "
+                 << upload_queue_->MaxLatencyMs() << " ms max, "
+                 << upload_queue_->ThroughputMBps() << " MB/s" << std::endl;
+            unsigned long long key = cubemap_loader_->ContentHash();
+            if (loadEnvironment(key)) {
+                state_cache_->DeleteTextures(1, &texture);
+            } else {
+                filterEnvironment(texture, cubemap_loader_->Size(), key);
+            }
+            delete cubemap_loader_;
+            cubemap_loader_ = nullptr;
+        } else if (cubemap_loader_->Failed()) {
+            delete cubemap_loader_;
+            cubemap_loader_ = nullptr;
+        }
+    }
+
     // When the renderable area changes, the projection matrix has to also be updated. This is true
     // even if you change from the sample orthographic projection matrix as your aspect ratio has
     // likely changed.
     if (shaderNeedsNewProjectionMatrix_) {
+        SetAspectOrtho(frameConstants_.projection, width_, height_);
+        frameConstants_.viewport[2] = (GLfloat) width_;
+        frameConstants_.viewport[3] = (GLfloat) height_;
         shaderNeedsNewProjectionMatrix_ = false;
     }
 
-    // clear the color buffer
-    glClear(GL_COLOR_BUFFER_BIT);
+    // The probe binds constants of its own for each face, so it goes before the frame's
+    cubemap_probe_->Update([this] { cubemap_render_->DrawProbeScene(); });
+    if (cubemap_probe_->WindowFrames() >= kProbeReportFrames) {
+        cubemap_probe_->LogStats();
+    }
 
-    // Render all the models. There's no depth testing in this sample so they're accepted in the
-    // order provided. But the sample EGL setup requests a 24 bit depth buffer so you could
-    // configure it at the end of initRenderer
+    // Global shader inputs go out once per frame, every program reads them from
+    // ES_FRAME_CONSTANTS_BINDING
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime_)
+            .count();
+    frameConstants_.time[1] = seconds - frameConstants_.time[0];
+    frameConstants_.time[0] = seconds;
+    frameConstants_.time[2] += 1.0f;
+    frame_constants_buffer_->Update(frameConstants_);
+
+    // Render all the models. The renderer clears the color buffer itself. There's no depth
+    // testing in this sample so they're accepted in the order provided. But the sample EGL setup
+    // requests a 24 bit depth buffer so you could configure it at the end of initRenderer
     cubemap_render_->Draw(width_, height_);
 
+    // Everything submitted this frame, grouped by state
+    draw_batcher_->Flush(state_cache_);
+    const DrawBatchStats &submitted = draw_batcher_->Submitted();
+    const DrawBatchStats &batched = draw_batcher_->Batched();
+    if (batched.draws != loggedBatchStats_.draws
+        || batched.StateChanges() != loggedBatchStats_.StateChanges()) {
+        aout << "Draw batches: " << submitted.draws << " packets -> " << batched.draws
+             << " draws, " << submitted.StateChanges() << " -> " << batched.StateChanges()
+             << " state changes" << std::endl;
+        loggedBatchStats_ = batched;
+    }
+
+    if (benchmarkRequested_) {
+        benchmarkRequested_ = false;
+        cubemap_render_->RunBenchmarks(width_, height_);
+    }
+
     // Present the rendered image. This is an implicit glFlush.
     auto swapResult = eglSwapBuffers(display_, surface_);
     assert(swapResult == EGL_TRUE);
+
+    // A steady scene makes the same calls every frame, so only log when the counts move
+    state_cache_->EndFrame();
+    const GLStateCounters &counters = state_cache_->LastFrame();
+    if (counters.forwarded != loggedStateCounters_.forwarded
+        || counters.filtered != loggedStateCounters_.filtered) {
+        aout << "GL state calls per frame: " << counters.forwarded << " forwarded, "
+             << counters.filtered << " filtered" << std::endl;
+        loggedStateCounters_ = counters;
+    }
 }
 
 void Renderer::initRenderer() {
@@ -299,11 +1010,104 @@ void Renderer::initRenderer() {
     glClearColor(CORNFLOWER_BLUE);
 
     // enable alpha globally for now, you probably don't want to do this in a game
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    state_cache_ = new GLStateCache();
+    state_cache_->Enable(GL_BLEND);
+    state_cache_->BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    frame_constants_buffer_ = new FrameConstantsBuffer(state_cache_);
+    SetIdentity(frameConstants_.projection);
+    SetIdentity(frameConstants_.view);
+    startTime_ = std::chrono::steady_clock::now();
+
+    program_cache_ = new ProgramCache(app_->activity->internalDataPath
+                                      ? app_->activity->internalDataPath : "");
+
+    texture_factory_ = new TextureFactory(state_cache_);
+    sampler_pool_ = new SamplerPool(state_cache_);
+    upload_queue_ = new TextureUploadQueue(state_cache_, texture_factory_, kUploadBufferSize,
+                                           kUploadBufferCount, kUploadFrameBudget);
+
+    mesh_cache_ = new SphereMeshCache(state_cache_);
+    draw_batcher_ = new DrawBatcher();
+    cubemap_render_ = new CubemapRender(state_cache_, mesh_cache_, texture_factory_,
+                                        sampler_pool_, draw_batcher_,
+                                        CubemapRender::kSphereIcosphere);
+    cubemap_probe_ = new CubemapProbe(state_cache_, texture_factory_, kProbeSize, kProbePosition,
+                                      kProbeSchedule, kProbeFacesPerFrame);
+    cubemap_render_->SetProbe(cubemap_probe_);
+    env_prefilter_ = new EnvironmentPrefilter(state_cache_, texture_factory_, sampler_pool_,
+                                              app_->activity->internalDataPath
+                                              ? app_->activity->internalDataPath : "");
+
+    // Prefer the ETC2 cubemap, it is uploaded from the APK without a copy. The PNG faces are
+    // only decoded, while the programs compile, if it is missing or cannot be sampled
+    cubemap_ktx_ = new KtxTexture(app_->activity->assetManager, "cubemap/cubemap_etc2.ktx2");
+    if (!cubemap_ktx_->Supported()) {
+        aout << "KtxTexture: " << (cubemap_ktx_->Valid() ? "format not supported"
+                                                          : cubemap_ktx_->Error())
+             << ", falling back to the PNG faces" << std::endl;
+        delete cubemap_ktx_;
+        cubemap_ktx_ = nullptr;
+        cubemap_loader_ = new CubemapLoader(app_->activity->assetManager, "cubemap",
+                                            texture_factory_, upload_queue_);
+    }
+
+    // Compiles run while the first frames are presented, see finishPrograms
+    shader_variants_ = new ShaderVariantCache(state_cache_);
+    program_batch_ = new ProgramBatch(program_cache_);
+    cubemap_render_->AddPrograms(shader_variants_);
+    env_prefilter_->AddPrograms(shader_variants_);
+    shader_variants_->Queue(program_batch_);
+    program_batch_->Submit();
+}
+
+bool Renderer::finishPrograms() {
+    if (!program_batch_) {
+        return true;
+    }
+    if (!program_batch_->IsReady()) {
+        return false;
+    }
+
+    program_batch_->Finish();
+    delete program_batch_;
+    program_batch_ = nullptr;
 
-    cubemap_render_ = new CubemapRender();
-    cubemap_render_->Init();
+    if (!cubemap_render_->Init()) {
+        aout << "Renderer init failed" << std::endl;
+    }
+
+    aout << "Programs: " << program_cache_->Hits() << " cached in " << program_cache_->HitMs()
+         << " ms, " << program_cache_->Misses() << " built in " << program_cache_->MissMs()
+         << " ms (" << program_cache_->Rejected() << " rejected)" << std::endl;
+    aout << "Shader variants: " << shader_variants_->Variants() << " built, "
+         << shader_variants_->SharedRequests() << " requests shared" << std::endl;
+    aout << "Textures: " << texture_factory_->Textures() << " immutable, "
+         << texture_factory_->Bytes() << " bytes, " << sampler_pool_->Samplers()
+         << " samplers for " << sampler_pool_->Requests() << " requests" << std::endl;
+    return true;
+}
+
+bool Renderer::loadEnvironment(unsigned long long sourceKey) {
+    GLuint specular = 0;
+    GLuint irradiance = 0;
+    if (!env_prefilter_->Load(sourceKey, &specular, &irradiance)) {
+        return false;
+    }
+    cubemap_render_->SetEnvironment(specular, irradiance);
+    return true;
+}
+
+void Renderer::filterEnvironment(GLuint source, GLsizei sourceSize,
+                                 unsigned long long sourceKey) {
+    GLuint specular = 0;
+    GLuint irradiance = 0;
+    if (env_prefilter_->Prefilter(source, sourceSize, sourceKey, &specular, &irradiance)) {
+        cubemap_render_->SetEnvironment(specular, irradiance);
+        texture_factory_->Destroy(&source);
+    } else {
+        cubemap_render_->SetCubemap(source);
+    }
 }
 
 void Renderer::updateRenderArea() {
@@ -316,7 +1120,7 @@ void Renderer::updateRenderArea() {
     if (width != width_ || height != height_) {
         width_ = width;
         height_ = height;
-        glViewport(0, 0, width, height);
+        state_cache_->Viewport(0, 0, width, height);
 
         // make sure that we lazily recreate the projection matrix before we render
         shaderNeedsNewProjectionMatrix_ = true;
@@ -352,6 +1156,7 @@ void Renderer::handleInput() {
             case AMOTION_EVENT_ACTION_POINTER_DOWN:
                 aout << "(" << pointer.id << ", " << x << ", " << y << ") "
                      << "Pointer Down";
+                benchmarkRequested_ = true;
                 break;
 
             case AMOTION_EVENT_ACTION_CANCEL:
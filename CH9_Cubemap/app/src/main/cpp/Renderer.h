@@ -3,43 +3,195 @@
 
 #include <EGL/egl.h>
 #include <GLES3/gl3.h>
+#include <chrono>
 #include <memory>
 
+#include "FrameConstants.h"
+#include "CubemapLoader.h"
+#include "CubemapProbe.h"
+#include "DrawBatcher.h"
+#include "EnvironmentPrefilter.h"
+#include "KtxTexture.h"
+#include "GLStateCache.h"
+#include "ProgramBatch.h"
+#include "ShaderVariants.h"
+#include "TextureFactory.h"
+#include "TextureUploadQueue.h"
+#include "ProgramCache.h"
+#include "MeshCache.h"
+
 struct android_app;
 
 class CubemapRender {
 public:
-    CubemapRender(): program_object_(0) {}
+    enum SphereMode {
+        // Indexed triangle list, reordered for the post-transform vertex cache
+        kSphereTriangleList,
+        // One triangle strip per ring, separated by the primitive restart index
+        kSphereTriangleStrip,
+        // Subdivided icosahedron / octahedron, level of detail picked from the size on screen
+        kSphereIcosphere,
+        kSphereOctasphere,
+        // No vertex or index buffers, the vertex shader builds the sphere from gl_VertexID
+        kSphereProcedural,
+        // A grid of small triangle list spheres, all drawn by one instanced call
+        kSphereInstanced
+    };
+
+    CubemapRender(GLStateCache* state_cache, SphereMeshCache* mesh_cache,
+                  TextureFactory* texture_factory, SamplerPool* sampler_pool,
+                  DrawBatcher* draw_batcher, SphereMode sphere_mode, int instance_count = 1024):
+            program_object_(0), state_cache_(state_cache), mesh_cache_(mesh_cache),
+            texture_factory_(texture_factory), sampler_pool_(sampler_pool),
+            draw_batcher_(draw_batcher),
+            mesh_variant_(nullptr), procedural_variant_(nullptr), instanced_variant_(nullptr),
+            sphere_mode_(sphere_mode), instance_count_(instance_count), current_lod_(-1),
+            probe_(nullptr), probe_sphere_(nullptr) {
+        UserData_.programObject = 0;
+        UserData_.proceduralProgram = 0;
+        UserData_.instancedProgram = 0;
+        UserData_.instanceBuffer = 0;
+        UserData_.instanceBufferCount = 0;
+        UserData_.textureId = 0;
+        UserData_.irradianceId = 0;
+        UserData_.samplerId = 0;
+        UserData_.sphere = nullptr;
+    }
     virtual ~CubemapRender() {
-        glDeleteProgram(program_object_);
-        program_object_ = 0;
+        state_cache_->DeleteBuffers(1, &UserData_.instanceBuffer);
+        texture_factory_->Destroy(&UserData_.textureId);
+        texture_factory_->Destroy(&UserData_.irradianceId);
+        mesh_cache_->Release(UserData_.sphere);
+        UserData_.sphere = nullptr;
+        mesh_cache_->Release(probe_sphere_);
+        probe_sphere_ = nullptr;
     }
 
+    /*!
+     * Requests the program variants of the renderer, owned by variants. Init must wait until
+     * they are built.
+     */
+    void AddPrograms(ShaderVariantCache* variants);
     bool Init();
+
+    ///
+    // Clear and submit the sphere to the draw batcher, the caller flushes it. Instanced spheres
+    // carry per-instance attributes a packet cannot describe, so they are drawn right away.
     void Draw(GLsizei width, GLsizei height) const;
 
+    ///
+    // Number of spheres drawn in kSphereInstanced mode. Rebuilds the instance buffer, so the
+    // context must be current once Init has run.
+    void SetInstanceCount(int instance_count);
+    int GetInstanceCount() const { return instance_count_; }
+
+    ///
+    // Replace the 1x1 placeholder cubemap, takes ownership of texture. Without an irradiance
+    // map the diffuse term reads the same cubemap.
+    void SetCubemap(GLuint texture);
+
+    ///
+    // Replace the cubemaps with prefiltered ones from EnvironmentPrefilter, takes ownership of
+    // both
+    void SetEnvironment(GLuint specular, GLuint irradiance);
+
+    ///
+    // Reflect what probe captures instead of the specular map once all of its faces are drawn.
+    // The probe is not owned, it is invalidated whenever the scene it sees changes.
+    void SetProbe(CubemapProbe* probe);
+
+    ///
+    // Draw what the probe sees: the instanced sphere field, reflecting the environment maps.
+    // Called back by CubemapProbe::Update with its framebuffer and constants bound
+    void DrawProbeScene() const;
+
+    ///
+    // Time list vs strip vs procedural submission over several tessellations, mutable against
+    // immutable textures, and log the results
+    void RunBenchmarks(GLsizei width, GLsizei height);
+
 private:
+    ///
+    // Issue the draw call for one level of a cached sphere, program and texture must already
+    // be bound
+    void DrawMesh(const SphereMesh* mesh, int lod) const;
+
+    ///
+    // Issue the attribute-less draw call of a numSlices UV sphere, the procedural program must
+    // already be bound
+    void DrawProcedural(int numSlices) const;
+
+    ///
+    // Issue one instanced draw of instanceCount copies of the first level of mesh, the
+    // instanced program must already be bound
+    void DrawInstanced(const SphereMesh* mesh, int instanceCount) const;
+
+    ///
+    // Lay instanceCount spheres out on a square grid covering the viewport and upload their
+    // transforms and tints into the instance buffer
+    void UploadInstances(int instanceCount);
+
+    ///
+    // Bind specular and the irradiance map with the shared sampler to units 0 and 1
+    void BindTextures(GLuint specular) const;
+
+    ///
+    // Pick the coarsest level of the sphere whose edges are still short on screen
+    int SelectLod(GLsizei width, GLsizei height) const;
+
     ///
     // Create a simple cubemap with a 1x1 face with a different color for each face
     // return texture id
     GLuint CreateSimpleTextureCubemap();
 
     GLuint program_object_;
+    GLStateCache* state_cache_;
+    SphereMeshCache* mesh_cache_;
+    TextureFactory* texture_factory_;
+    SamplerPool* sampler_pool_;
+    DrawBatcher* draw_batcher_;
+
+    // Programs of the three sphere paths, filled in by the ShaderVariantCache
+    const GLuint* mesh_variant_;
+    const GLuint* procedural_variant_;
+    const GLuint* instanced_variant_;
+    SphereMode sphere_mode_;
+    int instance_count_;
+    // Level drawn last frame, only used to log changes
+    mutable int current_lod_;
+    // Dynamic reflections, and the sphere the field inside them is drawn with
+    CubemapProbe* probe_;
+    const SphereMesh* probe_sphere_;
     struct RenderUserData {
         // Handle to a program object
         GLuint programObject;
 
-        // Sampler location
+        // Sampler locations
         GLint samplerLoc;
+        GLint irradianceLoc;
+
+        // Program generating the sphere from gl_VertexID, and its uniforms
+        GLuint proceduralProgram;
+        GLint proceduralSamplerLoc;
+        GLint proceduralIrradianceLoc;
+        GLint proceduralSlicesLoc;
+        GLint proceduralRadiusLoc;
 
-        // Texture handle
+        // Program reading a per-instance transform and tint, and its vertex buffer
+        GLuint instancedProgram;
+        GLint instancedSamplerLoc;
+        GLint instancedIrradianceLoc;
+        GLuint instanceBuffer;
+        // Number of instances currently in instanceBuffer
+        GLsizei instanceBufferCount;
+
+        // Specular and irradiance cubemaps, and the shared sampler both are read through
         GLuint textureId;
+        GLuint irradianceId;
+        GLuint samplerId;
 
-        // Vertex data
-        int      numIndices;
-        GLfloat *vertices;
-        GLfloat *normals;
-        GLuint  *indices;
+        // Vertex data, shared through the mesh cache
+        const SphereMesh *sphere;
     }UserData_;
 };
 
@@ -57,7 +209,25 @@ public:
             width_(0),
             height_(0),
             shaderNeedsNewProjectionMatrix_(true),
-            cubemap_render_(nullptr) {
+            benchmarkRequested_(false),
+            state_cache_(nullptr),
+            loggedStateCounters_(),
+            frame_constants_buffer_(nullptr),
+            frameConstants_(),
+            program_cache_(nullptr),
+            program_batch_(nullptr),
+            shader_variants_(nullptr),
+            texture_factory_(nullptr),
+            sampler_pool_(nullptr),
+            upload_queue_(nullptr),
+            mesh_cache_(nullptr),
+            draw_batcher_(nullptr),
+            loggedBatchStats_(),
+            cubemap_render_(nullptr),
+            env_prefilter_(nullptr),
+            cubemap_probe_(nullptr),
+            cubemap_ktx_(nullptr),
+            cubemap_loader_(nullptr) {
         initRenderer();
     }
 
@@ -88,6 +258,24 @@ private:
      */
     void updateRenderArea();
 
+    /*!
+     * Finishes the program batch and initializes the renderer once the driver is done
+     * compiling. Returns false while it is still busy.
+     */
+    bool finishPrograms();
+
+    /*!
+     * Hands the cached prefiltered maps of the source cubemap with sourceKey to the renderer,
+     * false if there are none.
+     */
+    bool loadEnvironment(unsigned long long sourceKey);
+
+    /*!
+     * Prefilters source, whose base level is sourceSize wide, hands the maps to the renderer and
+     * caches them. Takes ownership of source, which the sphere shows unfiltered if that fails.
+     */
+    void filterEnvironment(GLuint source, GLsizei sourceSize, unsigned long long sourceKey);
+
     android_app* app_;
     EGLDisplay display_;
     EGLSurface surface_;
@@ -97,7 +285,47 @@ private:
 
     bool shaderNeedsNewProjectionMatrix_;
 
+    // Set by a tap, runs the renderer's benchmarks on the next frame
+    bool benchmarkRequested_;
+
+    // All GL state changes of the sample go through here
+    GLStateCache* state_cache_;
+    // Counters of the frame last written to the log
+    GLStateCounters loggedStateCounters_;
+
+    // Projection, view, viewport and time shared by all programs, refreshed every frame
+    FrameConstantsBuffer* frame_constants_buffer_;
+    FrameConstants frameConstants_;
+    std::chrono::steady_clock::time_point startTime_;
+
+    // Program binaries of earlier launches, kept in the app's internal data path
+    ProgramCache* program_cache_;
+    // Programs still compiling, the renderer is initialized once it has finished
+    ProgramBatch* program_batch_;
+    // Every program of the sample, one per distinct permutation
+    ShaderVariantCache* shader_variants_;
+
+    // Immutable storage for every texture, and the samplers they share
+    TextureFactory* texture_factory_;
+    SamplerPool* sampler_pool_;
+    // Spreads texture uploads from worker threads over frames through staging buffers
+    TextureUploadQueue* upload_queue_;
+
+    SphereMeshCache* mesh_cache_;
+    // Draws of the frame, grouped by state and flushed once the renderers have submitted them
+    DrawBatcher* draw_batcher_;
+    // Batched stats of the frame last written to the log
+    DrawBatchStats loggedBatchStats_;
     CubemapRender* cubemap_render_;
+    // Filters the source cubemap into the sphere's specular and irradiance maps, or loads them
+    // from the app's internal data path
+    EnvironmentPrefilter* env_prefilter_;
+    // Captures the instanced sphere field for the sphere's reflections, a few faces per frame
+    CubemapProbe* cubemap_probe_;
+    // ETC2 cubemap mapped from the APK, uploaded once the renderer is initialized
+    KtxTexture* cubemap_ktx_;
+    // Fallback without a usable KTX file, decodes the asset cubemap in the background, gone once it has been handed over
+    CubemapLoader* cubemap_loader_;
 };
 
 #endif //ANDROIDGLINVESTIGATIONS_RENDERER_H
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "ShaderVariants.h"
+
+#include "AndroidOut.h"
+
+namespace {
+
+// 64-bit FNV-1a over the string and its terminator, continued from hash
+unsigned long long HashString(unsigned long long hash, const std::string &text) {
+    for (size_t i = 0; i <= text.size(); i++) {
+        hash ^= (unsigned char) text.c_str()[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+}  // namespace
+
+ShaderVariantCache::ShaderVariantCache(GLStateCache *stateCache)
+        : stateCache_(stateCache), sharedRequests_(0) {}
+
+ShaderVariantCache::~ShaderVariantCache() {
+    for (auto &entry : variants_) {
+        stateCache_->DeletePrograms(1, &entry.second->program);
+    }
+}
+
+std::string ShaderVariantCache::BuildSource(const char *templateSrc,
+                                            const ShaderDefines &defines) {
+    std::string source = "#version 300 es\n";
+    if (defines.find("PRECISION") == defines.end()) {
+        source += "#define PRECISION mediump\n";
+    }
+    for (const auto &define : defines) {
+        source += "#define " + define.first + " " + define.second + "\n";
+    }
+    source += templateSrc;
+    return source;
+}
+
+const GLuint *ShaderVariantCache::Request(const char *vertTemplate, const char *fragTemplate,
+                                          const ShaderDefines &defines) {
+    std::string vertSrc = BuildSource(vertTemplate, defines);
+    std::string fragSrc = BuildSource(fragTemplate, defines);
+    unsigned long long key = HashString(HashString(14695981039346656037ull, vertSrc), fragSrc);
+
+    auto found = variants_.find(key);
+    if (found != variants_.end()) {
+        const Variant &variant = *found->second;
+        if (variant.vertSrc != vertSrc || variant.fragSrc != fragSrc) {
+            // Never seen in practice, but a silent mix-up would be hard to track down
+            aout << "ShaderVariantCache: hash collision on " << std::hex << key << std::dec
+                 << std::endl;
+            return nullptr;
+        }
+        sharedRequests_++;
+        return &found->second->program;
+    }
+
+    std::unique_ptr<Variant> variant(new Variant());
+    variant->vertSrc = vertSrc;
+    variant->fragSrc = fragSrc;
+    variant->program = 0;
+    variant->queued = false;
+    const GLuint *program = &variant->program;
+    variants_[key] = std::move(variant);
+    return program;
+}
+
+int ShaderVariantCache::Queue(ProgramBatch *batch) {
+    int queued = 0;
+    for (auto &entry : variants_) {
+        Variant &variant = *entry.second;
+        if (!variant.queued) {
+            batch->Add(variant.vertSrc.c_str(), variant.fragSrc.c_str(), &variant.program);
+            variant.queued = true;
+            queued++;
+        }
+    }
+    return queued;
+}
@@ -0,0 +1,71 @@
+#ifndef LEARNES3_SHADERVARIANTS_H
+#define LEARNES3_SHADERVARIANTS_H
+
+#include <GLES3/gl3.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "GLStateCache.h"
+#include "ProgramBatch.h"
+
+/*!
+ * Feature defines of one shader variant, name to value. Ordered, so the same set always yields
+ * the same preamble and the same variant.
+ */
+typedef std::map<std::string, std::string> ShaderDefines;
+
+/*!
+ * Builds programs from GLSL templates specialized by defines, e.g. MRT_COUNT, USE_CUBEMAP or
+ * PRECISION.
+ *
+ * A template is shader source without the #version line. Each stage gets a generated preamble
+ * of "#version 300 es" and one #define per entry, PRECISION defaulting to mediump, so templates
+ * select features with #if and declare "precision PRECISION float;".
+ *
+ * Variants are keyed by a hash of the generated sources, so renderers asking for the same
+ * permutation share one program, and only requested permutations are ever compiled. The cache
+ * owns the programs. Must be used and destroyed with the GL context current.
+ */
+class ShaderVariantCache {
+public:
+    explicit ShaderVariantCache(GLStateCache *stateCache);
+    virtual ~ShaderVariantCache();
+
+    /*!
+     * Returns the generated source of one stage.
+     */
+    static std::string BuildSource(const char *templateSrc, const ShaderDefines &defines);
+
+    /*!
+     * Registers the variant and returns where its program will be. The pointer stays valid for
+     * the lifetime of the cache and holds 0 until the batch that built the variant has finished,
+     * or for good if it failed to build.
+     */
+    const GLuint *Request(const char *vertTemplate, const char *fragTemplate,
+                          const ShaderDefines &defines);
+
+    /*!
+     * Adds every variant that has not been built yet to batch. Returns how many were added.
+     */
+    int Queue(ProgramBatch *batch);
+
+    // Distinct variants, and Request calls that were answered with an existing one
+    int Variants() const { return (int) variants_.size(); }
+    int SharedRequests() const { return sharedRequests_; }
+
+private:
+    struct Variant {
+        std::string vertSrc;
+        std::string fragSrc;
+        GLuint program;
+        bool queued;
+    };
+
+    GLStateCache *stateCache_;
+    std::unordered_map<unsigned long long, std::unique_ptr<Variant>> variants_;
+    int sharedRequests_;
+};
+
+#endif //LEARNES3_SHADERVARIANTS_H
@@ -0,0 +1,231 @@
+#include "TextureFactory.h"
+
+#include <GLES2/gl2ext.h>
+
+#include <algorithm>
+#include <tuple>
+
+#ifdef ANDROID
+#include "AndroidOut.h"
+#else
+// The host tools in bench/ link this without the NDK
+#include <iostream>
+#define aout std::cerr
+#endif
+
+namespace {
+
+// Block footprints in the order of the GL ASTC enums
+const int kAstcBlocks[14][2] = {
+        { 4, 4 }, { 5, 4 }, { 5, 5 }, { 6, 5 }, { 6, 6 }, { 8, 5 }, { 8, 6 }, { 8, 8 },
+        { 10, 5 }, { 10, 6 }, { 10, 8 }, { 10, 10 }, { 12, 10 }, { 12, 12 } };
+
+}  // namespace
+
+bool SamplerDesc::operator<(const SamplerDesc &other) const {
+    return std::tie(minFilter, magFilter, wrapS, wrapT, wrapR)
+           < std::tie(other.minFilter, other.magFilter, other.wrapS, other.wrapT, other.wrapR);
+}
+
+SamplerDesc MakeSamplerDesc(GLenum minFilter, GLenum magFilter, GLenum wrap) {
+    SamplerDesc desc = { minFilter, magFilter, wrap, wrap, wrap };
+    return desc;
+}
+
+SamplerPool::SamplerPool(GLStateCache *stateCache) : stateCache_(stateCache), requests_(0) {}
+
+SamplerPool::~SamplerPool() {
+    for (auto &entry : samplers_) {
+        stateCache_->DeleteSamplers(1, &entry.second);
+    }
+}
+
+GLuint SamplerPool::Get(const SamplerDesc &desc) {
+    requests_++;
+    auto found = samplers_.find(desc);
+    if (found != samplers_.end()) {
+        return found->second;
+    }
+
+    GLuint sampler = 0;
+    glGenSamplers(1, &sampler);
+    glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, (GLint) desc.minFilter);
+    glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, (GLint) desc.magFilter);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, (GLint) desc.wrapS);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, (GLint) desc.wrapT);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_R, (GLint) desc.wrapR);
+    samplers_[desc] = sampler;
+    return sampler;
+}
+
+void SamplerPool::Bind(GLuint unit, const SamplerDesc &desc) {
+    stateCache_->BindSampler(unit, Get(desc));
+}
+
+TextureFactory::TextureFactory(GLStateCache *stateCache)
+        : stateCache_(stateCache), totalBytes_(0) {}
+
+TextureFactory::~TextureFactory() {
+    for (auto &entry : bytes_) {
+        stateCache_->DeleteTextures(1, &entry.first);
+    }
+}
+
+GLuint TextureFactory::Create(const TextureDesc &desc) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    if (!CreateStorage(texture, desc)) {
+        stateCache_->DeleteTextures(1, &texture);
+        return 0;
+    }
+    return texture;
+}
+
+bool TextureFactory::CreateStorage(GLuint texture, const TextureDesc &desc) {
+    bool volume = desc.target == GL_TEXTURE_3D || desc.target == GL_TEXTURE_2D_ARRAY;
+    GLsizei depth = volume ? desc.depth : 1;
+    GLsizei maxLevels = FullMipLevels(desc.width, desc.height,
+                                      desc.target == GL_TEXTURE_3D ? depth : 1);
+    GLsizei levels = desc.levels > 0 ? desc.levels : maxLevels;
+    if (desc.width <= 0 || desc.height <= 0 || depth <= 0 || levels > maxLevels
+        || (desc.target == GL_TEXTURE_CUBE_MAP && desc.width != desc.height)) {
+        aout << "TextureFactory: " << desc.width << "x" << desc.height << "x" << depth
+             << " with " << levels << " levels is not a valid texture" << std::endl;
+        return false;
+    }
+
+    stateCache_->BindTexture(desc.target, texture);
+    if (volume) {
+        glTexStorage3D(desc.target, levels, desc.internalFormat, desc.width, desc.height, depth);
+    } else {
+        glTexStorage2D(desc.target, levels, desc.internalFormat, desc.width, desc.height);
+    }
+
+    TextureDesc exact = desc;
+    exact.depth = depth;
+    exact.levels = levels;
+    size_t bytes = StorageBytes(exact);
+    bytes_[texture] = bytes;
+    totalBytes_ += bytes;
+    return true;
+}
+
+void TextureFactory::Destroy(GLuint *texture) {
+    auto found = bytes_.find(*texture);
+    if (found != bytes_.end()) {
+        totalBytes_ -= found->second;
+        bytes_.erase(found);
+    }
+    stateCache_->DeleteTextures(1, texture);
+    *texture = 0;
+}
+
+GLsizei TextureFactory::FullMipLevels(GLsizei width, GLsizei height, GLsizei depth) {
+    GLsizei largest = std::max(width, std::max(height, depth));
+    GLsizei levels = 1;
+    while (largest > 1) {
+        largest >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+size_t TextureFactory::StorageBytes(const TextureDesc &desc) {
+    // Uncompressed formats are 1x1 blocks of a texel
+    int blockWidth = 1, blockHeight = 1, blockBytes = (int) TexelBytes(desc.internalFormat);
+    BlockInfo(desc.internalFormat, &blockWidth, &blockHeight, &blockBytes);
+    size_t bytes = 0;
+    for (GLsizei level = 0; level < desc.levels; level++) {
+        size_t width = (size_t) std::max(1, desc.width >> level);
+        size_t height = (size_t) std::max(1, desc.height >> level);
+        size_t layers = 1;
+        if (desc.target == GL_TEXTURE_CUBE_MAP) {
+            layers = 6;
+        } else if (desc.target == GL_TEXTURE_2D_ARRAY) {
+            layers = (size_t) desc.depth;
+        } else if (desc.target == GL_TEXTURE_3D) {
+            layers = (size_t) std::max(1, desc.depth >> level);
+        }
+        bytes += (width + blockWidth - 1) / blockWidth * ((height + blockHeight - 1) / blockHeight)
+                 * layers * blockBytes;
+    }
+    return bytes;
+}
+
+bool TextureFactory::BlockInfo(GLenum internalFormat, int *blockWidth, int *blockHeight,
+                               int *blockBytes) {
+    switch (internalFormat) {
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+        case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+        case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+        case GL_COMPRESSED_R11_EAC:
+        case GL_COMPRESSED_SIGNED_R11_EAC:
+            *blockWidth = 4;
+            *blockHeight = 4;
+            *blockBytes = 8;
+            return true;
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+        case GL_COMPRESSED_RG11_EAC:
+        case GL_COMPRESSED_SIGNED_RG11_EAC:
+            *blockWidth = 4;
+            *blockHeight = 4;
+            *blockBytes = 16;
+            return true;
+        default:
+            break;
+    }
+
+    // Every ASTC block is 128 bits, only the footprint changes
+    int index = -1;
+    if (internalFormat >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+        && internalFormat <= GL_COMPRESSED_RGBA_ASTC_12x12_KHR) {
+        index = (int) (internalFormat - GL_COMPRESSED_RGBA_ASTC_4x4_KHR);
+    } else if (internalFormat >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR
+               && internalFormat <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR) {
+        index = (int) (internalFormat - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR);
+    }
+    if (index < 0) {
+        return false;
+    }
+    *blockWidth = kAstcBlocks[index][0];
+    *blockHeight = kAstcBlocks[index][1];
+    *blockBytes = 16;
+    return true;
+}
+
+size_t TextureFactory::TexelBytes(GLenum internalFormat) {
+    switch (internalFormat) {
+        case GL_R8:
+            return 1;
+        case GL_RG8:
+        case GL_RGB565:
+        case GL_RGBA4:
+        case GL_RGB5_A1:
+        case GL_R16F:
+        case GL_DEPTH_COMPONENT16:
+            return 2;
+        case GL_RGB8:
+        case GL_SRGB8:
+            return 3;
+        case GL_RGBA8:
+        case GL_SRGB8_ALPHA8:
+        case GL_RGB10_A2:
+        case GL_RG16F:
+        case GL_R32F:
+        case GL_R11F_G11F_B10F:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH24_STENCIL8:
+        case GL_DEPTH_COMPONENT32F:
+            return 4;
+        case GL_RGBA16F:
+        case GL_RG32F:
+        case GL_DEPTH32F_STENCIL8:
+            return 8;
+        case GL_RGBA32F:
+            return 16;
+        default:
+            return 0;
+    }
+}
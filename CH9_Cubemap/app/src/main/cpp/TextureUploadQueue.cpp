@@ -0,0 +1,251 @@
+#include "TextureUploadQueue.h"
+
+#include <algorithm>
+
+#include "AndroidOut.h"
+
+TextureUploadQueue::TextureUploadQueue(GLStateCache *stateCache, TextureFactory *textureFactory,
+                                       size_t bufferSize, int bufferCount, size_t frameBudget)
+        : stateCache_(stateCache),
+          textureFactory_(textureFactory),
+          bufferSize_(bufferSize),
+          frameBudget_(frameBudget),
+          staging_(bufferCount),
+          nextTicket_(0),
+          issuedTicket_(0),
+          shutdown_(false),
+          uploads_(0),
+          bytesUploaded_(0),
+          bytesRetired_(0),
+          retired_(0),
+          maxFrameBytes_(0),
+          latencyMsTotal_(0.0),
+          latencyMsMax_(0.0),
+          anySubmitted_(false) {
+    for (int slot = 0; slot < bufferCount; slot++) {
+        Staging &staging = staging_[slot];
+        staging.buffer = 0;
+        staging.mapped = nullptr;
+        staging.state = kInFlight;
+        staging.fence = nullptr;
+        staging.bytes = 0;
+        glGenBuffers(1, &staging.buffer);
+        stateCache_->BindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) bufferSize_, nullptr, GL_STREAM_DRAW);
+        if (Map(slot)) {
+            staging.state = kMapped;
+        }
+    }
+}
+
+TextureUploadQueue::~TextureUploadQueue() {
+    Shutdown();
+    for (Staging &staging : staging_) {
+        if (staging.mapped) {
+            stateCache_->BindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (staging.fence) {
+            glDeleteSync(staging.fence);
+        }
+        stateCache_->DeleteBuffers(1, &staging.buffer);
+    }
+    stateCache_->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+uint64_t TextureUploadQueue::Allocate(GLuint texture, const TextureDesc &desc) {
+    Command command = {};
+    command.slot = -1;
+    command.texture = texture;
+    command.desc = desc;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    command.ticket = ++nextTicket_;
+    commands_.push_back(command);
+    return command.ticket;
+}
+
+void *TextureUploadQueue::Acquire(int *slot) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        if (shutdown_) {
+            return nullptr;
+        }
+        for (size_t i = 0; i < staging_.size(); i++) {
+            if (staging_[i].state == kMapped) {
+                staging_[i].state = kFilling;
+                *slot = (int) i;
+                return staging_[i].mapped;
+            }
+        }
+        freeBuffer_.wait(lock);
+    }
+}
+
+uint64_t TextureUploadQueue::Submit(int slot, const std::vector<Region> &regions) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Staging &staging = staging_[slot];
+    if (regions.empty()) {
+        // Still mapped, straight back to the pool
+        staging.state = kMapped;
+        freeBuffer_.notify_one();
+        return issuedTicket_;
+    }
+
+    Command command = {};
+    command.slot = slot;
+    command.regions = regions;
+    command.ticket = ++nextTicket_;
+    staging.state = kSubmitted;
+    staging.bytes = 0;
+    for (const Region &region : regions) {
+        staging.bytes += region.size;
+    }
+    staging.submitTime = Clock::now();
+    commands_.push_back(command);
+    return command.ticket;
+}
+
+bool TextureUploadQueue::Issued(uint64_t ticket) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return issuedTicket_ >= ticket;
+}
+
+void TextureUploadQueue::Shutdown() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+    freeBuffer_.notify_all();
+}
+
+void TextureUploadQueue::Process() {
+    // Recycle buffers the GPU has finished reading, without waiting for any
+    bool recycled = false;
+    for (size_t slot = 0; slot < staging_.size(); slot++) {
+        Staging &staging = staging_[slot];
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (staging.state != kInFlight || !staging.fence) {
+                continue;
+            }
+        }
+        GLenum status = glClientWaitSync(staging.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            continue;
+        }
+        glDeleteSync(staging.fence);
+        staging.fence = nullptr;
+
+        lastRetire_ = Clock::now();
+        double latencyMs = std::chrono::duration<double, std::milli>(
+                lastRetire_ - staging.submitTime).count();
+        latencyMsTotal_ += latencyMs;
+        latencyMsMax_ = std::max(latencyMsMax_, latencyMs);
+        bytesRetired_ += staging.bytes;
+        retired_++;
+
+        if (Map((int) slot)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            staging.state = kMapped;
+            recycled = true;
+        }
+    }
+    if (recycled) {
+        freeBuffer_.notify_all();
+    }
+
+    // Issue in submission order until the budget is used up. Storage costs nothing, the first
+    // buffer of the frame always goes so that one larger than the budget cannot stall the queue
+    size_t frameBytes = 0;
+    for (;;) {
+        Command command;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (commands_.empty()) {
+                break;
+            }
+            const Command &next = commands_.front();
+            if (next.slot >= 0) {
+                size_t bytes = staging_[next.slot].bytes;
+                if (frameBytes > 0 && frameBytes + bytes > frameBudget_) {
+                    break;
+                }
+                frameBytes += bytes;
+                if (!anySubmitted_) {
+                    anySubmitted_ = true;
+                    firstSubmit_ = staging_[next.slot].submitTime;
+                }
+            }
+            command = std::move(commands_.front());
+            commands_.pop_front();
+        }
+
+        if (command.slot < 0) {
+            textureFactory_->CreateStorage(command.texture, command.desc);
+        } else {
+            Issue(command);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        issuedTicket_ = command.ticket;
+    }
+    maxFrameBytes_ = std::max(maxFrameBytes_, frameBytes);
+}
+
+double TextureUploadQueue::ThroughputMBps() const {
+    if (!retired_) {
+        return 0.0;
+    }
+    double seconds = std::chrono::duration<double>(lastRetire_ - firstSubmit_).count();
+    return seconds > 0.0 ? bytesRetired_ / seconds / (1024.0 * 1024.0) : 0.0;
+}
+
+bool TextureUploadQueue::Map(int slot) {
+    Staging &staging = staging_[slot];
+    stateCache_->BindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+    // The fence has signaled, so invalidating the whole buffer never waits on the GPU
+    staging.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) bufferSize_,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    // Client pointer uploads elsewhere must not see a bound unpack buffer
+    stateCache_->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!staging.mapped) {
+        aout << "TextureUploadQueue: glMapBufferRange failed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void TextureUploadQueue::Issue(const Command &command) {
+    Staging &staging = staging_[command.slot];
+    stateCache_->BindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+    // GL_FALSE means the contents were lost while mapped, which only happens on rare events
+    // like a display mode change. The texture is left as it was.
+    GLboolean intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    staging.mapped = nullptr;
+    if (intact) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (const Region &region : command.regions) {
+            stateCache_->BindTexture(BindTarget(region.target), region.texture);
+            // With an unpack buffer bound the pointer is an offset into it
+            glTexSubImage2D(region.target, region.level, 0, 0, region.width, region.height,
+                            region.format, region.type, (const void *) region.offset);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        uploads_ += command.regions.size();
+        bytesUploaded_ += staging.bytes;
+    } else {
+        aout << "TextureUploadQueue: staging buffer lost, " << staging.bytes
+             << " bytes dropped" << std::endl;
+    }
+    stateCache_->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    staging.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    std::lock_guard<std::mutex> lock(mutex_);
+    staging.state = kInFlight;
+}
+
+GLenum TextureUploadQueue::BindTarget(GLenum target) {
+    if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z) {
+        return GL_TEXTURE_CUBE_MAP;
+    }
+    return target;
+}
@@ -0,0 +1,174 @@
+#ifndef LEARNES3_TEXTUREUPLOADQUEUE_H
+#define LEARNES3_TEXTUREUPLOADQUEUE_H
+
+#include <GLES3/gl3.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "GLStateCache.h"
+#include "TextureFactory.h"
+
+/*!
+ * Streams texture data to GL through a pool of GL_PIXEL_UNPACK_BUFFER staging buffers, so that
+ * neither the copy of the pixels nor a large upload lands on a single frame.
+ *
+ * The render thread keeps every free staging buffer mapped. A worker thread takes one with
+ * Acquire, writes pixels through the mapped pointer and hands it back with Submit, together with
+ * the texture regions the bytes belong to. Process, called once per frame on the render thread,
+ * unmaps submitted buffers and issues their glTexSubImage2D calls in submission order until the
+ * frame's byte budget is used up. A fence after each buffer's uploads gates its reuse: it is only
+ * mapped again once the GPU has read it.
+ *
+ * Allocate queues immutable storage for a texture in the same order, so a worker can describe a
+ * texture whose size it only learns while decoding. Everything except the constructor, Process and
+ * the destructor may be called from any thread.
+ */
+class TextureUploadQueue {
+public:
+    /*!
+     * One glTexSubImage2D from a staging buffer.
+     */
+    struct Region {
+        // GL_TEXTURE_2D or a GL_TEXTURE_CUBE_MAP face
+        GLenum target;
+        GLuint texture;
+        GLint level;
+        GLsizei width;
+        GLsizei height;
+        GLenum format;
+        GLenum type;
+        // Of the tightly packed pixels in the staging buffer
+        size_t offset;
+        size_t size;
+    };
+
+    /*!
+     * Creates and maps the staging buffers, needs the GL context current.
+     * @param textureFactory gives storage to the textures of Allocate, must outlive the queue
+     * @param bufferSize bytes of each staging buffer, the largest single Submit
+     * @param bufferCount staging buffers in the pool
+     * @param frameBudget bytes Process issues per frame. One buffer is always issued, even if it
+     *        is larger
+     */
+    TextureUploadQueue(GLStateCache *stateCache, TextureFactory *textureFactory,
+                       size_t bufferSize, int bufferCount, size_t frameBudget);
+
+    /*!
+     * Shuts down and deletes the buffers, with the GL context current. Submitted work that was
+     * not issued yet is dropped.
+     */
+    virtual ~TextureUploadQueue();
+
+    size_t BufferSize() const { return bufferSize_; }
+
+    /*!
+     * Queues TextureFactory::CreateStorage for texture, issued by Process before any later
+     * Submit. Returns a ticket for Issued.
+     */
+    uint64_t Allocate(GLuint texture, const TextureDesc &desc);
+
+    /*!
+     * Blocks until a mapped staging buffer is free and returns its BufferSize() bytes to write
+     * to. Returns nullptr once Shutdown was called.
+     */
+    void *Acquire(int *slot);
+
+    /*!
+     * Hands a buffer filled after Acquire back, to be uploaded into regions. An empty regions
+     * returns the buffer unused. Returns a ticket for Issued.
+     */
+    uint64_t Submit(int slot, const std::vector<Region> &regions);
+
+    /*!
+     * True once Process has issued the uploads of ticket and everything submitted before it.
+     */
+    bool Issued(uint64_t ticket);
+
+    /*!
+     * Wakes and fails every Acquire, now and later. Call before joining workers that may be
+     * waiting in Acquire.
+     */
+    void Shutdown();
+
+    /*!
+     * Once per frame on the render thread: recycles buffers the GPU is done with and issues
+     * queued work up to the frame budget.
+     */
+    void Process();
+
+    // Counters since construction. Latency runs from Submit until the fence after the upload
+    // signaled, as seen by Process, so it includes waiting for the budget and the GPU.
+    uint64_t Uploads() const { return uploads_; }
+    uint64_t BytesUploaded() const { return bytesUploaded_; }
+    size_t MaxFrameBytes() const { return maxFrameBytes_; }
+    double MeanLatencyMs() const { return retired_ ? latencyMsTotal_ / retired_ : 0.0; }
+    double MaxLatencyMs() const { return latencyMsMax_; }
+    // Bytes of retired uploads over the time from the first Submit to the last retirement
+    double ThroughputMBps() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum BufferState { kMapped, kFilling, kSubmitted, kInFlight };
+
+    struct Staging {
+        GLuint buffer;
+        void *mapped;
+        BufferState state;
+        GLsync fence;
+        size_t bytes;
+        Clock::time_point submitTime;
+    };
+
+    // Either the storage of a texture or the uploads of one staging buffer
+    struct Command {
+        int slot;
+        uint64_t ticket;
+        std::vector<Region> regions;
+        GLuint texture;
+        TextureDesc desc;
+    };
+
+    /*!
+     * Maps the buffer of slot for writing, on the render thread.
+     */
+    bool Map(int slot);
+
+    /*!
+     * Unmaps the buffer of a submitted command and issues its uploads, then fences it.
+     */
+    void Issue(const Command &command);
+
+    static GLenum BindTarget(GLenum target);
+
+    GLStateCache *stateCache_;
+    TextureFactory *textureFactory_;
+    size_t bufferSize_;
+    size_t frameBudget_;
+
+    // Guards staging_ states, commands_, nextTicket_, issuedTicket_ and shutdown_
+    std::mutex mutex_;
+    std::condition_variable freeBuffer_;
+    std::vector<Staging> staging_;
+    std::deque<Command> commands_;
+    uint64_t nextTicket_;
+    uint64_t issuedTicket_;
+    bool shutdown_;
+
+    uint64_t uploads_;
+    uint64_t bytesUploaded_;
+    uint64_t bytesRetired_;
+    uint64_t retired_;
+    size_t maxFrameBytes_;
+    double latencyMsTotal_;
+    double latencyMsMax_;
+    bool anySubmitted_;
+    Clock::time_point firstSubmit_;
+    Clock::time_point lastRetire_;
+};
+
+#endif //LEARNES3_TEXTUREUPLOADQUEUE_H
@@ -0,0 +1,124 @@
+//
+// BatchReport.cpp
+//
+//    Host-side report of what DrawBatcher saves on a mixed frame: an MRT pass of
+//    quads followed by triangles and cube-mapped spheres, submitted interleaved
+//    order as independent renderers would. Only DrawBatcher::Plan runs, no GL
+//    context is needed. Build and run from the cpp directory:
+//
+//      g++ -O2 -std=c++17 -I. bench/BatchReport.cpp DrawBatcher.cpp GLStateCache.cpp
+//          LearnES3Geometry.cpp LearnES3VertexFormat.cpp -lGLESv2 -o batch_report
+//      ./batch_report
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "DrawBatcher.h"
+
+namespace {
+
+// Made-up GL names standing in for the objects of the three samples
+const GLuint kMrtFramebuffer = 1;
+const GLuint kMrtProgram = 1, kTriangleProgram = 2, kSphereProgram = 3;
+const GLuint kEnvironmentMaps[2] = { 1, 2 };
+const GLuint kQuadBuffer = 1, kQuadIndices = 2, kTriangleBuffer = 3;
+const GLuint kSphereBuffers[2] = { 4, 6 }, kSphereIndices[2] = { 5, 7 };
+const GLsizei kSphereIndexCounts[2] = { 2160, 480 };
+
+ESVertexFormat gPositionOnly, gSphereFormat;
+
+DrawPacket Packet(unsigned pass, GLuint framebuffer, GLuint program, GLenum textureTarget,
+                  GLuint texture, GLuint vertexBuffer, const ESVertexFormat *format,
+                  GLuint indexBuffer, GLenum indexType, GLuint first, GLsizei count, float depth) {
+    DrawPacket packet = { DrawBatcher::MakeSortKey ( pass, program, texture, vertexBuffer, depth ),
+                          framebuffer, program, textureTarget, texture, vertexBuffer, format,
+                          indexBuffer, indexType, GL_TRIANGLES, first, count };
+    return packet;
+}
+
+// quads MRT quads sharing one index buffer, triangles UI triangles sharing one vertex buffer,
+// spheres spheres over two environment maps and two levels of detail. Each renderer submits
+// its own packets in order, but the three streams are interleaved at random.
+std::vector<DrawPacket> MixedScene(int quads, int triangles, int spheres, std::mt19937 &random) {
+    std::uniform_real_distribution<float> depth ( 0.0f, 1.0f );
+    std::vector<DrawPacket> streams[3];
+
+    for ( int i = 0; i < quads; i++ ) {
+        // Full screen, so there is no depth to sort by
+        streams[0].push_back ( Packet ( 0, kMrtFramebuffer, kMrtProgram, 0, 0, kQuadBuffer,
+                                        &gPositionOnly, kQuadIndices, GL_UNSIGNED_SHORT, i * 6, 6,
+                                        0.0f ) );
+    }
+    for ( int i = 0; i < triangles; i++ ) {
+        // UI elements keep their order, so they all share one depth
+        streams[1].push_back ( Packet ( 1, 0, kTriangleProgram, 0, 0, kTriangleBuffer,
+                                        &gPositionOnly, 0, 0, i * 3, 3, 0.0f ) );
+    }
+    for ( int i = 0; i < spheres; i++ ) {
+        int lod = random() % 2;
+        streams[2].push_back ( Packet ( 1, 0, kSphereProgram, GL_TEXTURE_CUBE_MAP,
+                                        kEnvironmentMaps[random() % 2], kSphereBuffers[lod],
+                                        &gSphereFormat, kSphereIndices[lod], GL_UNSIGNED_SHORT, 0,
+                                        kSphereIndexCounts[lod], depth ( random ) ) );
+    }
+
+    std::vector<DrawPacket> packets;
+    size_t next[3] = {};
+    while ( packets.size() < streams[0].size() + streams[1].size() + streams[2].size() ) {
+        int stream = random() % 3;
+        if ( next[stream] < streams[stream].size() ) {
+            packets.push_back ( streams[stream][next[stream]++] );
+        }
+    }
+    return packets;
+}
+
+} // namespace
+
+int main() {
+    struct {
+        int quads;
+        int triangles;
+        int spheres;
+    } scenes[] = { { 4, 16, 16 }, { 4, 200, 300 }, { 64, 2000, 3000 }, { 256, 20000, 30000 } };
+    const int iterations = 50;
+    std::mt19937 random ( 1234 );
+
+    esInitVertexFormat ( &gPositionOnly, ES_POSITION_FLOAT, ES_NORMAL_NONE, ES_TEXCOORD_NONE );
+    esInitVertexFormat ( &gSphereFormat, ES_POSITION_HALF, ES_NORMAL_INT_2_10_10_10,
+                         ES_TEXCOORD_NONE );
+
+    printf ( "%7s %14s %14s %14s %14s %10s\n", "packets", "draws", "framebuffer", "program",
+             "texture+buffer", "plan" );
+    for ( const auto &scene : scenes ) {
+        std::vector<DrawPacket> packets = MixedScene ( scene.quads, scene.triangles,
+                                                       scene.spheres, random );
+        DrawBatcher batcher;
+
+        auto start = std::chrono::steady_clock::now();
+        for ( int i = 0; i < iterations; i++ ) {
+            batcher.Reset();
+            for ( const DrawPacket &packet : packets ) {
+                batcher.Submit ( packet );
+            }
+            batcher.Plan();
+        }
+        double ms = std::chrono::duration<double, std::milli> (
+                std::chrono::steady_clock::now() - start ).count() / iterations;
+
+        const DrawBatchStats &before = batcher.Submitted();
+        const DrawBatchStats &after = batcher.Batched();
+        printf ( "%7zu %6d -> %-5d %6d -> %-5d %6d -> %-5d %6d -> %-5d %7.3f ms\n",
+                 packets.size(), before.draws, after.draws, before.framebufferChanges,
+                 after.framebufferChanges, before.programChanges, after.programChanges,
+                 before.textureChanges + before.vertexBufferChanges + before.indexBufferChanges,
+                 after.textureChanges + after.vertexBufferChanges + after.indexBufferChanges, ms );
+        printf ( "        state changes %d -> %d\n", before.StateChanges(), after.StateChanges() );
+    }
+
+    return 0;
+}
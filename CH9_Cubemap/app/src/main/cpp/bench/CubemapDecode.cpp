@@ -0,0 +1,103 @@
+//
+// CubemapDecode.cpp
+//
+//    Host-side run of the CPU half of CubemapLoader: decodes the six asset faces
+//    with DecodePng, builds their mip chains with DownsampleImage and reports the
+//    time of each step. Also checks that every face decodes to the size the
+//    generator wrote and that its smallest level keeps the face color. Build and
+//    run from the cpp directory:
+//
+//      g++ -O2 -std=c++17 -I. bench/CubemapDecode.cpp ImageDecode.cpp -o cubemap_decode
+//      ./cubemap_decode ../assets/cubemap
+//
+//    The faces come from tools/gen_cubemap_faces.py.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "ImageDecode.h"
+
+static const char *const kFaceNames[6] = { "posx", "negx", "posy", "negy", "posz", "negz" };
+
+// Dominant channels of each face, see the generator
+static const int kFaceColors[6][3] = {
+        { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 1, 0 }, { 1, 0, 1 }, { 1, 1, 1 }
+};
+
+static double MsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+}
+
+static bool ReadFile(const std::string &path, std::vector<unsigned char> *data) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    unsigned char buffer[16384];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data->insert(data->end(), buffer, buffer + read);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::string directory = argc > 1 ? argv[1] : "../assets/cubemap";
+    int failures = 0;
+    double totalDecodeMs = 0.0;
+    double totalMipMs = 0.0;
+
+    printf("face   size     bytes   decode ms   mips   mip ms   1x1 rgba\n");
+    for (int face = 0; face < 6; face++) {
+        std::string path = directory + "/" + kFaceNames[face] + ".png";
+        std::vector<unsigned char> data;
+        if (!ReadFile(path, &data)) {
+            printf("%s: cannot read %s\n", kFaceNames[face], path.c_str());
+            failures++;
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Image image;
+        bool ok = DecodePng(data.data(), data.size(), &image);
+        double decodeMs = MsSince(start);
+        if (!ok) {
+            printf("%s: decode failed\n", kFaceNames[face]);
+            failures++;
+            continue;
+        }
+
+        start = std::chrono::steady_clock::now();
+        int levels = MipLevelCount(image.width, image.height);
+        std::vector<Image> chain(levels);
+        chain[0] = image;
+        for (int level = 1; level < levels; level++) {
+            DownsampleImage(chain[level - 1], &chain[level]);
+        }
+        double mipMs = MsSince(start);
+
+        const unsigned char *last = chain.back().pixels.data();
+        bool colorOk = chain.back().width == 1 && chain.back().height == 1;
+        for (int c = 0; c < 3; c++) {
+            colorOk = colorOk && (last[c] > 64) == (kFaceColors[face][c] != 0);
+        }
+        if (!colorOk || image.width != 256 || image.height != 256) {
+            failures++;
+        }
+
+        printf("%s   %dx%d  %6zu   %9.3f   %4d   %6.3f   %3d %3d %3d %3d%s\n", kFaceNames[face],
+               image.width, image.height, data.size(), decodeMs, levels, mipMs, last[0], last[1],
+               last[2], last[3], colorOk ? "" : "  WRONG");
+        totalDecodeMs += decodeMs;
+        totalMipMs += mipMs;
+    }
+
+    printf("total decode %.3f ms, mips %.3f ms, %d failures\n", totalDecodeMs, totalMipMs,
+           failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+//
+// KtxReport.cpp
+//
+//    Host-side check of the KTX files loaded by KtxTexture: maps each file given
+//    on the command line, prints its format and level layout, and reports how
+//    much smaller the compressed chain is than the RGBA8 one CubemapLoader
+//    uploads. When both a .ktx and a .ktx2 are given, also checks that they hold
+//    the same blocks. No GL context is created; GLESv2 is only linked because
+//    KtxTexture also has the upload path. Build and run from the cpp directory:
+//
+//      g++ -O2 -std=c++17 -I. bench/KtxReport.cpp KtxTexture.cpp TextureFactory.cpp
+//          GLStateCache.cpp -lGLESv2 -o ktx_report
+//      ./ktx_report ../assets/cubemap/cubemap_etc2.ktx ../assets/cubemap/cubemap_etc2.ktx2
+//
+//    The files come from tools/gen_cubemap_ktx.py.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "KtxTexture.h"
+
+namespace {
+
+bool SameBlocks(const KtxTexture &a, const KtxTexture &b) {
+    if (a.InternalFormat() != b.InternalFormat() || a.Width() != b.Width()
+        || a.Height() != b.Height() || a.Faces() != b.Faces() || a.Levels() != b.Levels()) {
+        return false;
+    }
+    for (int level = 0; level < a.Levels(); level++) {
+        for (int face = 0; face < a.Faces(); face++) {
+            size_t sizeA, sizeB;
+            const void *dataA = a.FaceData(level, face, &sizeA);
+            const void *dataB = b.FaceData(level, face, &sizeB);
+            if (sizeA != sizeB || memcmp(dataA, dataB, sizeA) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s file.ktx|file.ktx2 ...\n", argv[0]);
+        return 1;
+    }
+
+    int failures = 0;
+    std::vector<std::unique_ptr<KtxTexture>> textures;
+    for (int i = 1; i < argc; i++) {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<KtxTexture> texture(new KtxTexture(nullptr, argv[i]));
+        double parseMs = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+        if (!texture->Valid()) {
+            printf("%s: FAIL %s\n", argv[i], texture->Error().c_str());
+            failures++;
+            continue;
+        }
+
+        int blockWidth, blockHeight, blockBytes;
+        TextureFactory::BlockInfo(texture->InternalFormat(), &blockWidth, &blockHeight,
+                                  &blockBytes);
+        printf("%s: KTX %s, format 0x%04x (%dx%d blocks of %d bytes), %dx%d, %d faces, "
+               "%d levels, mapped and parsed in %.3f ms\n",
+               argv[i], texture->Version() == 1 ? "1.1" : "2.0", texture->InternalFormat(),
+               blockWidth, blockHeight, blockBytes, texture->Width(), texture->Height(),
+               texture->Faces(), texture->Levels(), parseMs);
+        for (int level = 0; level < texture->Levels(); level++) {
+            size_t size;
+            texture->FaceData(level, 0, &size);
+            printf("  level %2d  %4dx%-4d  %7zu bytes per face\n", level,
+                   std::max(1, texture->Width() >> level), std::max(1, texture->Height() >> level),
+                   size);
+        }
+        printf("  %zu bytes compressed, %zu as RGBA8, %.1fx smaller\n",
+               texture->CompressedBytes(), texture->UncompressedBytes(),
+               (double) texture->UncompressedBytes() / texture->CompressedBytes());
+        textures.push_back(std::move(texture));
+    }
+
+    for (size_t i = 1; i < textures.size(); i++) {
+        if (!SameBlocks(*textures[0], *textures[i])) {
+            printf("FAIL %s and %s hold different blocks\n", argv[1], argv[i + 1]);
+            failures++;
+        }
+    }
+    if (textures.size() > 1 && failures == 0) {
+        printf("all files hold the same blocks\n");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+//
+// SphereBench.cpp
+//
+//    Host-side microbenchmark for esGenSphereFast against the reference esGenSphere
+//    in LearnES3Util.h. No GL context is created; GLESv2 is only linked because
+//    LearnES3Util.h also defines the shader helpers. Build and run from the cpp
+//    directory:
+//
+//      g++ -O2 -std=c++17 -I. bench/SphereBench.cpp LearnES3Geometry.cpp -lGLESv2 -o sphere_bench
+//      ./sphere_bench
+//
+//    Every run also checks that both generators produce bit-identical buffers.
+//
+
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+
+#include "LearnES3Util.h"
+#include "LearnES3Geometry.h"
+
+namespace {
+
+typedef int (*GenSphereFunc)(int, float, GLfloat **, GLfloat **, GLfloat **, GLuint **);
+
+struct SphereBuffers {
+    GLfloat *vertices;
+    GLfloat *normals;
+    GLfloat *texCoords;
+    GLuint *indices;
+    int numIndices;
+};
+
+void FreeBuffers(SphereBuffers *buffers) {
+    free ( buffers->vertices );
+    free ( buffers->normals );
+    free ( buffers->texCoords );
+    free ( buffers->indices );
+}
+
+//
+/// \brief Run gen until at least minSeconds have passed; return the best time of one call
+///        in milliseconds and keep the buffers of the last call in out.
+//
+double TimeGenerator(GenSphereFunc gen, int numSlices, double minSeconds, SphereBuffers *out) {
+    double best = 1e30;
+    double total = 0.0;
+    int runs = 0;
+
+    memset ( out, 0, sizeof ( *out ) );
+    while ( runs < 3 || total < minSeconds ) {
+        FreeBuffers ( out );
+
+        auto start = std::chrono::steady_clock::now();
+        out->numIndices = gen ( numSlices, 0.75f, &out->vertices, &out->normals,
+                                &out->texCoords, &out->indices );
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        total += seconds;
+        best = seconds < best ? seconds : best;
+        runs++;
+    }
+    return best * 1000.0;
+}
+
+bool SameBuffers(const SphereBuffers &a, const SphereBuffers &b, int numSlices) {
+    int numParallels = numSlices / 2;
+    size_t numVertices = ( size_t ) ( numParallels + 1 ) * ( numSlices + 1 );
+
+    return a.numIndices == b.numIndices &&
+           memcmp ( a.vertices, b.vertices, sizeof ( GLfloat ) * 3 * numVertices ) == 0 &&
+           memcmp ( a.normals, b.normals, sizeof ( GLfloat ) * 3 * numVertices ) == 0 &&
+           memcmp ( a.texCoords, b.texCoords, sizeof ( GLfloat ) * 2 * numVertices ) == 0 &&
+           memcmp ( a.indices, b.indices, sizeof ( GLuint ) * a.numIndices ) == 0;
+}
+
+} // namespace
+
+int main() {
+    const int sliceCounts[] = { 20, 64, 128, 256, 512, 1024, 2048, 4096 };
+    int failures = 0;
+
+    printf ( "%8s %12s %14s %14s %8s %s\n", "slices", "vertices", "esGenSphere", "esGenSphereFast",
+             "speedup", "match" );
+
+    for ( int numSlices : sliceCounts ) {
+        SphereBuffers reference;
+        SphereBuffers fast;
+        double minSeconds = numSlices >= 2048 ? 0.0 : 0.25;
+
+        double referenceMs = TimeGenerator ( esGenSphere, numSlices, minSeconds, &reference );
+        double fastMs = TimeGenerator ( esGenSphereFast, numSlices, minSeconds, &fast );
+        bool match = SameBuffers ( reference, fast, numSlices );
+        failures += match ? 0 : 1;
+
+        printf ( "%8d %12d %11.3f ms %12.3f ms %7.2fx %s\n", numSlices,
+                 ( numSlices / 2 + 1 ) * ( numSlices + 1 ), referenceMs, fastMs,
+                 referenceMs / fastMs, match ? "yes" : "NO" );
+
+        FreeBuffers ( &reference );
+        FreeBuffers ( &fast );
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+//
+// VertexCacheReport.cpp
+//
+//    Host-side report of index size and post-transform vertex cache efficiency of
+//    the generated sphere per tessellation level, in ring order and after
+//    esOptimizeVertexCache. Build and run from the cpp directory:
+//
+//      g++ -O2 -std=c++17 -I. bench/VertexCacheReport.cpp LearnES3Geometry.cpp -o cache_report
+//      ./cache_report
+//
+//    ACMR is cache misses per triangle (0.5 is the limit for a regular grid),
+//    ATVR is misses per vertex (1.0 means every vertex is transformed once).
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "LearnES3Geometry.h"
+
+int main() {
+    const int sliceCounts[] = { 20, 32, 64, 128, 256, 360, 512 };
+    const int cacheSizes[] = { 16, 32 };
+
+    printf ( "%6s %8s %9s %6s %9s", "slices", "vertices", "triangles", "index", "bytes" );
+    for ( int cacheSize : cacheSizes ) {
+        printf ( "   fifo%-2d ACMR/ATVR row -> optimized", cacheSize );
+    }
+    printf ( " %10s\n", "optimize" );
+
+    for ( int numSlices : sliceCounts ) {
+        int numVertices = ( numSlices / 2 + 1 ) * ( numSlices + 1 );
+        GLenum indexType;
+        void *narrow;
+        GLuint *rowOrder;
+        int numIndices = esGenSphereIndices ( numSlices, 0, &indexType, &narrow );
+        free ( narrow );
+
+        esGenSphereFast ( numSlices, 1.0f, NULL, NULL, NULL, &rowOrder );
+
+        GLuint *optimized = ( GLuint * ) malloc ( sizeof ( GLuint ) * numIndices );
+        for ( int i = 0; i < numIndices; i++ ) {
+            optimized[i] = rowOrder[i];
+        }
+        auto start = std::chrono::steady_clock::now();
+        esOptimizeVertexCache ( optimized, numIndices, numVertices );
+        auto end = std::chrono::steady_clock::now();
+
+        printf ( "%6d %8d %9d %6s %9d", numSlices, numVertices, numIndices / 3,
+                 indexType == GL_UNSIGNED_SHORT ? "16bit" : "32bit",
+                 numIndices * esIndexTypeSize ( indexType ) );
+
+        for ( int cacheSize : cacheSizes ) {
+            float rowAcmr, rowAtvr, optAcmr, optAtvr;
+            esMeasureVertexCache ( rowOrder, numIndices, numVertices, cacheSize, &rowAcmr, &rowAtvr );
+            esMeasureVertexCache ( optimized, numIndices, numVertices, cacheSize, &optAcmr, &optAtvr );
+            printf ( "   %5.3f/%5.3f -> %5.3f/%5.3f     ", rowAcmr, rowAtvr, optAcmr, optAtvr );
+        }
+        printf ( " %7.2f ms\n", std::chrono::duration<double, std::milli>(end - start).count() );
+
+        free ( rowOrder );
+        free ( optimized );
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+#
+# gen_cubemap_faces.py
+#
+#    Writes the six cubemap faces loaded by CubemapLoader to
+#    app/src/main/assets/cubemap. Each face keeps the color of the old 1x1
+#    cubemap (red, green, blue, yellow, purple, white for +X -X +Y -Y +Z -Z),
+#    shaded by a checkerboard and a vignette so that mip levels and filtering
+#    are visible on the sphere.
+#
+#    Only the standard library is used. Rows cycle through all five PNG filter
+#    types so the decoder in ImageDecode.cpp sees each of them. Run from the
+#    CH9_Cubemap directory:
+#
+#      python3 tools/gen_cubemap_faces.py
+#
+
+import os
+import struct
+import zlib
+
+SIZE = 256
+CHECKER = 32
+
+# GL face order, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+FACES = [
+    ("posx", (255, 0, 0)),
+    ("negx", (0, 255, 0)),
+    ("posy", (0, 0, 255)),
+    ("negy", (255, 255, 0)),
+    ("posz", (255, 0, 255)),
+    ("negz", (255, 255, 255)),
+]
+
+
+def face_pixels(color):
+    rows = []
+    half = (SIZE - 1) / 2.0
+    for y in range(SIZE):
+        row = bytearray()
+        for x in range(SIZE):
+            dx = (x - half) / half
+            dy = (y - half) / half
+            vignette = 1.0 - 0.35 * min(1.0, (dx * dx + dy * dy) / 2.0)
+            checker = 1.0 if ((x // CHECKER) + (y // CHECKER)) % 2 == 0 else 0.6
+            scale = vignette * checker
+            row.extend(int(c * scale + 0.5) for c in color)
+        rows.append(bytes(row))
+    return rows
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def filter_row(kind, row, prior, bpp):
+    out = bytearray([kind])
+    for i, value in enumerate(row):
+        a = row[i - bpp] if i >= bpp else 0
+        b = prior[i]
+        c = prior[i - bpp] if i >= bpp else 0
+        predictor = (0, a, b, (a + b) // 2, paeth(a, b, c))[kind]
+        out.append((value - predictor) & 0xFF)
+    return bytes(out)
+
+
+def chunk(kind, data):
+    body = kind + data
+    return struct.pack(">I", len(data)) + body + struct.pack(">I", zlib.crc32(body) & 0xFFFFFFFF)
+
+
+def write_png(path, rows):
+    bpp = 3
+    prior = bytes(SIZE * bpp)
+    raw = bytearray()
+    for y, row in enumerate(rows):
+        raw.extend(filter_row(y % 5, row, prior, bpp))
+        prior = row
+    header = struct.pack(">IIBBBBB", SIZE, SIZE, 8, 2, 0, 0, 0)
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n")
+        f.write(chunk(b"IHDR", header))
+        f.write(chunk(b"IDAT", zlib.compress(bytes(raw), 9)))
+        f.write(chunk(b"IEND", b""))
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    out_dir = os.path.join(root, "app", "src", "main", "assets", "cubemap")
+    os.makedirs(out_dir, exist_ok=True)
+    for name, color in FACES:
+        path = os.path.join(out_dir, name + ".png")
+        write_png(path, face_pixels(color))
+        print("wrote", path)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+#
+# gen_cubemap_ktx.py
+#
+#    Writes the faces of gen_cubemap_faces.py as an ETC2 compressed cubemap with
+#    a full mip chain, once as KTX 1.1 and once as KTX 2.0, to
+#    app/src/main/assets/cubemap. KtxTexture uploads either one straight from the
+#    mapped asset.
+#
+#    The encoder is deliberately trivial: every 4x4 block is stored as its mean
+#    color in ETC1-compatible differential mode with zero deltas. That is enough
+#    for the flat checkerboard faces and is valid GL_COMPRESSED_RGB8_ETC2 data.
+#    Run from the CH9_Cubemap directory:
+#
+#      python3 tools/gen_cubemap_ktx.py
+#
+
+import os
+import struct
+
+from gen_cubemap_faces import FACES, SIZE, face_pixels
+
+GL_COMPRESSED_RGB8_ETC2 = 0x9274
+GL_RGB = 0x1907
+VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK = 147
+
+# Data Format Descriptor constants, Khronos Data Format Specification 1.3
+KHR_DF_MODEL_ETC2 = 161
+KHR_DF_CHANNEL_ETC2_COLOR = 2
+KHR_DF_PRIMARIES_BT709 = 1
+KHR_DF_TRANSFER_LINEAR = 1
+
+KTX1_IDENTIFIER = b"\xabKTX 11\xbb\r\n\x1a\n"
+KTX2_IDENTIFIER = b"\xabKTX 20\xbb\r\n\x1a\n"
+
+
+def to_image(rows):
+    # rows of packed RGB bytes -> list of rows of (r, g, b)
+    return [[tuple(row[x * 3:x * 3 + 3]) for x in range(len(row) // 3)] for row in rows]
+
+
+def downsample(image):
+    h = len(image)
+    w = len(image[0])
+    nh = max(1, h // 2)
+    nw = max(1, w // 2)
+    out = []
+    for y in range(nh):
+        row = []
+        for x in range(nw):
+            pixels = [image[min(sy, h - 1)][min(sx, w - 1)]
+                      for sy in (2 * y, 2 * y + 1) for sx in (2 * x, 2 * x + 1)]
+            row.append(tuple((sum(p[c] for p in pixels) + 2) // 4 for c in range(3)))
+        out.append(row)
+    return out
+
+
+def encode_block(pixels):
+    # Differential mode, table 0, every pixel index 0, so each pixel is base + 2
+    block = 0
+    for c in range(3):
+        mean = sum(p[c] for p in pixels) / len(pixels)
+        value5 = max(0, min(31, int(round((mean - 2) * 31 / 255))))
+        block |= value5 << (59 - 8 * c)
+    block |= 1 << 33
+    return struct.pack(">Q", block)
+
+
+def encode_level(image):
+    h = len(image)
+    w = len(image[0])
+    data = bytearray()
+    for by in range(0, max(h, 4), 4):
+        for bx in range(0, max(w, 4), 4):
+            pixels = [image[min(by + y, h - 1)][min(bx + x, w - 1)]
+                      for y in range(4) for x in range(4)]
+            data += encode_block(pixels)
+    return bytes(data)
+
+
+def build_levels():
+    # levels[level][face] = compressed bytes
+    chains = []
+    for _, color in FACES:
+        image = to_image(face_pixels(color))
+        chain = [encode_level(image)]
+        while len(image) > 1:
+            image = downsample(image)
+            chain.append(encode_level(image))
+        chains.append(chain)
+    return [[chains[face][level] for face in range(6)] for level in range(len(chains[0]))]
+
+
+def write_ktx1(path, levels):
+    header = struct.pack("<13I", 0x04030201, 0, 1, 0, GL_COMPRESSED_RGB8_ETC2, GL_RGB,
+                         SIZE, SIZE, 0, 0, 6, len(levels), 0)
+    with open(path, "wb") as f:
+        f.write(KTX1_IDENTIFIER + header)
+        for faces in levels:
+            # imageSize is one face for non-array cubemaps, blocks are 8 bytes so no padding
+            f.write(struct.pack("<I", len(faces[0])))
+            for face in faces:
+                f.write(face)
+
+
+def dfd_etc2():
+    samples = struct.pack("<IIII", (KHR_DF_CHANNEL_ETC2_COLOR << 24) | (63 << 16) | 0,
+                          0, 0, 0xFFFFFFFF)
+    block_size = 24 + len(samples)
+    block = struct.pack("<IIBBBBBBBBBBBBBBBB",
+                        0,                                    # vendorId 0, descriptorType 0
+                        2 | (block_size << 16),               # versionNumber 2, size
+                        KHR_DF_MODEL_ETC2, KHR_DF_PRIMARIES_BT709, KHR_DF_TRANSFER_LINEAR, 0,
+                        3, 3, 0, 0,                           # texel block 4x4 (minus one)
+                        8, 0, 0, 0, 0, 0, 0, 0) + samples     # bytesPlane0 = 8
+    return struct.pack("<I", 4 + len(block)) + block
+
+
+def align(value, alignment):
+    return (value + alignment - 1) // alignment * alignment
+
+
+def write_ktx2(path, levels):
+    level_count = len(levels)
+    index_end = 12 + 36 + 32 + 24 * level_count
+    dfd = dfd_etc2()
+    dfd_offset = index_end
+    data_start = align(dfd_offset + len(dfd), 8)
+
+    # Mip levels are stored smallest first, each aligned to the 8 byte block size
+    offsets = [0] * level_count
+    position = data_start
+    for level in reversed(range(level_count)):
+        position = align(position, 8)
+        offsets[level] = position
+        position += sum(len(face) for face in levels[level])
+
+    header = struct.pack("<9I", VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, 1, SIZE, SIZE, 0, 0, 6,
+                         level_count, 0)
+    index = struct.pack("<4I2Q", dfd_offset, len(dfd), 0, 0, 0, 0)
+    level_index = b"".join(struct.pack("<3Q", offsets[level],
+                                       sum(len(face) for face in levels[level]),
+                                       sum(len(face) for face in levels[level]))
+                           for level in range(level_count))
+
+    out = bytearray(KTX2_IDENTIFIER + header + index + level_index + dfd)
+    for level in reversed(range(level_count)):
+        out += bytes(offsets[level] - len(out))
+        for face in levels[level]:
+            out += face
+    with open(path, "wb") as f:
+        f.write(out)
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    out_dir = os.path.join(root, "app", "src", "main", "assets", "cubemap")
+    os.makedirs(out_dir, exist_ok=True)
+    levels = build_levels()
+    for name, writer in (("cubemap_etc2.ktx", write_ktx1), ("cubemap_etc2.ktx2", write_ktx2)):
+        path = os.path.join(out_dir, name)
+        writer(path, levels)
+        print("wrote", path, os.path.getsize(path), "bytes")
+
+
+if __name__ == "__main__":
+    main()